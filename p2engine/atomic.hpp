@@ -22,6 +22,10 @@
 
 #include "p2engine/push_warning_option.hpp"
 
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#	pragma intrinsic(_ReadWriteBarrier)
+#endif
 #ifdef USING_BOOST_PROCESS_ATOMIC
 #	include <boost/interprocess/detail/atomic.hpp>
 #elif defined(USEING_GNU_ATOMIC)
@@ -120,6 +124,41 @@ namespace p2engine{
 		mutable detail::atomic_t value_;
 	};
 
+	//word-sized(pointer or integer) access to a variable that a thread 
+	//publishes to the others without a lock: what the thread wrote before 
+	//store_release is visible to a thread after its load_acquire of the value.
+	template <typename T>
+	inline T load_acquire(const volatile T& v)
+	{
+		BOOST_STATIC_ASSERT(sizeof(T)<=sizeof(void*));
+#if defined(_MSC_VER)
+		T r=v;//x86/x64 loads are not reordered with later accesses
+		_ReadWriteBarrier();
+		return r;
+#elif defined(__ATOMIC_ACQUIRE)
+		return __atomic_load_n(&v,__ATOMIC_ACQUIRE);
+#else
+		T r=v;
+		__sync_synchronize();
+		return r;
+#endif
+	}
+
+	template <typename T>
+	inline void store_release(volatile T& v, T val)
+	{
+		BOOST_STATIC_ASSERT(sizeof(T)<=sizeof(void*));
+#if defined(_MSC_VER)
+		_ReadWriteBarrier();//x86/x64 stores are not reordered with earlier ones
+		v=val;
+#elif defined(__ATOMIC_RELEASE)
+		__atomic_store_n(&v,val,__ATOMIC_RELEASE);
+#else
+		__sync_synchronize();
+		v=val;
+#endif
+	}
+
 }
 
 #endif//p2engine_atomic_hpp__
@@ -41,11 +41,18 @@
 # pragma once
 #endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
 
+#include "p2engine/push_warning_option.hpp"
+#include <vector>
+#include "p2engine/pop_warning_option.hpp"
+
 #include "p2engine/basic_object.hpp"
 #include "p2engine/intrusive_ptr_base.hpp"
+#include "p2engine/mutex.hpp"
 
 namespace p2engine {
 
+	class raw_buffer_pool;
+
 	class raw_buffer 
 		:public basic_intrusive_ptr<raw_buffer>
 	{
@@ -55,7 +62,7 @@ namespace p2engine {
 		typedef object_allocator::memory_pool_type memory_pool_type;
 
 	private:
-		raw_buffer(std::size_t length):length_(length)
+		raw_buffer(std::size_t length):length_(length),pool_(NULL)
 		{
 			DEBUG_SCOPE(released_in_the_proper_way_=(int64_t)(void*)this;);
 		}
@@ -87,15 +94,7 @@ namespace p2engine {
 
 			return intrusive_ptr(ptr);
 		}
-		static void release(const raw_buffer* p)
-		{
-			DEBUG_SCOPE(BOOST_ASSERT(p->released_in_the_proper_way_==(int64_t)(void*)p));
-			DEBUG_SCOPE(p->released_in_the_proper_way_=8256272458LL;);
-			DEBUG_SCOPE(counter()--;);
-
-			p->~raw_buffer();
-			memory_pool_type::free(p->orig_ptr());
-		}
+		static void release(const raw_buffer* p);
 		std::size_t length() const {return length_;}
 		std::size_t size() const {return length_;}
 		char* buffer() 
@@ -131,8 +130,140 @@ namespace p2engine {
 		);
 		std::size_t length_;
 		int8_t replacement_new_offset_;
+		mutable raw_buffer_pool* pool_;//the pool it will be returned to
+
+		friend class raw_buffer_pool;
+	};
+
+	//a free-list of raw_buffers of the same length. A buffer handed out by
+	//alloc() returns to the list when its last reference dies instead of 
+	//being freed, so a steady stream of short lived buffers(e.g. received 
+	//datagrams) costs no malloc. The pool lives until the last buffer it 
+	//handed out is gone; after close() buffers are freed as usual.
+	class raw_buffer_pool
+		:public basic_intrusive_ptr<raw_buffer_pool>
+	{
+		typedef raw_buffer_pool this_type;
+		SHARED_ACCESS_DECLARE;
+
+	public:
+		struct statistics
+		{
+			uint64_t allocs;//buffers created by raw_buffer::create
+			uint64_t reuses;//buffers taken from the free-list
+			uint64_t recycles;//buffers returned to the free-list
+
+			statistics():allocs(0),reuses(0),recycles(0){}
+		};
+
+	private:
+		raw_buffer_pool(std::size_t bufferLen,std::size_t maxCached)
+			:buffer_len_(bufferLen),max_cached_(maxCached),closed_(false)
+		{
+			free_list_.reserve(maxCached);
+		}
+		~raw_buffer_pool()
+		{
+			close();
+		}
+
+	public:
+		static intrusive_ptr create(std::size_t bufferLen,std::size_t maxCached)
+		{
+			return intrusive_ptr(new this_type(bufferLen,maxCached));
+		}
+
+		std::size_t buffer_length()const
+		{
+			return buffer_len_;
+		}
+
+		raw_buffer::intrusive_ptr alloc()
+		{
+			raw_buffer::intrusive_ptr buf;
+			{
+				fast_mutex::scoped_lock lock(mutex_);
+				if (!free_list_.empty())
+				{
+					buf=raw_buffer::intrusive_ptr(free_list_.back());
+					free_list_.pop_back();
+					++stats_.reuses;
+				}
+				else
+				{
+					++stats_.allocs;
+				}
+			}
+			if (!buf)
+				buf=raw_buffer::create(buffer_len_);
+			if (buf)
+			{
+				BOOST_ASSERT(!buf->pool_);
+				buf->pool_=this;
+				intrusive_ptr_add_ref(this);
+			}
+			return buf;
+		}
+
+		//free the cached buffers and stop caching
+		void close()
+		{
+			std::vector<raw_buffer*> freeList;
+			{
+				fast_mutex::scoped_lock lock(mutex_);
+				closed_=true;
+				free_list_.swap(freeList);
+			}
+			for (std::size_t i=0;i<freeList.size();++i)
+				raw_buffer::release(freeList[i]);
+		}
+
+		statistics stats()const
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			return stats_;
+		}
+
+	private:
+		friend class raw_buffer;
+		bool recycle(const raw_buffer* p)
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			if (closed_||free_list_.size()>=max_cached_)
+				return false;
+			free_list_.push_back(const_cast<raw_buffer*>(p));
+			++stats_.recycles;
+			return true;
+		}
+
+	private:
+		mutable fast_mutex mutex_;
+		std::vector<raw_buffer*> free_list_;
+		std::size_t buffer_len_;
+		std::size_t max_cached_;
+		bool closed_;
+		statistics stats_;
 	};
 
+	inline void raw_buffer::release(const raw_buffer* p)
+	{
+		if (raw_buffer_pool* pool=p->pool_)
+		{
+			p->pool_=NULL;
+			bool recycled=pool->recycle(p);
+			intrusive_ptr_release(pool);
+			if (recycled)
+				return;
+		}
+
+		DEBUG_SCOPE(BOOST_ASSERT(p->released_in_the_proper_way_==(int64_t)(void*)p));
+		DEBUG_SCOPE(p->released_in_the_proper_way_=8256272458LL;);
+		DEBUG_SCOPE(counter()--;);
+
+		p->~raw_buffer();
+		memory_pool_type::free(p->orig_ptr());
+	}
+
 	//to make  raw_buffer be deleted in the right way
 	template<>
 	struct  shared_access_destroy<const raw_buffer>
@@ -23,7 +23,12 @@
 # pragma once
 #endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
 
+#include "p2engine/push_warning_option.hpp"
 #include "p2engine/config.hpp"
+#include <vector>
+#include <boost/weak_ptr.hpp>
+#include "p2engine/pop_warning_option.hpp"
+
 #include "p2engine/handler_allocator.hpp"
 #include "p2engine/local_id_allocator.hpp"
 #include "p2engine/fssignal.hpp"
@@ -33,7 +38,14 @@
 #include "p2engine/rdp/rdp_fwd.hpp"
 #include "p2engine/fast_stl.hpp"
 
-namespace p2engine { namespace trdp{
+//accept on the threads of an io_service_pool by SO_REUSEPORT
+#if (defined(LINUX_OS)||defined(ANDROID_OS)) && defined(SO_REUSEPORT)
+#	define TRDP_REUSE_PORT
+#endif
+
+namespace p2engine { 
+	class io_service_pool;
+namespace trdp{
 
 	class trdp_flow;
 
@@ -56,7 +68,14 @@ namespace p2engine { namespace trdp{
 		typedef boost::shared_ptr<shared_layer_type>shared_layer_sptr;
 
 	protected:
-		typedef boost::unordered_map<std::string, acceptor_type*> acceptor_container;
+		//the acceptor is taken by a weak_ptr, so that a flow can hand itself 
+		//to it with mutex_ released
+		struct acceptor_element
+		{
+			acceptor_type* acceptor;
+			boost::weak_ptr<acceptor_type> ptr;
+		};
+		typedef boost::unordered_map<std::string, acceptor_element> acceptor_container;
 		typedef std::map<endpoint_type, this_type*>   this_type_container;
 
 	public:
@@ -98,7 +117,7 @@ namespace p2engine { namespace trdp{
 		static boost::shared_ptr<acceptor_token> create_acceptor_token(
 			io_service& ios,
 			const endpoint_type& local_edp,
-			acceptor_type& acceptor,
+			acceptor_sptr acceptor,
 			const std::string domainName,
 			error_code& ec,
 			bool realTimeUsage=true
@@ -118,11 +137,29 @@ namespace p2engine { namespace trdp{
 
 		acceptor_type* find_acceptor(const std::string& domainName);
 
+		//called by a flow that has read the domain it requests, in the thread
+		//of the flow. false if no acceptor listens on the domain.
+		bool accept_flow(const std::string& domainName, flow_sptr flow);
+
 		bool is_real_time_usage()const
 		{
 			return b_real_time_usage_;
 		}
 
+		//  Layers created after the call accept on all the io_services of the 
+		//pool: with SO_REUSEPORT one acceptor socket on each of them is bound
+		//to the port and the kernel spreads the connections among them; 
+		//otherwise the sockets accepted are handed to them round robin. The
+		//domain handshake of a socket, its flow and the connection accepted 
+		//run on that io_service. NULL accepts on the io_service of the layer.
+		static void accept_on_pool(const boost::shared_ptr<io_service_pool>& pool);
+
+		//the sockets listening on the port
+		std::size_t acceptor_count()const
+		{
+			return 1+reuse_port_acceptors_.size();
+		}
+
 	protected:
 		basic_shared_tcp_layer(io_service& ios, 
 			const endpoint_type& local_edp,
@@ -133,12 +170,17 @@ namespace p2engine { namespace trdp{
 
 		void cancel_without_protector();
 
-		void handle_accept(const error_code& ec, flow_sptr flow);
+		//acc accepts on accIos
+		void handle_accept(const error_code& ec, flow_sptr flow, 
+			tcp_acceptor_type* acc, io_service* accIos);
+
+		void async_accept(tcp_acceptor_type& acc, io_service& accIos);
 
-		void async_accept();
+		void __set_options(tcp_acceptor_type& acc, error_code& ec);
+		void __open_reuse_port_acceptors();
 
 	protected:
-		error_code register_acceptor(acceptor_type& acc,
+		error_code register_acceptor(acceptor_sptr acc,
 			const std::string& domainName,error_code& ec);
 
 		void  unregister_acceptor(const acceptor_type& acptor);
@@ -155,11 +197,17 @@ namespace p2engine { namespace trdp{
 
 	protected:
 		tcp_acceptor_type tcp_acceptor_;
+		std::vector<std::pair<boost::shared_ptr<tcp_acceptor_type>, io_service*> > 
+			reuse_port_acceptors_;
+		boost::shared_ptr<io_service_pool> accept_pool_;
 		endpoint_type local_endpoint_;
 		acceptor_container	  acceptors_;
 		int                   state_;
 		timed_keeper_set<flow_sptr> flow_keeper_;
 		bool b_real_time_usage_;
+		fast_mutex mutex_;//of acceptors_ and flow_keeper_, which the pool shares
+
+		static boost::shared_ptr<io_service_pool> s_accept_ios_pool_;
 
 		static this_type_container s_this_type_pool_;
 		static boost::mutex s_this_type_pool_mutex_;
@@ -30,6 +30,11 @@
 #include <list>
 #include <boost/noncopyable.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#if defined(LINUX_OS)||defined(ANDROID_OS)
+#	include <sys/socket.h>
+#	include <sys/uio.h>
+#endif
 #include "p2engine/pop_warning_option.hpp"
 
 #include "p2engine/handler_allocator.hpp"
@@ -40,13 +45,30 @@
 #include "p2engine/local_id_allocator.hpp"
 #include "p2engine/keeper.hpp"
 #include "p2engine/speed_meter.hpp"
+#include "p2engine/timer.hpp"
 #include "p2engine/trafic_statistics.hpp"
 #include "p2engine/rdp/const_define.hpp"
+#include "p2engine/rdp/network_simulator.hpp"
 #include "p2engine/fast_stl.hpp"
+#include "p2engine/atomic.hpp"
 
 #define RUDP_SCRAMBLE
 
-namespace p2engine { namespace urdp{
+//use recvmmsg/sendmmsg to receive/send several datagrams in one syscall 
+//when they are available
+#if (defined(LINUX_OS)||defined(ANDROID_OS)) && defined(MSG_WAITFORONE)
+#	define RUDP_BATCH_RECV
+#	define RUDP_BATCH_SEND
+#endif
+
+//shard a port among the threads of an io_service_pool by SO_REUSEPORT
+#if (defined(LINUX_OS)||defined(ANDROID_OS)) && defined(SO_REUSEPORT)
+#	define RUDP_REUSE_PORT
+#endif
+
+namespace p2engine { 
+	class io_service_pool;
+namespace urdp{
 
 	class basic_shared_udp_layer 
 		: public basic_engine_object
@@ -64,24 +86,47 @@ namespace p2engine { namespace urdp{
 
 		typedef boost::function<void(safe_buffer&,const endpoint&)> 
 			recvd_data_handler_type;
-		typedef boost::function<int(const endpoint&)> 
+		//the second param is the layer that received the request, the 
+		//passive flow should be registered to it.
+		typedef boost::function<int(const endpoint&,const shared_layer_sptr&)> 
 			recvd_request_handler_type;
-
-		struct flow_element
+		typedef boost::function<void()> pacing_handler_type;
+
+		//the flow table is read by the receiving thread without any lock.
+		//slots live in chunks that never move once they are allocated, and 
+		//the generation of a slot is odd while a flow is registered in it.
+		//register/unregister are still serialized by flow_mutex_, and publish
+		//a chunk and a generation by store_release after what they guard has
+		//been written; the receiver reads them by load_acquire. A released
+		//slot keeps its handler until the id is recycled(ids are not reused 
+		//in 64s), so a receiver racing with unregister_flow never touches a
+		//half-destroyed handler.
+		enum{
+			FLOW_CHUNK_BITS=10,
+			FLOW_CHUNK_SIZE=(1<<FLOW_CHUNK_BITS),
+			FLOW_CHUNK_CNT=(INVALID_FLOWID>>FLOW_CHUNK_BITS)+1
+		};
+		struct flow_slot
 			:object_allocator
 		{
+			volatile uint32_t generation;
 			recvd_data_handler_type handler;
 			void* flow;
 
-			flow_element()
-				:flow(NULL){}
-			flow_element(const recvd_data_handler_type& h,void* f)
-				:handler(h),flow(f){}
-
-			void reset()
+			flow_slot()
+				:generation(0),flow(NULL){}
+			uint32_t current_generation()const
+			{
+				return load_acquire(generation);
+			}
+			bool is_registered()const
 			{
-				flow=NULL;
-				handler=recvd_data_handler_type();
+				return (current_generation()&1)!=0;
+			}
+			//writers only, under flow_mutex_
+			void next_generation()
+			{
+				store_release(generation,generation+1);
 			}
 		};
 		struct acceptor_element 
@@ -93,8 +138,35 @@ namespace p2engine { namespace urdp{
 			acceptor_element():acceptor(NULL){}
 		};
 
+		//domain bytes of a CONNECT packet, looked up in acceptors_ in place 
+		//so that no std::string is built per request.
+		struct domain_ref
+		{
+			const char* data;
+			std::size_t len;
+		};
+		struct domain_ref_hash
+		{
+			std::size_t operator()(const domain_ref& d)const
+			{
+				//same as boost::hash<std::string>
+				return boost::hash_range(d.data,d.data+d.len);
+			}
+		};
+		struct domain_ref_equal
+		{
+			bool operator()(const domain_ref& d,const std::string& s)const
+			{
+				return d.len==s.length()&&s.compare(0,s.length(),d.data,d.len)==0;
+			}
+			bool operator()(const std::string& s,const domain_ref& d)const
+			{
+				return (*this)(d,s);
+			}
+		};
+
 		typedef boost::unordered_map<std::string,acceptor_element> acceptor_container;
-		typedef std::vector<flow_element>			flow_container;
+		typedef std::vector<flow_slot*>			flow_container;
 		typedef boost::unordered_map<int,std::list<safe_buffer> >  linger_send_container;
 		typedef std::map<endpoint_type, this_type*>			this_type_container;
 
@@ -103,6 +175,51 @@ namespace p2engine { namespace urdp{
 	public:
 		enum{INIT,STARTED,STOPED};
 
+		struct send_batch_statistics
+		{
+			uint64_t flushes;//times the send queue was flushed
+			uint64_t syscalls;//sendmmsg calls
+			uint64_t datagrams;//datagrams sent by sendmmsg
+			uint64_t fallbacks;//datagrams sent by async_send_to when sendmmsg failed
+			uint64_t gso_sends;//super buffers segmented by the kernel
+			uint64_t gso_segments;//datagrams sent in super buffers
+			uint64_t gso_layers;//layers that send with GSO(the kernel has it)
+			std::size_t max_batch;
+			uint64_t batch_histogram[8];//batch size of [1],[2,3],[4,7]...[128,inf)
+
+			send_batch_statistics()
+			{
+				memset(this,0,sizeof(*this));
+			}
+		};
+
+		struct recv_batch_statistics
+		{
+			uint64_t syscalls;//recvmmsg calls
+			uint64_t datagrams;//datagrams received by recvmmsg
+			uint64_t gro_datagrams;//datagrams coalesced by the kernel
+			uint64_t gro_segments;//datagrams split from coalesced ones
+			uint64_t gro_layers;//layers that receive with GRO(the kernel has it)
+
+			recv_batch_statistics()
+			{
+				memset(this,0,sizeof(*this));
+			}
+		};
+
+		struct pacing_statistics
+		{
+			uint64_t schedules;//wakeups asked by paced flows
+			uint64_t wakeups;//handlers called
+			uint64_t timer_fires;//one fire may wake up several flows
+			std::size_t max_pending;
+
+			pacing_statistics()
+			{
+				memset(this,0,sizeof(*this));
+			}
+		};
+
 		struct flow_token:basic_object,basic_intrusive_ptr<flow_token>
 		{
 			typedef flow_token this_type;
@@ -204,9 +321,105 @@ namespace p2engine { namespace urdp{
 			return flows_cnt_;
 		}
 
+		//a sharded layer is one of the sockets bound to the same port by 
+		//SO_REUSEPORT. Each shard runs on its own io_service and owns the
+		//flows that it receives traffic of.
+		bool is_sharded()const
+		{
+			return shard_group_.get()!=NULL;
+		}
+
+		//the kernel delivers the packets of a flow to the shard that owns it
+		//(by a BPF program on the flow id), rather than by the 4-tuple hash.
+		//Packets of a steered group are only forwarded between shards after
+		//a shard has been closed.
+		bool is_steered()const
+		{
+			return shard_group_&&shard_group_->steered;
+		}
+
+		//layers created after the call, are sharded to all the io_services of
+		//the pool(one socket for each). NULL disables sharding.
+		static void shard_by_reuse_port(const boost::shared_ptr<io_service_pool>& pool);
+
+		//max datagrams received in one syscall. 1 means one datagram per 
+		//receive(the old path). it only affects layers created after the call.
+		static void recv_batch_size(std::size_t n);
+		static std::size_t recv_batch_size()
+		{
+			return s_recv_batch_size_;
+		}
+
+		//max datagrams queued before the send queue is flushed by sendmmsg.
+		//1 means send each datagram at once(the old path).
+		static void send_batch_size(std::size_t n);
+		static std::size_t send_batch_size()
+		{
+			return s_send_batch_size_;
+		}
+
+		send_batch_statistics send_batch_stats()const;
+		recv_batch_statistics recv_batch_stats()const;
+
+		//receive buffers are taken from a free-list and go back to it when 
+		//the last safe_buffer referring to them dies. allocs stays constant
+		//once the layer runs in steady state.
+		raw_buffer_pool::statistics recv_buffer_stats()const;
+
+		pacing_statistics pacing_stats()const;
+
+		//sum of all the shared layers that are alive
+		static send_batch_statistics total_send_batch_stats();
+		static recv_batch_statistics total_recv_batch_stats();
+		static raw_buffer_pool::statistics total_recv_buffer_stats();
+		static pacing_statistics total_pacing_stats();
+
+		//UDP segmentation offload for the send queue(on by default) and 
+		//receive offload(off by default, it needs 64k receive buffers).
+		//the kernel support is probed and falls back automatically. 
+		//they only affect layers created after the call.
+		static void use_udp_gso(bool enable);
+		static void use_udp_gro(bool enable);
+
+		//  Sends with the DF bit and receives datagrams up to MAX_MTU_SIZE, so
+		//that the flows can find the path MTU by probing(off by default). An
+		//unreliable message longer than the path MTU is lost then. It only
+		//affects layers created after the call.
+		static void use_path_mtu_discovery(bool enable);
+		bool is_path_mtu_discovery()const
+		{
+			return b_path_mtu_discovery_;
+		}
+
+		//  For test. Datagrams whose UDP payload is longer than mtu are dropped
+		//when they are sent, as a path with a lower MTU does. 0 disables it.
+		static void simulate_path_mtu(std::size_t mtu);
+
+		//  For test. The datagrams sent by all layers go through a simulated
+		//path(see network_conditions) before they are sent, until it is 
+		//called with the default network_conditions. It is in the layer for
+		//every flow(and shard) sends through it, there is no socket under it
+		//to put a decorator on; when off it costs a flag load per datagram,
+		//when on a copy of each datagram, which waits in the simulator.
+		//It can be called from any thread.
+		static void simulate_network(const network_conditions& cond);
+		static network_conditions simulated_network();
+		network_simulator::statistics simulator_stats()const;
+		static network_simulator::statistics total_simulator_stats();
+
 	protected:
 		basic_shared_udp_layer(io_service& ios, const endpoint_type& local_edp,
-			error_code& ec);
+			error_code& ec, bool reusePort=false);
+
+		static shared_ptr __create_shards(io_service& ios, 
+			const endpoint_type& local_edp, error_code& ec);
+		shared_ptr __select_shard(io_service& ios);
+		std::vector<shared_ptr> __shards();
+		static bool __steer_shards(const std::vector<shared_ptr>& shards);
+		static std::vector<shared_ptr> __all_layers();
+		uint32_t __to_wire_flow_id(uint32_t localID)const;
+		uint32_t __to_local_flow_id(uint32_t wireID)const;
+		void __handle_forwarded_msg(safe_buffer& buffer, const endpoint_type& from);
 
 		void start();
 
@@ -225,8 +438,31 @@ namespace p2engine { namespace urdp{
 
 		void handle_receive(const error_code& ec, std::size_t bytes_transferred);
 		void async_receive();
+#ifdef RUDP_BATCH_RECV
+		void __batch_receive();
+#endif
+
+		//send all datagrams queued during this handler run
+		void __flush_send_queue();
+#ifdef RUDP_BATCH_SEND
+		void __do_flush_send_queue();
+		std::size_t __queue_send(const safe_buffer* bufs, std::size_t cnt,
+			const endpoint_type& ep);
+		struct pending_datagram;
+		std::size_t __send_datagram_size(const pending_datagram& dgram)const;
+		std::size_t __fill_send_iovecs(const pending_datagram& dgram,
+			std::size_t& iovCnt);
+#endif
 
 	protected:
+		error_code __register_acceptor(const void* acc,
+			const std::string& domainName,
+			const recvd_request_handler_type& callBack,
+			error_code& ec
+			);
+		void __unregister_acceptor(const void*acptor);
+
+		//register/unregister the acceptor to all shards
 		error_code register_acceptor(const void* acc,
 			const std::string& domainName,
 			const recvd_request_handler_type& callBack,
@@ -263,8 +499,33 @@ namespace p2engine { namespace urdp{
 		std::size_t async_send_to(const ConstBuffers& bufs,
 			const endpoint_type& ep,error_code& ec);
 
+		//  Calls handler after delay_msec, in the io_service of the layer. A 
+		//flow held back by pacing uses it to be woken up, so that one timer 
+		//serves all the paced flows of the layer instead of one each. The
+		//handler must dispatch to the io_service of the flow itself.
+		void schedule_pacing(const pacing_handler_type& handler, long delay_msec);
+
 	protected:
+		void __arm_pacing_timer();
+		void __on_pacing_timer(VC9_BIND_BUG_PARAM_DECLARE);
+
+		void __send_to(const safe_buffer& safebuffer, const endpoint_type& ep);
+		void __simulate(const safe_buffer& safebuffer, const endpoint_type& ep);
+		void __on_simulator_wakeup();
+
+		static bool __exceeds_simulated_path_mtu(std::size_t len)
+		{
+#ifdef RUDP_SCRAMBLE
+			len+=8;
+#endif
+			std::size_t mtu=load_acquire(s_simulated_path_mtu_);
+			return mtu&&len>mtu;
+		}
+
 		void __release_flow_id(int id);
+		void __renew_recv_buffer(safe_buffer& buf);
+		void __recycle_flow_ids();
+		flow_slot* __flow_slot(uint32_t id)const;
 
 		void do_handle_received(const safe_buffer& buffer);
 		void do_handle_received_urdp_msg(safe_buffer& buffer);
@@ -288,6 +549,10 @@ namespace p2engine { namespace urdp{
 		udp_socket_type socket_;
 		endpoint_type local_endpoint_;
 		safe_buffer recv_buffer_;
+		std::size_t recv_buffer_size_;
+		bool b_path_mtu_discovery_;
+		raw_buffer_pool::intrusive_ptr recv_buffer_pool_;
+		BOOST_STATIC_CONSTANT(std::size_t, MAX_CACHED_RECV_BUFFERS=1024);
 		endpoint_type sender_endpoint_;
 		timed_keeper_set<request_uuid> request_uuid_keeper_;
 		local_id_allocator id_allocator_;
@@ -295,7 +560,7 @@ namespace p2engine { namespace urdp{
 		timed_keeper_set<int> released_id_keeper_;
 		timed_keeper_set<endpoint_type> unreachable_endpoint_keeper_;
 		acceptor_container	  acceptors_;
-		flow_container        flows_;
+		flow_container        flows_;//chunks of FLOW_CHUNK_SIZE slots
 		int                   flows_cnt_;
 		linger_send_container lingerSends_;
 		fast_mutex flow_mutex_;
@@ -304,6 +569,41 @@ namespace p2engine { namespace urdp{
 		int state_;
 		int	continuous_recv_cnt_;
 
+		struct shard_group
+		{
+			shard_group():steered(false){}
+
+			fast_mutex mutex;
+			std::vector<boost::weak_ptr<this_type> > shards;
+			bool steered;
+		};
+		boost::shared_ptr<shard_group> shard_group_;
+		uint32_t shard_index_;
+		uint32_t shard_count_;
+
+		struct pacing_entry
+		{
+			int64_t due;//precise tick count
+			pacing_handler_type handler;
+		};
+		struct pacing_entry_later
+		{
+			bool operator()(const pacing_entry& lhs,const pacing_entry& rhs)const
+			{
+				return lhs.due>rhs.due;
+			}
+		};
+		mutable fast_mutex pacing_mutex_;
+		std::vector<pacing_entry> pacing_queue_;//min-heap on due
+		std::vector<pacing_handler_type> pacing_fired_;
+		precise_timer_sptr pacing_timer_;
+		int64_t pacing_timer_due_;//0 if the timer is not armed
+		pacing_statistics pacing_stats_;
+
+		mutable fast_mutex simulator_mutex_;
+		network_simulator simulator_;
+		int64_t simulator_wakeup_;//0 if none is scheduled
+
 		//recv handler(for performance)
 		
 		typedef handler_allocator_wrap<
@@ -315,6 +615,64 @@ namespace p2engine { namespace urdp{
 		static this_type_container s_shared_this_type_pool_;
 		static fast_mutex s_shared_this_type_pool_mutex_;
 		static allocator_wrap_handler s_dummy_callback;
+		static std::size_t s_recv_batch_size_;
+		static boost::shared_ptr<io_service_pool> s_shard_ios_pool_;
+		static std::size_t s_send_batch_size_;
+		static bool s_udp_gso_enabled_;
+		static bool s_udp_gro_enabled_;
+		static bool s_path_mtu_discovery_;
+		static volatile std::size_t s_simulated_path_mtu_;
+		static network_conditions s_simulated_network_;
+		static fast_mutex s_simulated_network_mutex_;
+		static volatile bool s_simulate_network_;
+
+#ifdef RUDP_BATCH_RECV
+		bool b_batch_recv_;
+		std::vector<safe_buffer> batch_recv_buffers_;
+		std::vector<mmsghdr> batch_recv_msgs_;
+		std::vector<iovec> batch_recv_iovecs_;
+		std::vector<sockaddr_storage> batch_recv_addrs_;
+		recv_batch_statistics recv_batch_stats_;
+
+		BOOST_STATIC_CONSTANT(std::size_t, MAX_GRO_BYTES=0xffff);
+		union gro_cmsg_buffer
+		{
+			char buf[CMSG_SPACE(sizeof(int))];
+			cmsghdr align;
+		};
+		bool b_udp_gro_;
+		std::vector<gro_cmsg_buffer> batch_recv_ctrls_;
+#endif
+
+#ifdef RUDP_BATCH_SEND
+		//  The most buffers a queued datagram is gathered from: header, 
+		//payload and an ACK bundled after it.
+		BOOST_STATIC_CONSTANT(std::size_t, MAX_DATAGRAM_BUFS=3);
+		struct pending_datagram
+		{
+			endpoint_type ep;
+			safe_buffer bufs[MAX_DATAGRAM_BUFS];
+			std::size_t bufCnt;
+		};
+		bool b_batch_send_;
+		bool b_send_flush_posted_;
+		mutable fast_mutex send_mutex_;
+		std::vector<pending_datagram> send_queue_;
+		std::vector<mmsghdr> batch_send_msgs_;
+		std::vector<iovec> batch_send_iovecs_;
+		send_batch_statistics send_batch_stats_;
+
+		BOOST_STATIC_CONSTANT(std::size_t, MAX_GSO_SEGMENTS=64);
+		BOOST_STATIC_CONSTANT(std::size_t, MAX_GSO_BYTES=0xffff-8-40);
+		union gso_cmsg_buffer
+		{
+			char buf[CMSG_SPACE(sizeof(uint16_t))];
+			cmsghdr align;
+		};
+		bool b_udp_gso_;
+		std::vector<gso_cmsg_buffer> batch_send_ctrls_;
+		std::vector<std::size_t> batch_send_first_dgram_;//index in send_queue_ of each mmsghdr
+#endif
 
 #ifdef RUDP_SCRAMBLE
 		safe_buffer zero_8_bytes_;
@@ -326,6 +684,48 @@ namespace p2engine { namespace urdp{
 		const ConstBuffers& bufs,const endpoint_type& ep,error_code& ec
 		)
 	{
+		if (load_acquire(s_simulated_path_mtu_))
+		{
+			std::size_t dgramLen=0;
+			BOOST_FOREACH(const safe_buffer& buf,bufs)
+			{
+				dgramLen+=buf.size();
+			}
+			if (__exceeds_simulated_path_mtu(dgramLen))
+				return dgramLen;
+		}
+		if (load_acquire(s_simulate_network_))
+		{
+			//the datagram waits in the simulator in one piece
+			std::size_t dgramLen=0;
+			BOOST_FOREACH(const safe_buffer& buf,bufs)
+			{
+				dgramLen+=buf.size();
+			}
+			if (dgramLen==0)
+				return 0;
+			safe_buffer dgram(dgramLen);
+			char* p=buffer_cast<char*>(dgram);
+			BOOST_FOREACH(const safe_buffer& buf,bufs)
+			{
+				memcpy(p,buffer_cast<const char*>(buf),buf.size());
+				p+=buf.size();
+			}
+			__simulate(dgram,ep);
+			return dgramLen;
+		}
+#ifdef RUDP_BATCH_SEND
+		if (b_batch_send_&&bufs.size()<=MAX_DATAGRAM_BUFS)
+		{
+			safe_buffer tmp[MAX_DATAGRAM_BUFS];
+			std::size_t cnt=0;
+			BOOST_FOREACH(const safe_buffer& buf,bufs)
+			{
+				tmp[cnt++]=buf;
+			}
+			return __queue_send(tmp,cnt,ep);
+		}
+#endif
 #ifdef RUDP_SCRAMBLE
 		std::size_t len=0;
 		std::vector<asio::const_buffer>sndbufs;
@@ -25,6 +25,7 @@
 #include "p2engine/push_warning_option.hpp"
 #include "p2engine/config.hpp"
 #include <string>
+#include <utility>
 #include "p2engine/pop_warning_option.hpp"
 
 #include "p2engine/typedef.hpp"
@@ -59,6 +60,13 @@ namespace p2engine{
 		std::string operator()(const RudpPacketFormat&,const safe_buffer& buf)const;
 	};
 
+	//the same as get_demain_name_vistor, but points into the packet
+	template <typename RudpPacketFormat>
+	struct get_demain_name_ref_vistor 
+	{
+		std::pair<const char*,std::size_t> operator()(const RudpPacketFormat&,const safe_buffer& buf)const;
+	};
+
 	template <typename RudpPacketFormat>
 	struct make_refuse_vistor
 	{
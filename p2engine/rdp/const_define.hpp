@@ -34,6 +34,10 @@ namespace p2engine{
 	static const uint32_t	 INVALID_FLOWID=0xffffff;
 	static const uint16_t    INVALID_MSGTYPE=(uint16_t)0xffff;
 	static const std::size_t MTU_SIZE=1450;
+	//the range of the payload size of a segment, when path MTU discovery is
+	//on. MIN_MTU_SIZE fits the IPv6 minimum link MTU 1280.
+	static const std::size_t MIN_MTU_SIZE=1200;
+	static const std::size_t MAX_MTU_SIZE=8192;
 
 }
 
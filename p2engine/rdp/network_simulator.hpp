@@ -0,0 +1,115 @@
+//
+// network_simulator.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_NETWORK_SIMULATOR_HPP
+#define P2ENGINE_NETWORK_SIMULATOR_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <vector>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+#include "p2engine/safe_buffer.hpp"
+
+namespace p2engine { namespace urdp{
+
+	//  The path a simulated datagram goes through(see 
+	//basic_shared_udp_layer::simulate_network). It waits for a bottleneck
+	//link of bandwidth bytes per second with a queue of queue_bytes(the tail
+	//is dropped), is lost at loss_rate and then takes delay_msec plus up to 
+	//jitter_msec. A datagram reordered at reorder_rate takes another delay, 
+	//so that the ones sent after it pass it.
+	struct network_conditions
+	{
+		double loss_rate;
+		double reorder_rate;
+		long delay_msec;
+		long jitter_msec;
+		double bandwidth;//0 for no limit
+		std::size_t queue_bytes;//0 for no limit
+
+		network_conditions()
+			:loss_rate(0.0),reorder_rate(0.0),delay_msec(0),jitter_msec(0)
+			,bandwidth(0.0),queue_bytes(0)
+		{}
+	};
+
+	//  The delay line of the datagrams a basic_shared_udp_layer sends when it
+	//simulates network_conditions. Not thread safe.
+	class network_simulator
+	{
+	public:
+		typedef asio::ip::udp::endpoint endpoint_type;
+
+		struct datagram
+		{
+			safe_buffer buf;
+			endpoint_type ep;
+			int64_t due;//msec, precise tick count
+			uint64_t order;//of push, for the datagrams due at the same msec
+		};
+
+		struct statistics
+		{
+			uint64_t datagrams;
+			uint64_t lost;//at loss_rate
+			uint64_t overflowed;//by the queue of the bottleneck
+			uint64_t reordered;
+
+			statistics():datagrams(0),lost(0),overflowed(0),reordered(0){}
+		};
+
+		network_simulator();
+
+		//false if the datagram is lost
+		bool push(const safe_buffer& buf, const endpoint_type& ep, 
+			const network_conditions& cond, int64_t now);
+
+		//moves the datagrams due at now to out, in the order they arrive
+		void pop_due(int64_t now, std::vector<datagram>& out);
+
+		bool empty()const{return queue_.empty();}
+		int64_t next_due()const;
+		const statistics& stats()const{return stats_;}
+
+	private:
+		struct datagram_later
+		{
+			bool operator()(const datagram& lhs,const datagram& rhs)const
+			{
+				if (lhs.due!=rhs.due)
+					return lhs.due>rhs.due;
+				return lhs.order>rhs.order;
+			}
+		};
+
+		std::vector<datagram> queue_;//min-heap on due
+		double link_free_;//when the bottleneck has sent what is queued, msec
+		uint64_t order_;
+		statistics stats_;
+	};
+
+}//namespace urdp
+}//namespace p2engine
+
+#endif//P2ENGINE_NETWORK_SIMULATOR_HPP
@@ -104,7 +104,7 @@ namespace p2engine{ namespace trdp{
 				ec.clear();
 				BOOST_ASSERT(!token_);
 				token_=shared_layer_type::create_acceptor_token(
-					this->get_io_service(),local_edp,*this,
+					this->get_io_service(),local_edp,SHARED_OBJ_FROM_THIS,
 					domainName,ec,this->b_real_time_usage_);
 				if (ec)
 				{
@@ -163,6 +163,24 @@ namespace p2engine{ namespace trdp{
 	protected:
 		virtual void accept_flow(flow_sptr flow)
 		{
+			//a flow accepted on a thread of the pool of the shared layer 
+			//comes to the acceptor in its own thread
+			this->get_io_service().dispatch(
+				make_alloc_handler(boost::bind(&this_type::__accept_flow,
+				SHARED_OBJ_FROM_THIS,flow))
+				);
+		}
+
+	protected:
+		void __accept_flow(flow_sptr flow)
+		{
+			//the layer hands the flow over without its lock, so the acceptor
+			//may have been closed meanwhile
+			if (state_==CLOSED)
+			{
+				flow->close(false);
+				return;
+			}
 			pending_sockets_.push(flow);
 			if (pending_sockets_.size()<8)
 			{
@@ -247,7 +265,12 @@ namespace p2engine{ namespace trdp{
 				return connection_sptr();
 			flow_sptr flow=pending_sockets_.front();
 			pending_sockets_.pop();
-			connection_sptr sock=connection_type::create(this->get_io_service(),
+			//the connection runs in the io_service of its flow, which is one
+			//of the pool of the shared layer if it accepts on a pool
+			typedef typename connection_type::flow_type flow_type;
+			BOOST_ASSERT(boost::dynamic_pointer_cast<flow_type>(flow));
+			connection_sptr sock=connection_type::create(
+				boost::static_pointer_cast<flow_type>(flow)->get_io_service(),
 				this->is_real_time_usage(),true);
 			sock->set_flow(flow);
 			flow->set_socket(sock);
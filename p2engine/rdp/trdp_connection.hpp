@@ -251,6 +251,35 @@ namespace p2engine{ namespace trdp{
 			return 1.0;
 		}
 
+		//see trdp_flow::messages_per_write
+		double messages_per_write()const
+		{
+			if (flow_)
+				return flow_->messages_per_write();
+			return 0.0;
+		}
+
+		//see trdp_flow::messages_per_read
+		double messages_per_read()const
+		{
+			if (flow_)
+				return flow_->messages_per_read();
+			return 0.0;
+		}
+
+		//see trdp_flow::message_weight
+		void message_weight(uint16_t msgType, int weight)
+		{
+			if (flow_)
+				flow_->message_weight(msgType,weight);
+		}
+		int message_weight(uint16_t msgType)const
+		{
+			if (flow_)
+				return flow_->message_weight(msgType);
+			return trdp_send_scheduler::DEFAULT_WEIGHT;
+		}
+
 		virtual safe_buffer make_punch_packet(error_code& ec,const endpoint& externalEdp)
 		{
 			ec=boost::asio::error::service_not_found;
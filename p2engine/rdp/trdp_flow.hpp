@@ -25,8 +25,8 @@
 
 #include "p2engine/push_warning_option.hpp"
 #include "p2engine/config.hpp"
-#include <queue>
 #include <string>
+#include <vector>
 #include "p2engine/pop_warning_option.hpp"
 
 #include "p2engine/shared_access.hpp"
@@ -39,6 +39,7 @@
 #include "p2engine/trafic_statistics.hpp"
 #include "p2engine/rdp/const_define.hpp"
 #include "p2engine/rdp/rdp_fwd.hpp"
+#include "p2engine/rdp/trdp_send_scheduler.hpp"
 #include "p2engine/fast_stl.hpp"
 
 namespace p2engine{ namespace trdp{
@@ -94,13 +95,23 @@ namespace p2engine{ namespace trdp{
 
 		enum sendmode{RELIABLE_SEND,UNRELIABLE_SEND,SEMIRELIABLE_SEND};
 
-		struct send_emlment 
-			:object_allocator
+		typedef trdp_send_element send_emlment;
+
+		//  The buffers of a gathered write. It refers to write_iovecs_, which
+		//is not touched till the write completes, so that it is cheap to copy
+		//into the write operation.
+		struct gathered_buffers
 		{
-			safe_buffer buf;
-			msec_type   outTime;
-			uint16_t    msgType;
-			bool alertWritable;//only realiable packet
+			typedef asio::const_buffer value_type;
+			typedef std::vector<asio::const_buffer>::const_iterator const_iterator;
+
+			explicit gathered_buffers(const std::vector<asio::const_buffer>& bufs)
+				:bufs_(&bufs){}
+			const_iterator begin()const{return bufs_->begin();}
+			const_iterator end()const{return bufs_->end();}
+
+		private:
+			const std::vector<asio::const_buffer>* bufs_;
 		};
 
 	protected:
@@ -154,10 +165,14 @@ namespace p2engine{ namespace trdp{
 			return flowid_;//a random value
 		}
 
-		//called
+		//  A flow accepted on a thread of the pool of the shared layer runs
+		//in the io_service of that thread, so close, the sends and the 
+		//receiving switches are dispatched there.
 		virtual void close(bool graceful=true)
 		{
-			__close(graceful);
+			get_io_service().dispatch(make_alloc_handler(
+				boost::bind(&this_type::__close,SHARED_OBJ_FROM_THIS,graceful)
+				));
 		}
 
 		error_code open(const endpoint_type& local_edp, error_code& ec)
@@ -180,7 +195,9 @@ namespace p2engine{ namespace trdp{
 
 		void block_receiving()
 		{
-			is_recv_blocked_=true;
+			get_io_service().dispatch(make_alloc_handler(
+				boost::bind(&this_type::__block_receiving,SHARED_OBJ_FROM_THIS)
+				));
 		}
 
 		void async_send_unreliable(const safe_buffer& buffer,uint16_t msgType,
@@ -188,10 +205,7 @@ namespace p2engine{ namespace trdp{
 			)
 		{
 			(void)(maxRandomDelay);//not support yet
-			//if send_buffer of TCP is full, we drop unrealiable packet
-			if (qued_sending_size_>8*1024)
-				return;
-			__send(buffer,(char)DATA_PKT,false,&msgType);
+			__dispatch_send(buffer,msgType,UNRELIABLE_SEND);
 		}
 
 		void async_send_semireliable(const safe_buffer& buffer, uint16_t msgType,
@@ -199,12 +213,12 @@ namespace p2engine{ namespace trdp{
 		{
 			//treat as reliable
 			(void)(fastDupTrans);//not support yet
-			__send(buffer,(char)DATA_PKT,false,&msgType);
+			__dispatch_send(buffer,msgType,SEMIRELIABLE_SEND);
 		}
 
 		void async_send_reliable(const safe_buffer& buffer,uint16_t msgType)
 		{
-			__send(buffer,(char)DATA_PKT,true,&msgType);
+			__dispatch_send(buffer,msgType,RELIABLE_SEND);
 		}
 
 		bool is_open() const 
@@ -286,7 +300,65 @@ namespace p2engine{ namespace trdp{
 			 return __remote_to_local_lost_rate();
 		 }
 
+		 //  The messages queued while a write is in progress are written in
+		 //one gathered write when it completes. The average messages of a 
+		 //write, 0 if nothing has been written.
+		 double messages_per_write()const
+		 {
+			 if (writes_==0)
+				 return 0.0;
+			 return (double)written_msgs_/(double)writes_;
+		 }
+
+		 //  By default the reliable messages are written in the order they 
+		 //are sent, whatever their types; an unreliable message may pass the
+		 //reliable ones queued before it. Giving msgType a weight(1 to 
+		 //trdp_send_scheduler::MAX_WEIGHT) makes it share the socket with the
+		 //others in proportion to it, so its reliable messages are no longer
+		 //ordered with those of other types. Ping and pong always go first.
+		 void message_weight(uint16_t msgType, int weight)
+		 {
+			 send_bufs_.weight(msgType,weight);
+		 }
+		 int message_weight(uint16_t msgType)const
+		 {
+			 return send_bufs_.weight(msgType);
+		 }
+
+		 //  The socket is read in bulk into a chunk and every complete message
+		 //in it is delivered as a slice of the chunk, without a copy(a small
+		 //one is copied, so that it does not keep the chunk alive). A slice
+		 //shares the chunk with the messages after it, but its capacity ends
+		 //with the message: writing to it, or a realloc, moves it to a buffer
+		 //of its own. The average messages of a read, 0 if nothing has been
+		 //read.
+		 double messages_per_read()const
+		 {
+			 if (reads_==0)
+				 return 0.0;
+			 return (double)read_msgs_/(double)reads_;
+		 }
+
 	private:
+		void __keep_async_receiving();
+		void __block_receiving()
+		{
+			is_recv_blocked_=true;
+		}
+		void __send_ping();
+		void __set_ping_interval(const time_duration& t);
+
+		void __dispatch_send(const safe_buffer& buffer, uint16_t msgType,
+			sendmode mode)
+		{
+			get_io_service().dispatch(make_alloc_handler(
+				boost::bind(&this_type::__send_message,SHARED_OBJ_FROM_THIS,
+				buffer,msgType,mode)
+				));
+		}
+		void __send_message(const safe_buffer& buffer, uint16_t msgType,
+			sendmode mode);
+
 		void do_keep_receiving(error_code ec, std::size_t len, op_stamp_t stamp,
 			coroutine coro=coroutine());
 
@@ -297,12 +369,16 @@ namespace p2engine{ namespace trdp{
 			coroutine coro=coroutine());
 
 		bool __process_data(op_stamp_t stamp);
+		bool __process_buffered(op_stamp_t stamp);
+		void __prepare_recv_chunk();
 
 		error_code __open(error_code& ec);
 		void __close(bool greacful);
 
 		void __send(const safe_buffer& buffer,char type,bool alertWritable
-			,uint16_t* msgType=NULL,bool fromQue=false);
+			,uint16_t* msgType=NULL);
+		void __write_queued();
+		void __expire_queued(msec_type now);
 
 		void __handle_sent_packet(const error_code& ec, std::size_t bytes_trans,
 			bool allertWritable, op_stamp_t stamp);
@@ -341,7 +417,10 @@ namespace p2engine{ namespace trdp{
 		bool is_realtime_utility_;
 
 		char recv_header_buf_[4];
-		safe_buffer recv_buf_;
+		safe_buffer recv_buf_;//the message being processed
+		safe_buffer recv_chunk_;//the messages are slices of it
+		std::size_t recv_begin_, recv_end_;//the bytes of recv_chunk_ not framed
+		uint64_t reads_, read_msgs_;
 
 		resolver_type resolver_;
 		resolver_iterator endpoint_iterator_;
@@ -354,9 +433,12 @@ namespace p2engine{ namespace trdp{
 		int rttvar_;
 		int rto_;
 
-		std::queue<send_emlment> send_bufs_;
+		trdp_send_scheduler send_bufs_;
 		bool sending_;
-		int qued_sending_size_;
+		msec_type write_time_;//when the write in progress was issued
+		std::vector<safe_buffer> write_bufs_;//of the write in progress
+		std::vector<asio::const_buffer> write_iovecs_;
+		uint64_t writes_, written_msgs_;
 
 		uint32_t flowid_;
 
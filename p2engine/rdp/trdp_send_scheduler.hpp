@@ -0,0 +1,130 @@
+//
+// trdp_send_scheduler.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_TRDP_SEND_SCHEDULER_HPP
+#define P2ENGINE_TRDP_SEND_SCHEDULER_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <deque>
+#include <map>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+#include "p2engine/safe_buffer.hpp"
+
+namespace p2engine { namespace trdp{
+
+	//a packet waiting in the send queue of a trdp_flow
+	struct trdp_send_element
+	{
+		safe_buffer buf;
+		int64_t     outTime;//discarded if not written by then, MAX for reliable
+		uint16_t    msgType;
+		char        type;
+		bool alertWritable;//only realiable packet
+	};
+
+	//  The send queue of a trdp_flow. The control packets(ping, pong) go
+	//first in strict priority. The data packets of the types that have not
+	//been given a weight share one queue, so their reliable packets are
+	//written in the order they were pushed, whatever their types, as the 
+	//FIFO before did. A type given a weight gets a queue of its own, and the
+	//queues share the socket by deficit round robin in proportion to their
+	//weights(the shared one has DEFAULT_WEIGHT); its reliable packets may 
+	//then pass those of the other types, but never each other. Like the 
+	//reliable/unreliable split of urdp, each queue keeps its unreliable 
+	//packets apart from its reliable ones and sends them first, so a live 
+	//chunk does not wait behind a bulk transfer, and an unreliable packet is
+	//dropped as soon as its outTime has passed, wherever it is in the queue.
+	class trdp_send_scheduler
+	{
+	public:
+		typedef trdp_send_element element_type;
+		typedef int64_t msec_type;
+
+		enum{
+			QUANTUM=1500,//bytes a type of weight 1 may send in a round
+			DEFAULT_WEIGHT=1,
+			MAX_WEIGHT=64
+		};
+
+		trdp_send_scheduler();
+
+		void push(const element_type& elm, bool control);
+
+		//drops the unreliable packets whose outTime<now, returns how many
+		std::size_t expire(msec_type now);
+
+		//takes the next packet to write, false if there is none. The caller
+		//expires the queue first.
+		bool pop(element_type& elm);
+
+		void clear();
+
+		bool empty()const{return size_==0;}
+		std::size_t size()const{return size_;}
+		//payload bytes queued, and those of the unreliable packets
+		std::size_t bytes()const{return bytes_;}
+		std::size_t unreliable_bytes()const{return unreliable_bytes_;}
+
+		//  Gives msgType a queue of its own with a share of w, 1 to MAX_WEIGHT.
+		//The packets of it that are queued are moved there, in their order.
+		void weight(uint16_t msgType, int w);
+		int weight(uint16_t msgType)const;
+		//msgType has been given a weight
+		bool weighted(uint16_t msgType)const;
+
+	private:
+		struct type_queue
+		{
+			type_queue():weight(DEFAULT_WEIGHT),deficit(0),active(false){}
+
+			std::deque<element_type> unreliable;//outTime ascending
+			std::deque<element_type> reliable;
+			int weight;
+			long deficit;
+			bool active;//in the round
+			bool empty()const{return unreliable.empty()&&reliable.empty();}
+		};
+		typedef std::map<uint16_t, type_queue> type_queue_map;
+
+		type_queue& __queue_of(uint16_t msgType);
+		void __activate(type_queue& q);
+		void __take(std::deque<element_type>& q, element_type& elm);
+		static void __move_type(uint16_t msgType, std::deque<element_type>& from,
+			std::deque<element_type>& to);
+
+	private:
+		std::deque<element_type> control_;
+		type_queue fifo_;//the types that have no weight
+		type_queue_map queues_;//the weighted types
+		std::deque<type_queue*> round_;//the active queues
+		std::size_t size_;
+		std::size_t bytes_;
+		std::size_t unreliable_bytes_;
+	};
+
+}//namespace trdp
+}//namespace p2engine
+
+#endif//P2ENGINE_TRDP_SEND_SCHEDULER_HPP
@@ -115,7 +115,7 @@ namespace p2engine { namespace urdp{
 				BOOST_ASSERT(!token_);
 				token_=shared_layer_type::create_acceptor_token(
 					this->get_io_service(),local_edp,this,
-					boost::bind(&this_type::on_passive_request,this,_1),
+					boost::bind(&this_type::on_passive_request,this,_1,_2),
 					domainName,ec
 					);
 
@@ -242,7 +242,7 @@ namespace p2engine { namespace urdp{
 					{
 						connection_sptr sock(
 							connection_type::create(
-							this->get_io_service(),this->is_real_time_usage(),true)
+							flow->get_io_service(),this->is_real_time_usage(),true)
 							);
 						sock->set_flow(flow);
 						flow->set_socket(sock);
@@ -254,13 +254,15 @@ namespace p2engine { namespace urdp{
 		}
 
 	private:
-		int on_passive_request(const endpoint& from)
+		int on_passive_request(const endpoint& from, const shared_layer_sptr& sharedLayer)
 		{
 			//std::cout<<"------------------------------"<<pending_flows_.size()<<std::endl;
 			//OBJ_PROTECTOR(this_object);//do we really need to protect this?
+			//a flow accepted by a sharded layer runs in the thread of the shard
 			error_code ec;
 			flow_sptr flow=flow_type::create_for_passive_connect(
-				this->get_io_service(),SHARED_OBJ_FROM_THIS,get_shared_layer(),from,ec
+				sharedLayer->is_sharded()?sharedLayer->get_io_service():this->get_io_service(),
+				SHARED_OBJ_FROM_THIS,sharedLayer,from,ec
 				);//the new flow will register itself to shared_layer,don't worry about it.
 			if (!flow)
 				return INVALID_FLOWID;
@@ -268,6 +270,16 @@ namespace p2engine { namespace urdp{
 		}
 
 		virtual void accept_flow(boost::shared_ptr<basic_flow_adaptor> flow)
+		{
+			//the flow of a sharded layer is established in the thread of its shard
+			this->get_io_service().dispatch(
+				make_alloc_handler(boost::bind(&this_type::__accept_flow,
+				SHARED_OBJ_FROM_THIS,flow))
+				);
+		}
+
+	protected:
+		void __accept_flow(boost::shared_ptr<basic_flow_adaptor> flow)
 		{
 			//OBJ_PROTECTOR(this_object);//do we really need to protect this?
 			if (pending_flows_.size()<128)
@@ -0,0 +1,152 @@
+//
+// urdp_congestion.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_URDP_CONGESTION_HPP
+#define P2ENGINE_URDP_CONGESTION_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <string>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+#include "p2engine/object_allocator.hpp"
+
+namespace p2engine { namespace urdp{
+
+	enum congestion_control_type
+	{
+		CC_RENO,//loss based, the default
+		CC_LEDBAT//delay based, yields to other traffic(for background transfer)
+	};
+
+	//  The congestion window of a urdp_flow. The flow reports the events of
+	//its ACK path and retransmission timer, and keeps no more than cwnd()
+	//bytes in flight. The default implementation is Reno.
+	class urdp_congestion_controller
+		:public object_allocator
+	{
+	public:
+		typedef int32_t time32_type;
+
+		static urdp_congestion_controller* create(congestion_control_type type,
+			uint32_t mss, uint32_t cwnd, uint32_t ssthresh);
+
+		//the controller to be used by the flows of a domain, CC_RENO if not set
+		static void domain_congestion_control(const std::string& domainName,
+			congestion_control_type type);
+		static congestion_control_type domain_congestion_control(
+			const std::string& domainName);
+
+	protected:
+		urdp_congestion_controller(uint32_t mss, uint32_t cwnd, uint32_t ssthresh)
+			:mss_(mss),cwnd_(cwnd),ssthresh_(ssthresh)
+		{}
+
+	public:
+		virtual ~urdp_congestion_controller(){}
+
+		virtual congestion_control_type type()const
+		{
+			return CC_RENO;
+		}
+
+		uint32_t cwnd()const{return cwnd_;}
+		uint32_t ssthresh()const{return ssthresh_;}
+		uint32_t mss()const{return mss_;}
+		void set_mss(uint32_t mss){mss_=mss;}
+
+		//a round trip time sample(ms) taken from time_echo
+		virtual void on_rtt_sample(long rtt, time32_type now)
+		{
+			UNUSED_PARAMETER(rtt);
+			UNUSED_PARAMETER(now);
+		}
+		//new data is acked, not in fast recovery. ackSegs is the segments 
+		//an ACK stands for(2, or the ACK frequency asked of the remote), the
+		//growth is credited for no more than ackSegs*mss of ackedBytes.
+		virtual void on_ack(uint32_t ackedBytes, uint32_t inFlight, uint32_t ackSegs);
+		//the third duplicated ACK, the oldest segment is being resent
+		virtual void on_fast_retransmit(uint32_t inFlight);
+		//one more duplicated ACK in fast recovery
+		virtual void on_dup_ack();
+		//new data is acked, but not all that was sent before the recovery
+		virtual void on_partial_ack(uint32_t ackedBytes);
+		//all that was sent before the recovery is acked
+		virtual void on_recovery_exit(uint32_t inFlight);
+		//retransmission timer expired
+		virtual void on_timeout(uint32_t inFlight);
+		//nothing has been sent for more than a RTO
+		virtual void on_idle();
+
+	protected:
+		uint32_t mss_;
+		uint32_t cwnd_;
+		uint32_t ssthresh_;
+	};
+
+	//  LEDBAT(RFC6817) on the round trip time measured by time_sending and
+	//time_echo, as LEDBAT++ does, because urdp does not carry one way delay.
+	//It keeps the queuing delay it adds below TARGET_DELAY, so it gets out of
+	//the way of loss based flows sharing the bottleneck.
+	class ledbat_congestion_controller
+		:public urdp_congestion_controller
+	{
+	public:
+		enum{
+			TARGET_DELAY=60,//ms
+			BASE_HISTORY=10,//minutes
+			CURRENT_FILTER=4//samples
+		};
+
+		ledbat_congestion_controller(uint32_t mss, uint32_t cwnd, uint32_t ssthresh);
+
+		virtual congestion_control_type type()const
+		{
+			return CC_LEDBAT;
+		}
+
+		virtual void on_rtt_sample(long rtt, time32_type now);
+		virtual void on_ack(uint32_t ackedBytes, uint32_t inFlight, uint32_t ackSegs);
+		virtual void on_fast_retransmit(uint32_t inFlight);
+		virtual void on_timeout(uint32_t inFlight);
+
+		//-1 if it is not known yet
+		long queuing_delay()const;
+
+	private:
+		long base_delay()const;
+		long current_delay()const;
+
+	private:
+		long base_history_[BASE_HISTORY];//min rtt of each minute
+		time32_type base_minute_;
+		int base_index_;
+		long current_history_[CURRENT_FILTER];
+		int current_index_;
+		int sample_cnt_;
+	};
+
+}//namespace urdp
+}//namespace p2engine
+
+#endif//P2ENGINE_URDP_CONGESTION_HPP
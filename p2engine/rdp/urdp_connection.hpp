@@ -26,7 +26,9 @@
 #include "p2engine/push_warning_option.hpp"
 #include "p2engine/config.hpp"
 #include <list>
+#include <set>
 #include <string>
+#include <utility>
 #include "p2engine/pop_warning_option.hpp"
 
 #include "p2engine/typedef.hpp"
@@ -135,6 +137,23 @@ namespace p2engine{ namespace urdp{
 			{
 				flow_=flow_type::create_for_active_connect(SHARED_OBJ_FROM_THIS,
 					this->get_io_service(),local_edp,ec);
+				if (flow_&&congestion_control_)
+					flow_->congestion_control(*congestion_control_);
+				if (flow_&&pacing_)
+					flow_->pacing(*pacing_);
+				for (std::set<message_type>::const_iterator itr=fec_msg_types_.begin();
+					flow_&&itr!=fec_msg_types_.end();++itr)
+				{
+					flow_->fec(*itr, true);
+				}
+				if (flow_&&ack_frequency_)
+					flow_->ack_frequency(ack_frequency_->first, ack_frequency_->second);
+				if (flow_&&bundling_)
+					flow_->bundling(bundling_->first, bundling_->second);
+				if (flow_&&zero_copy_send_)
+					flow_->zero_copy_send(*zero_copy_send_);
+				if (flow_&&fast_reconnect_)
+					flow_->fast_reconnect(*fast_reconnect_);
 			}
 			return ec;
 		}
@@ -221,6 +240,160 @@ namespace p2engine{ namespace urdp{
 			return seconds(0xffffffffUL);
 		}
 
+		//  The congestion controller of this connection, it takes the place of
+		//the one set for the domain. It may be called before connecting.
+		void congestion_control(congestion_control_type type)
+		{
+			congestion_control_=type;
+			if (flow_) flow_->congestion_control(type);
+		}
+
+		congestion_control_type congestion_control()const
+		{
+			if (flow_)
+				return flow_->congestion_control();
+			return congestion_control_?*congestion_control_:CC_RENO;
+		}
+
+		//see urdp_flow::pacing
+		void pacing(bool enable)
+		{
+			pacing_=enable;
+			if (flow_) flow_->pacing(enable);
+		}
+
+		bool pacing()const
+		{
+			if (flow_)
+				return flow_->pacing();
+			return pacing_?*pacing_:flow_type::default_pacing();
+		}
+
+		//see urdp_flow::fec
+		void fec(message_type msgType, bool enable)
+		{
+			if (enable)
+				fec_msg_types_.insert(msgType);
+			else
+				fec_msg_types_.erase(msgType);
+			if (flow_) flow_->fec(msgType, enable);
+		}
+
+		bool fec(message_type msgType)const
+		{
+			if (flow_)
+				return flow_->fec(msgType);
+			return fec_msg_types_.find(msgType)!=fec_msg_types_.end();
+		}
+
+		//see urdp_flow::ack_frequency
+		void ack_frequency(uint32_t segments, double rttFraction)
+		{
+			ack_frequency_=std::make_pair(segments, rttFraction);
+			if (flow_) flow_->ack_frequency(segments, rttFraction);
+		}
+
+		uint32_t ack_frequency()const
+		{
+			if (flow_)
+				return flow_->ack_frequency();
+			return ack_frequency_?ack_frequency_->first:0;
+		}
+
+		//see urdp_flow::bundling
+		void bundling(bool enable, const time_duration& delay=time_duration())
+		{
+			bundling_=std::make_pair(enable, delay);
+			if (flow_) flow_->bundling(enable, delay);
+		}
+
+		bool bundling()const
+		{
+			if (flow_)
+				return flow_->bundling();
+			return bundling_?bundling_->first:true;
+		}
+
+		//see urdp_flow::zero_copy_send
+		void zero_copy_send(bool enable)
+		{
+			zero_copy_send_=enable;
+			if (flow_) flow_->zero_copy_send(enable);
+		}
+
+		bool zero_copy_send()const
+		{
+			if (flow_)
+				return flow_->zero_copy_send();
+			return zero_copy_send_?*zero_copy_send_:false;
+		}
+
+		//see urdp_flow::fast_reconnect
+		void fast_reconnect(bool enable)
+		{
+			fast_reconnect_=enable;
+			if (flow_) flow_->fast_reconnect(enable);
+		}
+
+		bool fast_reconnect()const
+		{
+			if (flow_)
+				return flow_->fast_reconnect();
+			return fast_reconnect_?*fast_reconnect_:false;
+		}
+
+		double pacing_rate()const
+		{
+			if (flow_)
+				return flow_->pacing_rate();
+			return 0.0;
+		}
+
+		//see urdp_flow::sent_bytes
+		uint64_t sent_bytes()const
+		{
+			if (flow_)
+				return flow_->sent_bytes();
+			return 0;
+		}
+
+		uint64_t retransmitted_bytes()const
+		{
+			if (flow_)
+				return flow_->retransmitted_bytes();
+			return 0;
+		}
+
+		//see urdp_flow::buffer_memory_limit, 0 if not connected
+		uint32_t recv_buffer_size()const
+		{
+			if (flow_)
+				return flow_->recv_buffer_size();
+			return 0;
+		}
+
+		uint32_t send_buffer_size()const
+		{
+			if (flow_)
+				return flow_->send_buffer_size();
+			return 0;
+		}
+
+		//see urdp_flow::mss
+		uint32_t mss()const
+		{
+			if (flow_)
+				return flow_->mss();
+			return MTU_SIZE;
+		}
+
+		flow_type::PmtuState pmtu_state()const
+		{
+			if (flow_)
+				return flow_->pmtu_state();
+			return flow_type::PMTU_DISABLED;
+		}
+
 		virtual endpoint local_endpoint(error_code& ec)const
 		{
 			if (flow_)
@@ -411,6 +584,13 @@ namespace p2engine{ namespace urdp{
 		std::string domain_;
 		int state_;
 		endpoint cached_remote_endpoint_;
+		boost::optional<congestion_control_type> congestion_control_;
+		boost::optional<bool> pacing_;
+		std::set<message_type> fec_msg_types_;
+		boost::optional<std::pair<uint32_t, double> > ack_frequency_;
+		boost::optional<std::pair<bool, time_duration> > bundling_;
+		boost::optional<bool> zero_copy_send_;
+		boost::optional<bool> fast_reconnect_;
 	};
 } // namespace urdp
 } // namespace p2engine
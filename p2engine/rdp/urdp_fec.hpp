@@ -0,0 +1,111 @@
+//
+// urdp_fec.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_URDP_FEC_HPP
+#define P2ENGINE_URDP_FEC_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <map>
+#include <vector>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+#include "p2engine/safe_buffer.hpp"
+
+namespace p2engine { namespace urdp{
+
+	//  XOR parity over groups of unreliable packets. The sender adds each
+	//packet of a group to the encoder and sends the parity when the group is
+	//full(or when it has waited long enough); the receiver gets back any one
+	//packet of a group that is lost.
+	//  A packet is coded as [length(2)|body], body is the pktID, msgType and
+	//payload as delivered, so a recovered body is delivered as a received one.
+	class urdp_fec_encoder
+	{
+	public:
+		enum{MAX_GROUP_SIZE=32};
+
+		//packets per parity for the lost rate, the more lost the smaller
+		static uint8_t group_size(double lostRate);
+
+		urdp_fec_encoder();
+
+		//a new group is opened by the first add after close
+		void open(uint8_t groupSize);
+		void add(uint16_t pktID, uint16_t msgType, const safe_buffer& payload);
+		void close();
+
+		bool empty()const{return count_==0;}
+		bool full()const{return count_>=size_;}
+		uint16_t group()const{return group_;}
+		uint8_t count()const{return count_;}
+		uint8_t size()const{return size_;}
+		const std::vector<char>& parity()const{return parity_;}
+
+	private:
+		std::vector<char> parity_;
+		uint16_t group_;
+		uint8_t count_;
+		uint8_t size_;
+	};
+
+	class urdp_fec_decoder
+	{
+	public:
+		typedef int32_t time32_type;
+
+		enum{GROUP_LIFETIME=2000};//ms, the parity is given up after it
+
+		//  Both return true if the missing packet of the group is recovered
+		//into body. on_data sets duplicated if the packet has been received
+		//or recovered already, then it is not to be delivered again.
+		bool on_data(uint16_t group, uint8_t index, const safe_buffer& body,
+			time32_type now, safe_buffer& recovered, bool& duplicated);
+		bool on_parity(uint16_t group, uint8_t count, const safe_buffer& parity,
+			time32_type now, safe_buffer& recovered);
+
+		void clear(){groups_.clear();}
+
+	private:
+		struct group_state
+		{
+			time32_type expire;
+			uint8_t count;//0 until the parity arrives
+			uint8_t received;
+			bool done;
+			safe_buffer parity;
+			std::vector<safe_buffer> bodies;
+		};
+		typedef std::map<uint16_t, group_state> group_map;
+
+		group_state* __group(uint16_t group, time32_type now);
+		bool __try_recover(group_state& g, safe_buffer& recovered);
+
+	private:
+		group_map groups_;
+	};
+
+}//namespace urdp
+}//namespace p2engine
+
+#endif//P2ENGINE_URDP_FEC_HPP
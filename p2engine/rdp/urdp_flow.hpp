@@ -25,7 +25,9 @@
 
 #include "p2engine/push_warning_option.hpp"
 #include "p2engine/config.hpp"
+#include <algorithm>
 #include <set>
+#include <vector>
 #include <boost/logic/tribool.hpp>
 #include <boost/optional.hpp>
 #include "p2engine/pop_warning_option.hpp"
@@ -42,6 +44,11 @@
 #include "p2engine/rdp/rdp_fwd.hpp"
 #include "p2engine/rdp/const_define.hpp"
 #include "p2engine/rdp/basic_shared_udp_layer.hpp"
+#include "p2engine/rdp/urdp_congestion.hpp"
+#include "p2engine/rdp/urdp_fec.hpp"
+#include "p2engine/rdp/urdp_ring.hpp"
+#include "p2engine/rdp/urdp_session_cache.hpp"
+#include "p2engine/rdp/urdp_timing_wheel.hpp"
 
 namespace p2engine { namespace urdp{
 
@@ -69,14 +76,13 @@ namespace p2engine { namespace urdp{
 		typedef basic_shared_udp_layer shared_layer_type;
 		typedef shared_layer_type::flow_token flow_token_type;
 
-		typedef rough_timer timer_type;
+		typedef urdp_wheel_timer timer_type;
 		typedef int32_t     time32_type;
 
 		typedef boost::shared_ptr<shared_layer_type> shared_layer_sptr;
 		typedef flow_token_type::smart_ptr flow_token_sptr;
 		typedef boost::shared_ptr<acceptor_type> acceptor_sptr;
 		typedef boost::shared_ptr<connection_type>  connection_sptr;
-		typedef boost::shared_ptr<timer_type> timer_sptr;
 
 		typedef asio::ip::udp::resolver resolver_type;
 		typedef resolver_type::iterator resolver_iterator;
@@ -89,6 +95,9 @@ namespace p2engine { namespace urdp{
 		enum TcpState {INIT, LISTEN, SYN_SENT, SYN_RCVD, ESTABLISHED, CLOSING,
 			WATING_FIN_ACK, CLOSED};
 		enum SendFlags { sfNone, sfDelayedAck, sfImmediateAck};
+		//path MTU discovery(RFC4821, states as RFC8899)
+		enum PmtuState {PMTU_DISABLED, PMTU_BASE, PMTU_SEARCHING, 
+			PMTU_SEARCH_COMPLETE, PMTU_ERROR};
 		enum {RECV_BUF_SIZE = 0xffff+16*1024,SND_BUF_SIZE =RECV_BUF_SIZE*3/2};
 
 	public:
@@ -116,7 +125,8 @@ namespace p2engine { namespace urdp{
 		}
 		virtual bool is_connected()const
 		{
-			return is_open()&&m_state==ESTABLISHED;
+			return is_open()&&(m_state==ESTABLISHED
+				||(m_state==SYN_SENT&&b_fast_open_));
 		}
 		virtual void set_socket(connection_sptr sock)
 		{
@@ -157,6 +167,138 @@ namespace p2engine { namespace urdp{
 		{
 			return milliseconds(m_srtt);
 		}
+
+		//the max payload of a segment, path MTU discovery changes it. With 
+		//path MTU discovery(DF) on, a longer unreliable message is dropped.
+		uint32_t mss()const
+		{
+			return m_mss;
+		}
+		PmtuState pmtu_state()const
+		{
+			return (PmtuState)m_pmtu_state;
+		}
+
+		//  Overrides the controller of the domain(see 
+		//urdp_congestion_controller::domain_congestion_control).
+		void congestion_control(congestion_control_type type);
+		congestion_control_type congestion_control()const
+		{
+			return m_cc->type();
+		}
+
+		//  Spreads the segments of a window over the srtt instead of sending 
+		//them back to back, at a little more than cwnd/srtt. Flows take the
+		//default when they are created.
+		void pacing(bool enable);
+		bool pacing()const
+		{
+			return b_pacing_;
+		}
+		static void default_pacing(bool enable)
+		{
+			s_default_pacing_=enable;
+		}
+		static bool default_pacing()
+		{
+			return s_default_pacing_;
+		}
+		//  A flow connecting to a remote(endpoint and domain) it has lately been
+		//connected to starts from the ticket of the last flow(see 
+		//urdp_session_cache): its mss, rtt and window. on_connected is called
+		//at once; the reliable messages sent in it go in the connect request,
+		//and the remote accepts the flow as soon as the request arrives, so
+		//the data is there in half an rtt. What does not fit is held until
+		//the remote answers, and unreliable messages are dropped till then.
+		//Only used with remotes that support it. Off by default, for it
+		//changes what the caller sees: is_connected() is true before the 
+		//remote has answered, and a refused connect is reported as a 
+		//disconnect. The messages of the connect request can be replayed(a
+		//copy of the datagram makes the remote accept them again), so send
+		//nothing in it that is not idempotent.
+		void fast_reconnect(bool enable)
+		{
+			b_fast_reconnect_=enable;
+		}
+		bool fast_reconnect()const
+		{
+			return b_fast_reconnect_;
+		}
+		static urdp_session_cache& session_cache();
+
+		//  Reliable messages of an mss or longer are queued as slices of the 
+		//buffer given to async_send instead of being copied, only the heads
+		//and tails that are coalesced with other messages are copied. The 
+		//buffer must not be written after it is sent. Off by default.
+		void zero_copy_send(bool enable)
+		{
+			b_zero_copy_send_=enable;
+		}
+		bool zero_copy_send()const
+		{
+			return b_zero_copy_send_;
+		}
+		//  The receive and send buffers start at RECV_BUF_SIZE and SND_BUF_SIZE
+		//and grow with the bandwidth-delay product the flow sees, which needs 
+		//the remote to scale the window(CAP_WINDOW_SCALE) beyond 64K. What all
+		//flows grow beyond their defaults is capped by buffer_memory_limit, 
+		//64M by default; it is given back when a flow is closed.
+		static void buffer_memory_limit(std::size_t bytes);
+		static std::size_t buffer_memory_limit();
+		static std::size_t buffer_memory_used();
+		uint32_t recv_buffer_size()const
+		{
+			return m_rcv_buf;
+		}
+		uint32_t send_buffer_size()const
+		{
+			return m_snd_buf;
+		}
+
+		//reliable bytes sent for the first time and sent again
+		uint64_t sent_bytes()const
+		{
+			return m_sent_bytes;
+		}
+		uint64_t retransmitted_bytes()const
+		{
+			return m_retransmitted_bytes;
+		}
+
+		//bytes per second, 0 if not paced(disabled or no rtt sample yet)
+		double pacing_rate()const
+		{
+			return b_pacing_?(double)__pacing_rate():0.0;
+		}
+		//  Unreliable and semireliable messages of msgType are sent once, and
+		//protected by XOR parity instead of being sent for several times. The
+		//parity ratio follows local_to_remote_lost_rate(). It takes effect only
+		//if the remote supports it too.
+		void fec(message_type msgType, bool enable);
+		bool fec(message_type msgType)const
+		{
+			return m_fec_msg_types.find(msgType)!=m_fec_msg_types.end();
+		}
+		//  Asks the remote to ACK once per segments data segments, or when 
+		//rttFraction of the srtt has passed since the first segment it has not
+		//ACKed(<=0 for its default delay), so that a fast stream does not cost
+		//an ACK per 2 segments upstream. segments==0 restores the default. It
+		//takes effect only if the remote supports it too.
+		void ack_frequency(uint32_t segments, double rttFraction);
+		//  Small unreliable and semireliable messages share datagrams: they are
+		//bundled until a datagram is full, and sent at the end of the current
+		//handler, or delay later if delay>0. On by default; it takes effect 
+		//only if the remote supports it too.
+		void bundling(bool enable, const time_duration& delay=time_duration());
+		bool bundling()const
+		{
+			return b_bundling_;
+		}
+		uint32_t ack_frequency()const
+		{
+			return m_ack_freq_segs;
+		}
+
 		double alive_probability()const;
 		double local_to_remote_speed()const
 		{
@@ -214,45 +356,43 @@ namespace p2engine { namespace urdp{
 			uint32_t seq;
 			int8_t xmit;
 			uint8_t ctrlType;
+			bool sacked;//remote has received it out of order
+			bool shared;//buf is a slice of a buffer of the user, never appended to
+			SSegment() 
+				: seq(0),xmit(0), ctrlType(0), sacked(false), shared(false)
+			{ }
 			SSegment(uint32_t s,uint8_t c) 
-				: seq(s),xmit(0), ctrlType(c) 
+				: seq(s),xmit(0), ctrlType(c), sacked(false), shared(false)
 			{ }
 		};
 
-		struct RSegment:object_allocator {
-			safe_buffer buf;
-			uint32_t seq;
-			bool operator<(RSegment const& rhs)const
-			{
-				return mod_less(seq,rhs.seq);
-			}
-		};
-
 		struct SUnraliableSegment:object_allocator {
 			safe_buffer buf;
-			int32_t id;
 			time32_type timeout;
 			uint16_t pktID;
 			uint16_t msgType;
 			int8_t remainXmit;
 			uint8_t control;
-
-			SUnraliableSegment(){
-				static int32_t id_seed__=0;
-				id=id_seed__++;
-			}
-
-			bool operator <(const SUnraliableSegment& rhs)const{
-				if (timeout!=rhs.timeout)
-					return mod_less(timeout,rhs.timeout);
-				return mod_less(id,rhs.id);
+		};
+		//heap order of m_unreliable_slist, the earliest timeout on top and
+		//the older pktID first for the same timeout
+		struct SUnraliableSegmentLater{
+			bool operator()(const SUnraliableSegment& lhs, 
+				const SUnraliableSegment& rhs)const
+			{
+				if (lhs.timeout!=rhs.timeout)
+					return mod_less(rhs.timeout,lhs.timeout);
+				return mod_less(rhs.pktID,lhs.pktID);
 			}
 		};
 
-		typedef std::deque<SSegment> SSegmentList;
-		typedef std::set<RSegment> RSegmentList;
+		typedef urdp_segment_ring<SSegment> SSegmentList;
+		static bool __segment_seq_less(const SSegment& seg, uint32_t seq)
+		{
+			return mod_less(seg.seq, seq);
+		}
 		typedef std::deque<safe_buffer> RUnraliablePacketList;
-		typedef std::set<SUnraliableSegment> SUnraliableSegmentList;
+		typedef std::vector<SUnraliableSegment> SUnraliableSegmentList;//min-heap
 
 		void __async_receive(op_stamp_t mark);
 		int  __recv(safe_buffer& buf,error_code& ec);
@@ -265,20 +405,74 @@ namespace p2engine { namespace urdp{
 		int __packet_as_unreliable_and_sendout(SUnraliableSegment& seg, time32_type now); 
 		uint32_t __queue(const char * data, std::size_t len, uint8_t ctrlType,
 			std::size_t reserveLen=0);
+		uint32_t __queue_ref(const safe_buffer& buf, uint8_t ctrlType);
+		bool __appendable(uint8_t ctrlType)const;
 		bool __transmit(const SSegmentList::iterator& seg, time32_type now);
 
 		bool __process(const safe_buffer& buf,const endpoint_type& from);
 
+		std::size_t __make_sack_blocks(char* p, std::size_t maxBlocks)const;
+		void __process_sack(const char* p, std::size_t len);
+		bool __retransmit_sack_holes(time32_type now);
+		bool __has_out_of_order_data()const;
+
 		void __attempt_send(SendFlags sflags = sfNone);
+		bool __process_new_ack(uint32_t ackno, time32_type now);
+		void __process_bundled_ack(uint32_t ackno, time32_type now);
+		uint16_t __ack_frequency_field()const;
+		void __apply_ack_frequency(uint16_t field);
 
 		void __to_closed_state();
 
 		bool __clock_check(time32_type now, long& nTimeout);
 		void __on_clock(VC9_BIND_BUG_PARAM_DECLARE);
 
-		void __adjust_mtu();
+		void __adjust_mtu(uint32_t mss);
+		void __resegment(SSegmentList& slist);
+		void __start_pmtu_discovery(time32_type now);
+		void __send_pmtu_probe(time32_type now);
+		void __pmtu_next_probe(time32_type now);
+		void __on_pmtu_probe_acked(uint32_t mss, time32_type now);
+		void __on_pmtu_probe_timeout(time32_type now);
+		void __on_pmtu_black_hole(time32_type now);
+		void __packet_pmtu_and_sendout(uint8_t control, uint32_t mss);
+		void __process_pmtu(int ctrlType, const safe_buffer& pkt, time32_type now);
+		uint16_t __window_field(int control)const;
+		uint32_t __peer_window(int control, uint32_t window)const;
+		void __grow_buffer(uint32_t& bufSize, uint32_t want, uint32_t maxSize);
+		void __tune_recv_buffer(time32_type now);
+		void __tune_send_buffer();
+		void __release_buffers();
+		void __process_new_path(const safe_buffer& pkt, const endpoint_type& from, 
+			time32_type now);
+		void __process_path(int ctrlType, const safe_buffer& pkt, 
+			const endpoint_type& from, time32_type now);
+		void __send_path_challenge(time32_type now);
+		void __end_path_challenge(time32_type now, time32_type holdOff);
+		void __packet_path_and_sendout(uint8_t control, uint32_t nonce, 
+			const endpoint_type& to);
+		void __migrate(time32_type now);
+		void __send_fec(SUnraliableSegment& seg, time32_type now);
+		void __packet_fec_parity_and_sendout(time32_type now);
+		void __process_fec(int ctrlType, const safe_buffer& pkt, time32_type now);
+		void __deliver_unreliable(const safe_buffer& pkt, bool dedup);
+		void __send_unreliable(SUnraliableSegment& seg, time32_type now);
+		void __bundle(SUnraliableSegment& seg, time32_type now);
+		void __packet_bundle_and_sendout(time32_type now);
+		bool __process_bundle(const safe_buffer& pkt);
+		void __on_bundle_flush(VC9_BIND_BUG_PARAM_DECLARE);
+		void __apply_ticket(const urdp_session_ticket& ticket);
+		void __save_ticket();
+		void __on_fast_connect(op_stamp_t mark);
 		void __incress_rto();
 		void __updata_rtt(long msec);
+		void __set_congestion_control(congestion_control_type type);
+
+		uint32_t __pacing_rate()const;
+		bool __pacing_permit(time32_type now);
+		void __schedule_pacing();
+		static void __wake_for_pacing(io_service* ios, boost::weak_ptr<urdp_flow> wflow);
+		static void __on_pacing(boost::weak_ptr<urdp_flow> wflow);
 
 		void __schedule_timer(time32_type now,bool calledInOnClock=false);
 
@@ -319,12 +513,19 @@ namespace p2engine { namespace urdp{
 		bool m_detect_writable:1;
 
 		// Incoming data
-		RSegmentList m_rlist;
+		urdp_recv_ring m_rring;
 		uint32_t m_rcv_nxt, m_rcv_wnd, m_rlen;
+		uint32_t m_rcv_space;//read by the user since m_t_rcv_space
+		time32_type m_t_rcv_space;
 
 		// Outgoing data
 		SSegmentList m_slist,m_retrans_slist;
 		uint32_t m_snd_nxt, m_snd_wnd, m_slen,m_snd_una;
+		uint64_t m_sent_bytes, m_retransmitted_bytes;
+
+		// Buffer autotuning
+		uint32_t m_rcv_buf, m_snd_buf;//limits of m_rlen and m_slen
+		uint32_t m_buf_reserved;//beyond the defaults, from buffer_memory_limit
 		uint32_t m_mss;
 		time32_type m_t_rto_base;
 
@@ -339,19 +540,63 @@ namespace p2engine { namespace urdp{
 		uint32_t m_lastack;
 
 		// Congestion avoidance, Fast retransmit/recovery, Delayed ACKs
-		uint32_t m_ssthresh, m_cwnd;
+		boost::scoped_ptr<urdp_congestion_controller> m_cc;
 		uint32_t m_recover;
 		time32_type m_t_ack;
 		uint8_t  m_dup_acks;
 
+		// ACK frequency
+		uint32_t m_ack_every;//segments per ACK, as the remote asks
+		time32_type m_ack_delay;//the longest an ACK is delayed, as the remote asks
+		uint32_t m_delayed_segs;//segments received since the last ACK
+		uint32_t m_ack_freq_segs;//what we ask the remote for
+		double m_ack_freq_rtt;
+
+		// Selective ACK
+		uint16_t m_caps;//capabilities both sides support
+		uint32_t m_sack_rexmit_nxt;//holes below it have been retransmitted
+
+		// Path MTU discovery
+		uint8_t m_pmtu_state;
+		uint32_t m_pmtu_lo, m_pmtu_hi;//confirmed and upper bound of the search
+		uint32_t m_pmtu_probe_size;//0 if no probe is outstanding
+		uint8_t m_pmtu_probe_cnt;//times m_pmtu_probe_size is sent
+		uint8_t m_pmtu_rto_cnt;//successive RTOs, for black hole detection
+		time32_type m_t_pmtu;//probe timeout, or when to search again
+
+		// Migration to a new endpoint of the remote
+		endpoint_type m_path_candidate;//being challenged
+		uint32_t m_path_nonce;//of the challenge, 0 if none is outstanding
+		uint32_t m_path_old_nonce;//of the challenge sent to m_remote_endpoint
+		uint8_t m_path_challenge_cnt;
+		time32_type m_t_path_challenge;//challenge timeout
+		time32_type m_t_path_allowed;//no challenge is started before it
+
+		// Forward error correction of unreliable messages
+		std::set<message_type> m_fec_msg_types;
+		urdp_fec_encoder m_fec_encoder;
+		urdp_fec_decoder m_fec_decoder;
+		time32_type m_t_fec_flush;//when to send the parity of an unfilled group
+
+		// Bundling of small unreliable messages
+		safe_buffer m_bundle;//the CTRL_BUNDLE being filled
+		std::size_t m_bundle_len;//0 if no bundle is open
+		time32_type m_bundle_delay;//0 to send it at the end of the handler
+		time32_type m_t_bundle_flush;
+
+		// Pacing
+		int64_t m_pacing_credit;//bytes that may be sent now, <=0 means wait
+		time32_type m_t_pacing;//last time the credit was refilled
+
 		uint32_t m_remote_peer_id;
 		time32_type m_ping_interval;
 
 	protected:
 		shared_ptr m_self_holder;
 		endpoint_type m_remote_endpoint;
+		std::string m_domain;//the domain connected to, for the session ticket
 		TcpState m_state;
-		timer_sptr m_timer;
+		timer_type m_timer;//on the timing wheel of the io_service
 		connection_type*    m_socket;
 		flow_token_sptr m_token;
 		boost::weak_ptr<acceptor_type> m_acceptor;
@@ -365,6 +610,17 @@ namespace p2engine { namespace urdp{
 		bool b_active_:1;
 		bool b_timer_posted_:1;
 		bool b_close_called_:1;
+		bool b_cc_assigned_:1;//congestion_control() was called
+		bool b_pacing_:1;
+		bool b_pacing_scheduled_:1;//a wakeup is pending in the shared layer
+		bool b_bundling_:1;
+		bool b_bundle_posted_:1;//__on_bundle_flush is posted
+		bool b_zero_copy_send_:1;
+		bool b_fast_reconnect_:1;
+		bool b_fast_open_:1;//connected before the remote answered
+		bool b_path_validated_:1;//m_path_candidate has echoed its nonce
+
+		static bool s_default_pacing_;
 
 	protected:
 		rough_speed_meter in_speed_meter_;
@@ -0,0 +1,240 @@
+//
+// urdp_ring.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_URDP_RING_HPP
+#define P2ENGINE_URDP_RING_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+
+namespace p2engine { namespace urdp{
+
+	//  The send queues of urdp_flow: a deque of segments on one contiguous,
+	//power of 2 sized array, so that queuing, sending and ACK trimming do not
+	//allocate once it has grown to the window. The segments are in the order
+	//of seq, the one of a seq is found by binary search(see lower_bound).
+	template<typename T>
+	class urdp_segment_ring
+	{
+		typedef urdp_segment_ring<T> this_type;
+
+		template<typename Ring, typename Value>
+		class basic_iterator
+		{
+			friend class urdp_segment_ring<T>;
+		public:
+			typedef std::random_access_iterator_tag iterator_category;
+			typedef Value value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef Value* pointer;
+			typedef Value& reference;
+
+			basic_iterator():ring_(NULL),index_(0){}
+			basic_iterator(Ring* ring, std::size_t index):ring_(ring),index_(index){}
+
+			reference operator*()const{return (*ring_)[index_];}
+			pointer operator->()const{return &(*ring_)[index_];}
+			reference operator[](difference_type n)const{return (*ring_)[index_+n];}
+
+			basic_iterator& operator++(){++index_;return *this;}
+			basic_iterator& operator--(){--index_;return *this;}
+			basic_iterator operator++(int){basic_iterator t(*this);++index_;return t;}
+			basic_iterator operator--(int){basic_iterator t(*this);--index_;return t;}
+			basic_iterator& operator+=(difference_type n){index_+=n;return *this;}
+			basic_iterator& operator-=(difference_type n){index_-=n;return *this;}
+			basic_iterator operator+(difference_type n)const{return basic_iterator(ring_,index_+n);}
+			basic_iterator operator-(difference_type n)const{return basic_iterator(ring_,index_-n);}
+			difference_type operator-(const basic_iterator& rhs)const
+			{
+				return (difference_type)index_-(difference_type)rhs.index_;
+			}
+
+			bool operator==(const basic_iterator& rhs)const{return index_==rhs.index_;}
+			bool operator!=(const basic_iterator& rhs)const{return index_!=rhs.index_;}
+			bool operator<(const basic_iterator& rhs)const{return index_<rhs.index_;}
+
+			std::size_t index()const{return index_;}
+
+		private:
+			Ring* ring_;
+			std::size_t index_;
+		};
+
+	public:
+		typedef T value_type;
+		typedef basic_iterator<this_type, T> iterator;
+		typedef basic_iterator<const this_type, const T> const_iterator;
+
+		enum{INIT_CAPACITY=16};
+
+		urdp_segment_ring():head_(0),size_(0){}
+
+		bool empty()const{return size_==0;}
+		std::size_t size()const{return size_;}
+
+		T& operator[](std::size_t i)
+		{
+			BOOST_ASSERT(i<size_);
+			return slots_[(head_+i)&(slots_.size()-1)];
+		}
+		const T& operator[](std::size_t i)const
+		{
+			BOOST_ASSERT(i<size_);
+			return slots_[(head_+i)&(slots_.size()-1)];
+		}
+		T& front(){return (*this)[0];}
+		const T& front()const{return (*this)[0];}
+		T& back(){return (*this)[size_-1];}
+		const T& back()const{return (*this)[size_-1];}
+
+		iterator begin(){return iterator(this,0);}
+		iterator end(){return iterator(this,size_);}
+		const_iterator begin()const{return const_iterator(this,0);}
+		const_iterator end()const{return const_iterator(this,size_);}
+
+		void push_back(const T& v)
+		{
+			if (size_==slots_.size())
+				__grow();
+			slots_[(head_+size_)&(slots_.size()-1)]=v;
+			++size_;
+		}
+		void pop_front()
+		{
+			BOOST_ASSERT(size_>0);
+			slots_[head_]=T();//release the buffer now
+			head_=(head_+1)&(slots_.size()-1);
+			--size_;
+		}
+		//O(n), only for the rare resegmenting
+		iterator insert(iterator pos, const T& v)
+		{
+			std::size_t i=pos.index();
+			BOOST_ASSERT(i<=size_);
+			push_back(v);
+			for (std::size_t j=size_-1;j>i;--j)
+				std::swap((*this)[j], (*this)[j-1]);
+			return iterator(this,i);
+		}
+		void clear()
+		{
+			std::vector<T>().swap(slots_);
+			head_=size_=0;
+		}
+
+		//the first segment that is not less than key, by comp(segment, key)
+		template<typename Key, typename Compare>
+		iterator lower_bound(const Key& key, Compare comp)
+		{
+			std::size_t lo=0, hi=size_;
+			while (lo<hi)
+			{
+				std::size_t mid=(lo+hi)/2;
+				if (comp((*this)[mid], key))
+					lo=mid+1;
+				else
+					hi=mid;
+			}
+			return iterator(this,lo);
+		}
+
+	private:
+		void __grow()
+		{
+			std::vector<T> slots(slots_.empty()?(std::size_t)INIT_CAPACITY:2*slots_.size());
+			for (std::size_t i=0;i<size_;++i)
+				slots[i]=(*this)[i];
+			slots_.swap(slots);
+			head_=0;
+		}
+
+	private:
+		std::vector<T> slots_;
+		std::size_t head_;
+		std::size_t size_;
+	};
+
+	//  The receive buffer of urdp_flow. Bytes are stored at their offset from
+	//the first unread byte in a contiguous, power of 2 sized ring, so an out
+	//of order segment is one memcpy and no allocation. The received ranges
+	//beyond the in order data are kept as [begin, end) blocks, which are
+	//the SACK blocks too.
+	//  The flow keeps rcv_nxt. Everything before base() has been read, the
+	//bytes in [base(), rcv_nxt) are in order and unread.
+	class urdp_recv_ring
+	{
+	public:
+		typedef std::pair<uint32_t, uint32_t> block_type;
+		typedef std::vector<block_type> block_list;
+
+		//MAX_CAPACITY is beyond the largest receive window of urdp_flow
+		enum{INIT_CAPACITY=4096, MAX_CAPACITY=8*1024*1024};
+
+		urdp_recv_ring();
+
+		uint32_t base()const{return base_;}
+		std::size_t capacity()const{return buf_.size();}
+
+		//  Moves base to seq when nothing is left unread(rcv_nxt may have 
+		//been moved without data), the blocks before it are dropped.
+		void rebase(uint32_t seq);
+
+		//  Stores [seq, seq+len), seq must not be less than rcvNxt. Returns
+		//the bytes that were not held before. A segment before rcvNxt(or base)
+		//or reaching MAX_CAPACITY beyond base is not stored, 0 is returned.
+		std::size_t write(uint32_t seq, const char* data, std::size_t len,
+			uint32_t rcvNxt);
+
+		//  The in order data is extended by the blocks adjacent to rcvNxt,
+		//returns the new rcv_nxt.
+		uint32_t advance(uint32_t rcvNxt);
+
+		//copies len bytes from base, read also consumes them
+		void peek(char* out, std::size_t len)const;
+		void read(char* out, std::size_t len);
+
+		bool has_out_of_order()const{return !blocks_.empty();}
+		const block_list& blocks()const{return blocks_;}
+
+		void clear();
+
+	private:
+		void __reserve(std::size_t len);
+
+	private:
+		std::vector<char> buf_;
+		std::size_t head_;//where base_ is in buf_
+		uint32_t base_;
+		block_list blocks_;
+	};
+
+}//namespace urdp
+}//namespace p2engine
+
+#endif//P2ENGINE_URDP_RING_HPP
@@ -0,0 +1,107 @@
+//
+// urdp_session_cache.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_URDP_SESSION_CACHE_HPP
+#define P2ENGINE_URDP_SESSION_CACHE_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+#include "p2engine/time.hpp"
+#include "p2engine/mutex.hpp"
+
+namespace p2engine { namespace urdp{
+
+	//what a flow has learned of a remote, for the next flow to the same 
+	//remote to start from(see urdp_flow::fast_reconnect)
+	struct urdp_session_ticket
+	{
+		uint16_t session_id;
+		uint16_t caps;
+		uint32_t mss;
+		uint32_t window;
+		uint32_t cwnd;
+		uint32_t srtt;
+		uint32_t rttvar;
+
+		urdp_session_ticket()
+			:session_id(0),caps(0),mss(0),window(0),cwnd(0),srtt(0),rttvar(0)
+		{}
+	};
+
+	//  The tickets of the remotes(endpoint and domain) connected lately, the
+	//least recently used one is dropped when it is full, and a ticket expires
+	//after lifetime. Shared by the flows of all threads.
+	class urdp_session_cache
+		:private boost::noncopyable
+	{
+		typedef std::pair<endpoint, std::string> key_type;
+		struct entry
+		{
+			key_type key;
+			urdp_session_ticket ticket;
+			tick_type expiry;
+		};
+		typedef std::list<entry> entry_list;
+		typedef std::map<key_type, entry_list::iterator> entry_map;
+
+	public:
+		enum{
+			DEFAULT_MAX_SIZE=4096,
+			DEFAULT_LIFETIME=10*60*1000//msec
+		};
+
+		explicit urdp_session_cache(std::size_t maxSize=DEFAULT_MAX_SIZE, 
+			long lifetime=DEFAULT_LIFETIME);
+
+		void put(const endpoint& edp, const std::string& domain, 
+			const urdp_session_ticket& ticket);
+		//false if there is none or it has expired
+		bool get(const endpoint& edp, const std::string& domain, 
+			urdp_session_ticket& ticket);
+		void erase(const endpoint& edp, const std::string& domain);
+		void clear();
+
+		std::size_t size()const;
+
+	private:
+		void __erase(entry_map::iterator itr);
+
+	private:
+		entry_list entries_;//the most recently used first
+		entry_map index_;
+		std::size_t max_size_;
+		long lifetime_;
+		mutable fast_mutex mutex_;
+	};
+
+}//namespace urdp
+}//namespace p2engine
+
+#endif//P2ENGINE_URDP_SESSION_CACHE_HPP
@@ -0,0 +1,152 @@
+//
+// urdp_timing_wheel.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009, GuangZhu Wu  <guangzhuwu@gmail.com>
+//
+//This program is free software; you can redistribute it and/or modify it
+//under the terms of the GNU General Public License or any later version.
+//
+//This program is distributed in the hope that it will be useful, but
+//WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+//or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+//for more details.
+//
+//You should have received a copy of the GNU General Public License along
+//with this program; if not, contact <guangzhuwu@gmail.com>.
+//
+
+#ifndef P2ENGINE_URDP_TIMING_WHEEL_HPP
+#define P2ENGINE_URDP_TIMING_WHEEL_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include "p2engine/push_warning_option.hpp"
+#include "p2engine/config.hpp"
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/typedef.hpp"
+#include "p2engine/time.hpp"
+
+namespace p2engine { namespace urdp{
+
+	class urdp_timing_wheel;
+
+	//the links of a timer in a slot of the wheel, a slot is a circular list
+	//with a hook as its head
+	struct urdp_wheel_hook
+	{
+		urdp_wheel_hook():prev_(NULL),next_(NULL){}
+
+		urdp_wheel_hook* prev_;
+		urdp_wheel_hook* next_;
+	};
+
+	//  A timer on the urdp_timing_wheel of an io_service, embedded in the
+	//object it wakes up(urdp_flow). Arming and cancelling are O(1) and never
+	//allocate; the handler is called in the tick of the wheel, it is kept
+	//across async_wait and cancel. Only used in the thread of the io_service.
+	class urdp_wheel_timer
+		:public urdp_wheel_hook
+		,private boost::noncopyable
+	{
+		friend class urdp_timing_wheel;
+
+	public:
+		typedef boost::function<void(void)> handler_type;
+
+		explicit urdp_wheel_timer(io_service& ios);
+		~urdp_wheel_timer();
+
+		void set_handler(const handler_type& handler){handler_=handler;}
+
+		//rearms the timer if it is waiting
+		void async_wait(long msec);
+		void cancel();
+
+		bool is_idle()const{return next_==NULL;}
+
+		//msec to the expiry, may be <=0 if it is due
+		long expires_from_now()const;
+
+	private:
+		urdp_timing_wheel* wheel_;//NULL after the io_service has shut down
+		tick_type expiry_;
+		int level_;
+		handler_type handler_;
+	};
+
+	//  A hierarchical timing wheel of millisecond granularity, one for each
+	//io_service(boost::asio::use_service). The root wheel has a slot for each
+	//of the next ROOT_SIZE msec, each upper level has LEVEL_SIZE slots, each
+	//as long as a whole turn of the level below it; the timers of an upper
+	//slot are cascaded down when the wheel reaches it. A single deadline
+	//timer ticks the wheel, waking only when a root slot is due or a cascade
+	//is needed, so thousands of flows cost one timer.
+	class urdp_timing_wheel
+		:public boost::asio::detail::service_base<urdp_timing_wheel>
+	{
+		friend class urdp_wheel_timer;
+		typedef urdp_timing_wheel this_type;
+		typedef boost::asio::basic_deadline_timer<
+			rough_tick_time::time_type, rough_tick_time
+		> tick_timer;
+
+	public:
+		enum{
+			ROOT_BITS=8,
+			LEVEL_BITS=6,
+			LEVELS=4,//root included, 2^26 msec(about 18 hours) in all
+			ROOT_SIZE=1<<ROOT_BITS,
+			LEVEL_SIZE=1<<LEVEL_BITS,
+			ROOT_MASK=ROOT_SIZE-1,
+			LEVEL_MASK=LEVEL_SIZE-1
+		};
+
+		explicit urdp_timing_wheel(io_service& ios);
+		~urdp_timing_wheel();
+
+		static tick_type tick_now()
+		{
+			return system_time::tick_count();
+		}
+
+		//the waiting timers
+		std::size_t size()const{return size_;}
+
+	private:
+		void shutdown_service();
+
+		void __arm(urdp_wheel_timer* t, tick_type expiry);
+		void __cancel(urdp_wheel_timer* t);
+		void __link(urdp_wheel_timer* t);
+		void __cascade(int level, std::size_t slot);
+		void __advance(tick_type now);
+		void __schedule_tick(tick_type due);
+		void __on_tick(const error_code& ec);
+
+		static void __push_back(urdp_wheel_hook* head, urdp_wheel_hook* h);
+		static void __unlink(urdp_wheel_hook* h);
+		static void __detach_all(urdp_wheel_hook* head);
+
+	private:
+		urdp_wheel_hook root_[ROOT_SIZE];
+		urdp_wheel_hook levels_[LEVELS-1][LEVEL_SIZE];
+		tick_type cur_;//the next msec to run
+		std::size_t size_;
+		std::size_t root_size_;
+
+		tick_timer timer_;
+		tick_type timer_due_;
+		bool timer_armed_;
+	};
+
+}//namespace urdp
+}//namespace p2engine
+
+#endif//P2ENGINE_URDP_TIMING_WHEEL_HPP
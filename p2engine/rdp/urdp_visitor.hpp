@@ -29,6 +29,7 @@
 #include <boost/optional.hpp>
 #include "p2engine/pop_warning_option.hpp"
 
+#include "p2engine/io.hpp"
 #include "p2engine/packet_format_def.hpp"
 #include "p2engine/safe_buffer.hpp"
 #include "p2engine/rdp/basic_urdp_visitor.hpp"
@@ -58,7 +59,37 @@ namespace p2engine { namespace urdp{
 
 		CTRL_RST,
 		CTRL_FIN,
-		CTRL_FIN_ACK
+		CTRL_FIN_ACK,
+
+		CTRL_SACK,//an ACK followed by SACK blocks, only sent if CAP_SACK is negotiated
+
+		CTRL_PMTU_PROBE,//path MTU probe, only sent if CAP_PMTU_PROBE is negotiated
+		CTRL_PMTU_PROBE_ACK,
+
+		CTRL_FEC_DATA,//unreliable data in a FEC group, only sent if CAP_FEC is negotiated
+		CTRL_FEC_PARITY,
+
+		CTRL_BUNDLE,//small unreliable messages in one packet, only sent if CAP_BUNDLE is negotiated
+
+		CTRL_CONNECT_DATA,//connect request with data, only sent if CAP_FAST_OPEN was negotiated before
+
+		CTRL_PATH_CHALLENGE,//validates a new endpoint, only sent if CAP_MIGRATION is negotiated
+		CTRL_PATH_RESPONSE
+	};
+
+	//  The capabilities are exchanged by CTRL_CONNECT and CTRL_CONNECT_ACK in 
+	//the bandwidth_recving field, which old peers leave 0 and ignore. A flow 
+	//uses a capability only if both sides have it.
+	enum urdp_capability
+	{
+		CAP_SACK=(1<<0),
+		CAP_PMTU_PROBE=(1<<1),
+		CAP_FEC=(1<<2),
+		CAP_ACK_FREQUENCY=(1<<3),
+		CAP_BUNDLE=(1<<4),
+		CAP_FAST_OPEN=(1<<5),
+		CAP_MIGRATION=(1<<6),
+		CAP_WINDOW_SCALE=(1<<7)//window is in units of 64 bytes, but in the handshake
 	};
 
 	//////////////////////////////////////////////////////////////////////
@@ -108,9 +139,73 @@ namespace p2engine { namespace urdp{
 	// 24 |//---------- length -----------|//----------- type------------ |
 	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 	//
+	//  The payload of CTRL_SACK is up to MAX_SACK_BLOCKS blocks of received 
+	//out-of-order data, each block is [begin, end) of seqno:
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 24 |                          block_begin                          |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 28 |                           block_end                           |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//
+	//  CTRL_PMTU_PROBE and CTRL_PMTU_PROBE_ACK are urdp_packet_basic_format
+	//followed by the probed mss. A probe is padded to as long as a reliable
+	//packet carrying mss bytes, and is acked only if it arrives whole.
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 12 |                              mss                              |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//
+	//  CTRL_FEC_DATA is urdp_packet_unreliable_format with the FEC group in
+	//front of packet_id. count is the planned group size in CTRL_FEC_DATA, 
+	//and the real one in CTRL_FEC_PARITY(index is count then), where the 
+	//parity(see urdp_fec_encoder) follows at 16 instead of packet_id.
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 12 |//---------- group ----------- |     index     |     count     |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 16 |//---------- packet_id --------|//----------- type------------ |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//
+	//  If CAP_ACK_FREQUENCY is negotiated, bandwidth_recving of CTRL_DATA is
+	//the ACK frequency the sender asks for: ACK once per segments, or delay
+	//msec after the first segment not ACKed. 0 is the default(2 segments,
+	//ACK_DELAY in urdp_flow.cpp).
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//  8 | segments  |       delay       |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//  And a pending ACK is bundled into an unreliable packet(CTRL_UNRELIABLE_DATA,
+	//CTRL_SEMIRELIABLE_DATA, CTRL_FEC_DATA or CTRL_BUNDLE) by setting 
+	//CTRL_FLAG_ACK in control, with the ackno at the end of the packet.
+	//
+	//  CTRL_BUNDLE is urdp_packet_basic_format followed by messages, each with
+	//its own packet_id and type. S is set if the message is semireliable.
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 12 |S|          length             |//---------- packet_id --------|
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 16 |//----------- type------------ |   payload(length bytes) ...   |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//
+	//  CTRL_CONNECT_DATA is a CTRL_CONNECT whose domain is led by its length,
+	//the data of the stream follows the domain in the same segment. It is 
+	//sent to a remote that had CAP_FAST_OPEN when last connected, which 
+	//accepts the flow on it without waiting for the ACK of CTRL_CONNECT_ACK.
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 24 |//------- domain length -------|    domain ...    |  data ...  |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//
+	//  CTRL_PATH_CHALLENGE and CTRL_PATH_RESPONSE are urdp_packet_basic_format
+	//followed by a random nonce. A flow that gets its packets from a new 
+	//endpoint of the remote(a NAT rebinding) sends a challenge there and 
+	//another to the old endpoint. It moves when the response from the new
+	//one echoes its nonce and the old one does not answer in an rto; an 
+	//answer from the old endpoint means the remote has not moved.
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	// 12 |                             nonce                             |
+	//    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	//
 
 	static const double LOST_RATE_PRECISION=1.0/0xff;
 	static const double BANDWIDTH_PRECISION=1000.0;
+	static const std::size_t MAX_SACK_BLOCKS=4;
+	static const uint32_t CTRL_FLAG_ACK=0x80;
 
 	P2ENGINE_PACKET_FORMAT_DEF_BEGIN(urdp_packet_basic_format,0, {})
 		P2ENGINE_PACKET_BIT_FIELD_DEF(uint32_t,control,8)
@@ -142,7 +237,8 @@ struct is_conn_request_vistor<urdp::urdp_packet_basic_format>
 	typedef urdp::urdp_packet_basic_format header_format;
 	bool operator()(const header_format& h)const
 	{
-		return h.get_control()==urdp::CTRL_CONNECT;
+		return h.get_control()==urdp::CTRL_CONNECT
+			||h.get_control()==urdp::CTRL_CONNECT_DATA;
 	}
 };
 
@@ -198,6 +294,34 @@ struct get_session_vistor<urdp::urdp_packet_basic_format>
 };
 
 
+template <>
+struct get_demain_name_ref_vistor<urdp::urdp_packet_basic_format> 
+{
+	typedef urdp::urdp_packet_basic_format header_format;
+	std::pair<const char*,std::size_t> operator()(const header_format&h,const safe_buffer& buf)const
+	{
+		if (urdp::urdp_packet_reliable_format::format_size()<buf.length())
+		{
+			if (is_conn_request_vistor<header_format>()(h))
+			{
+				std::size_t offset=urdp::urdp_packet_reliable_format::format_size();
+				const char* p=buffer_cast<const char*>(buf)+offset;
+				std::size_t len=buf.length()-offset;
+				if (h.get_control()==urdp::CTRL_CONNECT_DATA)
+				{
+					//led by its length, and followed by data
+					std::size_t domainLen=(len<2?len:read_uint16_ntoh(p));
+					if (len<2+domainLen)
+						return std::make_pair(INVALID_DOMAIN.c_str(),INVALID_DOMAIN.length());
+					len=domainLen;
+				}
+				return std::make_pair(p,len);
+			}
+		}
+		return std::make_pair(INVALID_DOMAIN.c_str(),INVALID_DOMAIN.length());
+	}
+};
+
 template <>
 struct get_demain_name_vistor<urdp::urdp_packet_basic_format> 
 {
@@ -208,8 +332,9 @@ struct get_demain_name_vistor<urdp::urdp_packet_basic_format>
 		{
 			if (is_conn_request_vistor<header_format>()(h))
 			{
-				safe_buffer domainBuf=buf.buffer_ref(urdp::urdp_packet_reliable_format::format_size());
-				return std::string(buffer_cast<const char*>(domainBuf),domainBuf.length());
+				std::pair<const char*,std::size_t> domain
+					=get_demain_name_ref_vistor<header_format>()(h,buf);
+				return std::string(domain.first,domain.second);
 			}
 		}
 		return get_invalid_domain_vistor<header_format>()();
@@ -53,10 +53,11 @@ namespace p2engine {
 
 		BOOST_STATIC_CONSTANT(std::size_t,BUFFER_DELTA=128);
 	public:
-		safe_buffer_base():p_ptr_(NULL),g_ptr_(NULL)
+		safe_buffer_base():p_ptr_(NULL),g_ptr_(NULL),e_ptr_(NULL)
 		{}
 		explicit safe_buffer_base(std::size_t len)
 			: raw_buffer_(raw_buffer::create(((std::max))(len,(std::size_t)BUFFER_DELTA)))
+			, e_ptr_(NULL)
 		{
 			gptr(raw_buffer_ptr());
 			pptr(raw_buffer_ptr()+len);
@@ -68,6 +69,7 @@ namespace p2engine {
 		}
 		safe_buffer_base(const void* data,std::size_t data_len)
 			: raw_buffer_(raw_buffer::create(((std::max))(data_len,(std::size_t)BUFFER_DELTA)))
+			, e_ptr_(NULL)
 		{
 			gptr(raw_buffer_ptr());
 			memcpy(raw_buffer_ptr(),data,data_len);
@@ -98,6 +100,7 @@ namespace p2engine {
 			{
 				raw_buffer_ = buf.raw_buffer_;
 				g_ptr_ = buf.g_ptr_;
+				e_ptr_ = buf.e_ptr_;
 			}
 			p_ptr_ = g_ptr_+(std::min)(buf.length(), trucated_len);
 		}
@@ -107,6 +110,7 @@ namespace p2engine {
 			raw_buffer_.reset();
 			gptr(NULL);
 			pptr(NULL);
+			e_ptr_=NULL;
 		}
 
 		void swap(safe_buffer_base&buf)
@@ -116,6 +120,7 @@ namespace p2engine {
 				raw_buffer_.swap(buf.raw_buffer_);
 				std::swap(p_ptr_, buf.p_ptr_);
 				std::swap(g_ptr_, buf.g_ptr_);
+				std::swap(e_ptr_, buf.e_ptr_);
 			}
 		}
 
@@ -141,12 +146,34 @@ namespace p2engine {
 			raw_buffer_ = raw_buffer::create(len);
 			gptr(raw_buffer_ptr());
 			pptr(gptr()+len);
+			e_ptr_=NULL;
+		}
+
+		//use a buffer that has been allocated(e.g. by raw_buffer_pool)
+		void recreate(const raw_buffer_type& rawBuffer,std::size_t len)
+		{
+			BOOST_ASSERT(rawBuffer&&rawBuffer->length()>=len);
+			raw_buffer_ = rawBuffer;
+			gptr(raw_buffer_ptr());
+			pptr(gptr()+len);
+			e_ptr_=NULL;
+		}
+
+		//the capacity ends where the data does. A slice of a buffer shares the
+		//bytes after it(e.g. the next messages), a write or realloc past the
+		//end then moves the data to a new buffer instead of writing over them.
+		//It also holds for the copies and slices of this one.
+		void limit_capacity()
+		{
+			e_ptr_=pptr();
 		}
 
 		std::size_t capacity()const
 		{
 			if (raw_buffer_)
 			{
+				if (e_ptr_)
+					return e_ptr_-gptr();
 				return raw_buffer_len()-(gptr()-raw_buffer_ptr());
 			}
 			return 0;
@@ -348,6 +375,7 @@ namespace p2engine {
 		raw_buffer_type raw_buffer_;
 		char* p_ptr_;
 		char* g_ptr_;
+		char* e_ptr_;//the end of the capacity, NULL if it is that of raw_buffer_
 	};
 
 	template<class OStream>
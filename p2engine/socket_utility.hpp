@@ -58,6 +58,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
+#if defined(LINUX_OS)||defined(ANDROID_OS)
+#	include <linux/filter.h>
+#endif
 #include "p2engine/pop_warning_option.hpp"
 
 #include "p2engine/typedef.hpp"
@@ -200,6 +203,90 @@ namespace p2engine{
 		char m_value;
 	};
 
+#if defined(LINUX_OS)||defined(ANDROID_OS)
+#if !defined(SOL_UDP)
+# define SOL_UDP 17
+#endif
+#if !defined(UDP_SEGMENT)
+# define UDP_SEGMENT 103
+#endif
+#if !defined(UDP_GRO)
+# define UDP_GRO 104
+#endif
+	//several sockets can be bound to the same port, the kernel distributes
+	//the incoming packets among them by the hash of the 4-tuple(linux 3.9 and later)
+#if defined(SO_REUSEPORT)
+	struct reuse_port
+	{
+		reuse_port(bool enable): m_value(enable) {}
+		template<class Protocol>
+		int level(Protocol const&) const { return SOL_SOCKET; }
+		template<class Protocol>
+		int name(Protocol const&) const { return SO_REUSEPORT; }
+		template<class Protocol>
+		int const* data(Protocol const&) const { return &m_value; }
+		template<class Protocol>
+		std::size_t size(Protocol const&) const { return sizeof(m_value); }
+		int m_value;
+	};
+
+#if !defined(SO_ATTACH_REUSEPORT_CBPF)
+# define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+	//the socket of a SO_REUSEPORT group that a packet is delivered to is
+	//the index returned by a classic BPF program run on the UDP payload. An 
+	//index out of the group falls back to the hash(linux 4.5 and later).
+	struct reuse_port_cbpf
+	{
+		reuse_port_cbpf(sock_filter* code, unsigned short len)
+		{
+			m_value.len=len;
+			m_value.filter=code;
+		}
+		template<class Protocol>
+		int level(Protocol const&) const { return SOL_SOCKET; }
+		template<class Protocol>
+		int name(Protocol const&) const { return SO_ATTACH_REUSEPORT_CBPF; }
+		template<class Protocol>
+		sock_fprog const* data(Protocol const&) const { return &m_value; }
+		template<class Protocol>
+		std::size_t size(Protocol const&) const { return sizeof(m_value); }
+		sock_fprog m_value;
+	};
+#endif
+
+	//UDP generic segmentation offload(linux 4.18 and later).
+	//the value is the segment size, 0 means no segmentation.
+	struct udp_segment
+	{
+		udp_segment(int segSize): m_value(segSize) {}
+		template<class Protocol>
+		int level(Protocol const&) const { return SOL_UDP; }
+		template<class Protocol>
+		int name(Protocol const&) const { return UDP_SEGMENT; }
+		template<class Protocol>
+		int const* data(Protocol const&) const { return &m_value; }
+		template<class Protocol>
+		std::size_t size(Protocol const&) const { return sizeof(m_value); }
+		int m_value;
+	};
+
+	//UDP generic receive offload(linux 5.0 and later)
+	struct udp_gro
+	{
+		udp_gro(bool enable): m_value(enable) {}
+		template<class Protocol>
+		int level(Protocol const&) const { return SOL_UDP; }
+		template<class Protocol>
+		int name(Protocol const&) const { return UDP_GRO; }
+		template<class Protocol>
+		int const* data(Protocol const&) const { return &m_value; }
+		template<class Protocol>
+		std::size_t size(Protocol const&) const { return sizeof(m_value); }
+		int m_value;
+	};
+#endif
+
 #ifdef WINDOWS_OS//disable ICMP "port unreachable"(WSAECONNRESET)
 	inline void disable_icmp_unreachable(SOCKET socketDescriptor)
 	{
@@ -0,0 +1,55 @@
+#include "p2engine/push_warning_option.hpp"
+#include <boost/bind.hpp>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/io_service_pool.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+
+void io_service_pool::__start(bool block)
+{
+	std::vector<thread_ptr> threads;
+	{
+		mutex_type::scoped_lock lock(mutex_);
+		if (!threads_.empty())//started
+			return;
+		block_=block;
+		typedef std::size_t (asio::io_service::*run_type)();
+		for (std::size_t i = 0; i < io_services_.size(); ++i)
+		{
+			io_services_[i]->reset();
+			work_.push_back(work_ptr(new asio::io_service::work(*io_services_[i])));
+			thread_ptr thread(new boost::thread(
+				boost::bind((run_type)&asio::io_service::run, io_services_[i].get())));
+			threads_.push_back(thread);
+			io_services_map_[thread->get_id()]=io_services_[i].get();
+		}
+		threads=threads_;
+	}
+	if (block)
+	{
+		for (std::size_t i = 0; i < threads.size(); ++i)
+			threads[i]->join();
+	}
+}
+
+void io_service_pool::__wait()
+{
+	std::vector<thread_ptr> threads;
+	{
+		mutex_type::scoped_lock lock(mutex_);
+		work_.clear();
+		for (std::size_t i = 0; i < io_services_.size(); ++i)
+			io_services_[i]->stop();
+		threads.swap(threads_);
+		io_services_map_.clear();
+	}
+	//a thread of the pool can not join itself
+	for (std::size_t i = 0; i < threads.size(); ++i)
+	{
+		if (threads[i]->get_id()!=boost::this_thread::get_id())
+			threads[i]->join();
+	}
+}
+
+NAMESPACE_END(p2engine);
@@ -3,6 +3,7 @@
 #include "p2engine/logging.hpp"
 #include "p2engine/broadcast_socket.hpp"
 #include "p2engine/socket_utility.hpp"
+#include "p2engine/io_service_pool.hpp"
 #include "p2engine/rdp/const_define.hpp"
 #include "p2engine/rdp/trdp_flow.hpp"
 #include "p2engine/rdp/basic_shared_tcp_layer.hpp"
@@ -14,7 +15,13 @@ basic_shared_tcp_layer::this_type_container basic_shared_tcp_layer::s_this_type_
 boost::mutex basic_shared_tcp_layer::s_this_type_pool_mutex_;
 rough_speed_meter basic_shared_tcp_layer::s_out_speed_meter_(millisec(3000));
 rough_speed_meter basic_shared_tcp_layer::s_in_speed_meter_(millisec(3000));
+boost::shared_ptr<io_service_pool> basic_shared_tcp_layer::s_accept_ios_pool_;
 
+void basic_shared_tcp_layer::accept_on_pool(
+	const boost::shared_ptr<io_service_pool>& pool)
+{
+	s_accept_ios_pool_=pool;
+}
 
 bool basic_shared_tcp_layer::is_shared_endpoint_type(const endpoint_type& edp)
 {
@@ -26,7 +33,7 @@ boost::shared_ptr<basic_shared_tcp_layer::acceptor_token>
 	basic_shared_tcp_layer::create_acceptor_token(
 	io_service& ios,
 	const endpoint_type& local_edp,
-	acceptor_type& acceptor,
+	acceptor_sptr acceptor,
 	const std::string domainName,
 	error_code& ec,
 	bool realTimeUsage
@@ -37,7 +44,7 @@ boost::shared_ptr<basic_shared_tcp_layer::acceptor_token>
 		return acceptor_token::shared_ptr();
 	obj->register_acceptor(acceptor,domainName,ec);
 	return boost::shared_ptr<acceptor_token>(
-		new acceptor_token(domainName,obj,acceptor));
+		new acceptor_token(domainName,obj,*acceptor));
 }
 
 basic_shared_tcp_layer::shared_ptr 
@@ -126,41 +133,12 @@ basic_shared_tcp_layer::basic_shared_tcp_layer(io_service& ios,
 {
 	this->set_obj_desc("basic_shared_tcp_layer");
 
+	if (s_accept_ios_pool_&&s_accept_ios_pool_->size()>1)
+		accept_pool_=s_accept_ios_pool_;
+
 	tcp_acceptor_.open(boost::asio::ip::tcp::endpoint(local_edp).protocol(), ec);
 	if (!ec)
-	{
-		error_code e;
-		//set some option to fate rail time message trans
-		if (realTimeUsage)
-		{
-			asio::socket_base::reuse_address reuse_address_option(false);
-			asio::socket_base::receive_buffer_size receive_buffer_size_option(64*1024);
-			asio::socket_base::send_buffer_size send_buffer_size_option(4*1024);//using a small buffer??
-			asio::socket_base::send_low_watermark send_low_watermark_option(4);
-			type_of_service type_of_service_option(0x20);
-
-			tcp_acceptor_.set_option(reuse_address_option,e);
-			tcp_acceptor_.set_option(receive_buffer_size_option,e);
-			tcp_acceptor_.set_option(send_buffer_size_option,e);
-			tcp_acceptor_.set_option(send_low_watermark_option,e);
-			tcp_acceptor_.set_option(type_of_service_option,e);
-		}
-		else
-		{
-			asio::socket_base::reuse_address reuse_address_option(false);
-			asio::socket_base::receive_buffer_size receive_buffer_size_option(1024*1024);
-			asio::socket_base::send_buffer_size send_buffer_size_option(512*1024);
-			//asio::socket_base::send_low_watermark send_low_watermark_option(4);
-			type_of_service type_of_service_option(0x20);
-
-			tcp_acceptor_.set_option(reuse_address_option,e);
-			tcp_acceptor_.set_option(receive_buffer_size_option,e);
-			tcp_acceptor_.set_option(send_buffer_size_option,e);
-			//tcp_acceptor_.set_option(send_low_watermark_option,e);
-			tcp_acceptor_.set_option(type_of_service_option,e);
-		}
-		tcp_acceptor_.set_option(asio::socket_base::linger(false,0));
-	}
+		__set_options(tcp_acceptor_,ec);
 
 	if (ec)
 	{
@@ -198,12 +176,100 @@ basic_shared_tcp_layer::basic_shared_tcp_layer(io_service& ios,
 		}
 		else
 		{
+			__open_reuse_port_acceptors();
 			boost::mutex::scoped_lock lock(s_this_type_pool_mutex_);
 			s_this_type_pool_.insert(std::make_pair(local_endpoint_, this));
 		}
 	}
 };
 
+void basic_shared_tcp_layer::__set_options(tcp_acceptor_type& acc, error_code& ec)
+{
+	error_code e;
+	//set some option to fate rail time message trans
+	if (b_real_time_usage_)
+	{
+		asio::socket_base::reuse_address reuse_address_option(false);
+		asio::socket_base::receive_buffer_size receive_buffer_size_option(64*1024);
+		asio::socket_base::send_buffer_size send_buffer_size_option(4*1024);//using a small buffer??
+		asio::socket_base::send_low_watermark send_low_watermark_option(4);
+		type_of_service type_of_service_option(0x20);
+
+		acc.set_option(reuse_address_option,e);
+		acc.set_option(receive_buffer_size_option,e);
+		acc.set_option(send_buffer_size_option,e);
+		acc.set_option(send_low_watermark_option,e);
+		acc.set_option(type_of_service_option,e);
+	}
+	else
+	{
+		asio::socket_base::reuse_address reuse_address_option(false);
+		asio::socket_base::receive_buffer_size receive_buffer_size_option(1024*1024);
+		asio::socket_base::send_buffer_size send_buffer_size_option(512*1024);
+		//asio::socket_base::send_low_watermark send_low_watermark_option(4);
+		type_of_service type_of_service_option(0x20);
+
+		acc.set_option(reuse_address_option,e);
+		acc.set_option(receive_buffer_size_option,e);
+		acc.set_option(send_buffer_size_option,e);
+		//acc.set_option(send_low_watermark_option,e);
+		acc.set_option(type_of_service_option,e);
+	}
+	acc.set_option(asio::socket_base::linger(false,0));
+
+#ifdef TRDP_REUSE_PORT
+	if (accept_pool_)
+	{
+		acc.set_option(reuse_port(true),ec);
+		if (ec)
+		{
+			LOG(
+				LogError("unable to set SO_REUSEPORT, error:%d, %s",
+				ec.value(),ec.message().c_str());
+			);
+		}
+	}
+#else
+	UNUSED_PARAMETER(ec);
+#endif
+}
+
+void basic_shared_tcp_layer::__open_reuse_port_acceptors()
+{
+#ifdef TRDP_REUSE_PORT
+	if (!accept_pool_)
+		return;
+	//the acceptor of the layer accepts on its io_service, one more is bound 
+	//to the port for each of the others of the pool
+	for (std::size_t i=0;i<accept_pool_->size();++i)
+	{
+		io_service& ios=accept_pool_->get_io_service(i);
+		if (&ios==&get_io_service())
+			continue;
+		boost::shared_ptr<tcp_acceptor_type> acc(new tcp_acceptor_type(ios));
+		error_code ec;
+		acc->open(boost::asio::ip::tcp::endpoint(local_endpoint_).protocol(), ec);
+		if (!ec)
+			__set_options(*acc,ec);
+		if (!ec)
+			acc->bind(local_endpoint_,ec);
+		if (ec)
+		{
+			//run with the acceptors that have been opened
+			LOG(
+				LogError("unable to bind tcp acceptor with endpoint %s by SO_REUSEPORT, error %d %s",
+				endpoint_to_string(local_endpoint_).c_str(),ec.value(),
+				ec.message().c_str());
+			);
+			error_code e;
+			acc->close(e);
+			break;
+		}
+		reuse_port_acceptors_.push_back(std::make_pair(acc,&ios));
+	}
+#endif
+}
+
 basic_shared_tcp_layer::~basic_shared_tcp_layer()
 {
 	BOOST_ASSERT(acceptors_.empty());
@@ -214,17 +280,40 @@ basic_shared_tcp_layer::~basic_shared_tcp_layer()
 	error_code ec;
 	cancel_without_protector();
 	tcp_acceptor_.close(ec);
+	for (std::size_t i=0;i<reuse_port_acceptors_.size();++i)
+		reuse_port_acceptors_[i].first->close(ec);
 }
 
 basic_shared_tcp_layer::acceptor_type*
 	basic_shared_tcp_layer::find_acceptor(const std::string& domainName)
 {
 	//check if there is any acceptor listening on the domain
+	fast_mutex::scoped_lock lock(mutex_);
 	acceptor_container::iterator itr=acceptors_.find(domainName);
 	if (itr==acceptors_.end())
 		return NULL;
 	else
-		return itr->second;
+		return itr->second.acceptor;
+}
+
+bool basic_shared_tcp_layer::accept_flow(const std::string& domainName, 
+	flow_sptr flow)
+{
+	//the acceptor is kept alive by acc, and is called with mutex_ released:
+	//it may run the handlers of its own thread inline, which may close it
+	//or open another acceptor
+	acceptor_sptr acc;
+	{
+		fast_mutex::scoped_lock lock(mutex_);
+		acceptor_container::iterator itr=acceptors_.find(domainName);
+		if (itr!=acceptors_.end())
+			acc=itr->second.ptr.lock();
+	}
+	if (!acc)
+		return false;
+	flow->accept(error_code());
+	acc->accept_flow(flow);
+	return true;
 }
 
 void basic_shared_tcp_layer::start()
@@ -243,29 +332,41 @@ void basic_shared_tcp_layer::start()
 			ec.message().c_str());
 		);
 	}
-	async_accept();
+	async_accept(tcp_acceptor_,get_io_service());
+	for (std::size_t i=0;i<reuse_port_acceptors_.size();++i)
+	{
+		reuse_port_acceptors_[i].first->listen(asio::socket_base::max_connections, ec);
+		async_accept(*reuse_port_acceptors_[i].first,*reuse_port_acceptors_[i].second);
+	}
 }
 
 void basic_shared_tcp_layer::cancel_without_protector()
 {
 	error_code ec;
 	tcp_acceptor_.cancel(ec);
+	for (std::size_t i=0;i<reuse_port_acceptors_.size();++i)
+		reuse_port_acceptors_[i].first->cancel(ec);
 	state_=STOPED;
 }
 
 void basic_shared_tcp_layer::handle_accept(const error_code& ec, 
-	flow_sptr flow)
+	flow_sptr flow, tcp_acceptor_type* acc, io_service* accIos)
 {
 	if (state_!=STARTED)
 		return;
 	if (!ec)
 	{
 		//accept next
-		async_accept();
+		async_accept(*acc,*accIos);
 
-		//process this socket
-		flow_keeper_.try_keep(flow,seconds(5));
-		flow->waiting_domain(SHARED_OBJ_FROM_THIS);
+		//process this socket, in the thread of its flow
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			flow_keeper_.try_keep(flow,seconds(5));
+		}
+		flow->get_io_service().dispatch(make_alloc_handler(
+			boost::bind(&flow_type::waiting_domain,flow,SHARED_OBJ_FROM_THIS)
+			));
 	}
 	else
 	{
@@ -275,31 +376,40 @@ void basic_shared_tcp_layer::handle_accept(const error_code& ec,
 			endpoint_to_string(local_endpoint(e)).c_str(),ec.value(),
 			ec.message().c_str());
 		);
-		tcp_acceptor_.cancel(e);
-		tcp_acceptor_.close(e);
+		acc->cancel(e);
+		acc->close(e);
 	}
 }
 
-void basic_shared_tcp_layer::async_accept()
+void basic_shared_tcp_layer::async_accept(tcp_acceptor_type& acc, 
+	io_service& accIos)
 {
 	if (state_!=STARTED)
 		return;
 
-	flow_sptr flow=flow_type::create_for_passive_connect(get_io_service(),
+	//the flow runs on the io_service of the acceptor, or on the next one of
+	//the pool if the port is not shared by SO_REUSEPORT
+	io_service& ios=((accept_pool_&&reuse_port_acceptors_.empty())
+		?accept_pool_->get_io_service():accIos);
+	flow_sptr flow=flow_type::create_for_passive_connect(ios,
 		is_real_time_usage());
-	tcp_acceptor_.async_accept(flow->lowest_layer(),
+	acc.async_accept(flow->lowest_layer(),
 		make_alloc_handler(
-		boost::bind(&this_type::handle_accept,SHARED_OBJ_FROM_THIS,_1,flow)
+		boost::bind(&this_type::handle_accept,SHARED_OBJ_FROM_THIS,_1,flow,&acc,&accIos)
 		)
 		);
 }
 
-error_code basic_shared_tcp_layer::register_acceptor(acceptor_type& acc,
+error_code basic_shared_tcp_layer::register_acceptor(acceptor_sptr acc,
 	const std::string& domainName,error_code& ec)
 {
 	ec.clear();
+	acceptor_element elm;
+	elm.acceptor=acc.get();
+	elm.ptr=acc;
+	fast_mutex::scoped_lock lock(mutex_);
 	std::pair<acceptor_container::iterator,bool> insertRst
-		=acceptors_.insert(std::make_pair(domainName,&acc));
+		=acceptors_.insert(std::make_pair(domainName,elm));
 	if (!insertRst.second)
 	{
 		ec=asio::error::already_open; 
@@ -310,10 +420,11 @@ error_code basic_shared_tcp_layer::register_acceptor(acceptor_type& acc,
 
 void  basic_shared_tcp_layer::unregister_acceptor(const acceptor_type& acptor)
 {
+	fast_mutex::scoped_lock lock(mutex_);
 	acceptor_container::iterator itr=acceptors_.begin();
 	for (;itr!=acceptors_.end();++itr)
 	{
-		if (itr->second==const_cast<acceptor_type*>(&acptor))
+		if (itr->second.acceptor==const_cast<acceptor_type*>(&acptor))
 		{
 			acceptors_.erase(itr);
 			break;
@@ -2,6 +2,7 @@
 #include "p2engine/utilities.hpp"
 #include "p2engine/safe_buffer_io.hpp"
 #include "p2engine/broadcast_socket.hpp"
+#include "p2engine/io_service_pool.hpp"
 #include "p2engine/rdp/urdp_visitor.hpp"
 #include "p2engine/rdp/basic_shared_udp_layer.hpp"
 
@@ -17,6 +18,83 @@ basic_shared_udp_layer::this_type_container
 fast_mutex basic_shared_udp_layer::s_shared_this_type_pool_mutex_;
 basic_shared_udp_layer::allocator_wrap_handler 
 	basic_shared_udp_layer::s_dummy_callback(boost::bind(&__dummy_callback,_1,_2));
+#ifdef RUDP_BATCH_RECV
+std::size_t basic_shared_udp_layer::s_recv_batch_size_=32;
+#else
+std::size_t basic_shared_udp_layer::s_recv_batch_size_=1;
+#endif
+
+boost::shared_ptr<io_service_pool> basic_shared_udp_layer::s_shard_ios_pool_;
+bool basic_shared_udp_layer::s_udp_gso_enabled_=true;
+bool basic_shared_udp_layer::s_udp_gro_enabled_=false;
+bool basic_shared_udp_layer::s_path_mtu_discovery_=false;
+volatile std::size_t basic_shared_udp_layer::s_simulated_path_mtu_=0;
+network_conditions basic_shared_udp_layer::s_simulated_network_;
+fast_mutex basic_shared_udp_layer::s_simulated_network_mutex_;
+volatile bool basic_shared_udp_layer::s_simulate_network_=false;
+#ifdef RUDP_BATCH_SEND
+std::size_t basic_shared_udp_layer::s_send_batch_size_=64;
+#else
+std::size_t basic_shared_udp_layer::s_send_batch_size_=1;
+#endif
+
+void basic_shared_udp_layer::recv_batch_size(std::size_t n)
+{
+#ifdef RUDP_BATCH_RECV
+	s_recv_batch_size_=std::min<std::size_t>(std::max<std::size_t>(n,1),1024);
+#else
+	UNUSED_PARAMETER(n);
+#endif
+}
+
+void basic_shared_udp_layer::shard_by_reuse_port(
+	const boost::shared_ptr<io_service_pool>& pool)
+{
+	s_shard_ios_pool_=pool;
+}
+
+void basic_shared_udp_layer::use_udp_gso(bool enable)
+{
+	s_udp_gso_enabled_=enable;
+}
+
+void basic_shared_udp_layer::use_udp_gro(bool enable)
+{
+	s_udp_gro_enabled_=enable;
+}
+
+void basic_shared_udp_layer::use_path_mtu_discovery(bool enable)
+{
+	s_path_mtu_discovery_=enable;
+}
+
+void basic_shared_udp_layer::simulate_path_mtu(std::size_t mtu)
+{
+	store_release(s_simulated_path_mtu_,mtu);
+}
+
+void basic_shared_udp_layer::simulate_network(const network_conditions& cond)
+{
+	fast_mutex::scoped_lock lock(s_simulated_network_mutex_);
+	s_simulated_network_=cond;
+	store_release(s_simulate_network_,(cond.loss_rate>0.0||cond.reorder_rate>0.0
+		||cond.delay_msec>0||cond.jitter_msec>0||cond.bandwidth>0.0));
+}
+
+network_conditions basic_shared_udp_layer::simulated_network()
+{
+	fast_mutex::scoped_lock lock(s_simulated_network_mutex_);
+	return s_simulated_network_;
+}
+
+void basic_shared_udp_layer::send_batch_size(std::size_t n)
+{
+#ifdef RUDP_BATCH_SEND
+	s_send_batch_size_=std::min<std::size_t>(std::max<std::size_t>(n,1),1024);
+#else
+	UNUSED_PARAMETER(n);
+#endif
+}
 
 basic_shared_udp_layer::flow_token::smart_ptr 
 	basic_shared_udp_layer::create_flow_token( io_service& ios,
@@ -84,7 +162,7 @@ basic_shared_udp_layer::shared_ptr
 			bool port_match=(local_edp.port()==net_obj->local_endpoint_.port());
 			if (((anyport&&address_match)||(anyaddr&&port_match))&&net_obj->is_open())
 			{
-				return net_obj;
+				return net_obj->__select_shard(ios);
 			}
 		}
 	}
@@ -95,9 +173,13 @@ basic_shared_udp_layer::shared_ptr
 		if (iter != s_shared_this_type_pool_.end()&&iter->second->is_open())
 		{
 			BOOST_ASSERT(iter->second);
-			return iter->second->shared_ptr_from_this();
+			return iter->second->__select_shard(ios);
 		}
 	}
+#ifdef RUDP_REUSE_PORT
+	if (s_shard_ios_pool_&&s_shard_ios_pool_->size()>1)
+		return __create_shards(ios,local_edp,ec);
+#endif
 	shared_ptr net_obj;
 	endpoint_type edp(local_edp);
 	for (int i=(anyport?16:1);i>0;--i)
@@ -134,14 +216,185 @@ basic_shared_udp_layer::shared_ptr
 }
 
 
+basic_shared_udp_layer::shared_ptr 
+	basic_shared_udp_layer::__create_shards(io_service& ios, 
+	const endpoint_type& local_edp, error_code& ec)
+{
+	BOOST_ASSERT(s_shard_ios_pool_);
+	boost::shared_ptr<io_service_pool> pool=s_shard_ios_pool_;
+	boost::shared_ptr<shard_group> group(new shard_group);
+	std::vector<shared_ptr> shards;
+	endpoint_type edp(local_edp);
+	bool anyport=(!local_edp.port());
+
+	for (std::size_t i=0;i<pool->size();++i)
+	{
+		shared_ptr net_obj;
+		for (int j=(anyport&&i==0?16:1);j>0;--j)
+		{
+			if (anyport&&i==0)
+				edp.port(random<unsigned short>(1024,10000));
+			try
+			{
+				net_obj=shared_ptr(new this_type(pool->get_io_service(i),edp,ec,true));
+			}
+			catch (...)
+			{
+				LOG(
+					LogError("catched exception when create basic_shared_udp_layer");
+				);
+				net_obj.reset();
+				continue;
+			}
+			if (!ec&&net_obj->is_open())
+				break;
+		}
+		if (!net_obj||ec||!net_obj->is_open())
+		{
+			if (i==0)
+				return net_obj;
+			//run with the shards that have been created
+			ec.clear();
+			break;
+		}
+		edp=net_obj->local_endpoint_;
+		shards.push_back(net_obj);
+	}
+
+	for (std::size_t i=0;i<shards.size();++i)
+	{
+		shards[i]->shard_group_=group;
+		shards[i]->shard_index_=(uint32_t)i;
+		shards[i]->shard_count_=(uint32_t)shards.size();
+		group->shards.push_back(shards[i]);
+	}
+	group->steered=__steer_shards(shards);
+	for (std::size_t i=0;i<shards.size();++i)
+		shards[i]->start();
+	return shards[0]->__select_shard(ios);
+}
+
+//the sockets of a group are indexed by the order they were bound in, which
+//is the shard index. The program returns peer_id%shard_count, the owner of
+//the flow a packet is sent to; the peer_id of a connect request is the id 
+//of the remote flow, so its retransmissions go to the same shard too.
+bool basic_shared_udp_layer::__steer_shards(const std::vector<shared_ptr>& shards)
+{
+#ifdef RUDP_REUSE_PORT
+#	ifndef BPF_MOD
+#		define BPF_MOD 0x90
+#	endif
+	if (shards.size()<2)
+		return false;
+#ifdef RUDP_SCRAMBLE
+	const uint32_t headerOffset=8;//8 bytes of zero
+#else
+	const uint32_t headerOffset=0;
+#endif
+	sock_filter code[]={
+		{BPF_LD|BPF_W|BPF_ABS,0,0,headerOffset},//control:8, peer_id:24
+		{BPF_ALU|BPF_AND|BPF_K,0,0,0xffffff},
+		{BPF_ALU|BPF_MOD|BPF_K,0,0,(uint32_t)shards.size()},
+		{BPF_RET|BPF_A,0,0,0}
+	};
+	error_code ec;
+	shards[0]->socket_.set_option(
+		reuse_port_cbpf(code,(unsigned short)(sizeof(code)/sizeof(code[0]))),ec);
+	if (ec)
+	{
+		LOG(
+			LogError("unable to steer udp shards by BPF, error:%d, %s",
+			ec.value(),ec.message().c_str());
+		);
+		return false;
+	}
+	return true;
+#else
+	UNUSED_PARAMETER(shards);
+	return false;
+#endif
+}
+
+basic_shared_udp_layer::shared_ptr 
+	basic_shared_udp_layer::__select_shard(io_service& ios)
+{
+	if (!shard_group_)
+		return SHARED_OBJ_FROM_THIS;
+
+	//prefer the shard running on the caller's io_service, so that an active
+	//flow and the layer it sends through run in the same thread. A steered
+	//group delivers the replies to that shard as well; otherwise they are
+	//hashed to any shard and forwarded.
+	std::vector<shared_ptr> shards=__shards();
+	for (std::size_t i=0;i<shards.size();++i)
+	{
+		if (&shards[i]->get_io_service()==&ios)
+			return shards[i];
+	}
+	return SHARED_OBJ_FROM_THIS;
+}
+
+std::vector<basic_shared_udp_layer::shared_ptr> basic_shared_udp_layer::__shards()
+{
+	std::vector<shared_ptr> shards;
+	if (!shard_group_)
+	{
+		shards.push_back(SHARED_OBJ_FROM_THIS);
+		return shards;
+	}
+	fast_mutex::scoped_lock lock(shard_group_->mutex);
+	shards.reserve(shard_group_->shards.size());
+	for (std::size_t i=0;i<shard_group_->shards.size();++i)
+	{
+		shared_ptr shard=shard_group_->shards[i].lock();
+		if (shard)
+			shards.push_back(shard);
+	}
+	return shards;
+}
+
+//flow id on wire is localID*shard_count_+shard_index_, so any shard can tell
+//the owner of a packet that the kernel hashed to it.
+uint32_t basic_shared_udp_layer::__to_wire_flow_id(uint32_t localID)const
+{
+	if (localID>=INVALID_FLOWID/shard_count_)
+		return INVALID_FLOWID;
+	return localID*shard_count_+shard_index_;
+}
+
+uint32_t basic_shared_udp_layer::__to_local_flow_id(uint32_t wireID)const
+{
+	if (wireID==INVALID_FLOWID)
+		return INVALID_FLOWID;
+	return wireID/shard_count_;
+}
+
 basic_shared_udp_layer::basic_shared_udp_layer(io_service& ios, 
-	const endpoint_type& local_edp,error_code& ec)
+	const endpoint_type& local_edp,error_code& ec, bool reusePort)
 	: basic_engine_object(ios)
 	, socket_(ios)
+	, recv_buffer_size_(mtu_size)
+	, b_path_mtu_discovery_(false)
 	, id_allocator_(true,64)
+	, flows_(FLOW_CHUNK_CNT,(flow_slot*)NULL)
 	, flows_cnt_(0)
 	, state_(INIT)
 	, continuous_recv_cnt_(0)
+	, shard_index_(0)
+	, shard_count_(1)
+	, pacing_timer_due_(0)
+	, simulator_wakeup_(0)
+#ifdef RUDP_BATCH_RECV
+	, b_batch_recv_(false)
+#endif
+#ifdef RUDP_BATCH_SEND
+	, b_batch_send_(false)
+	, b_send_flush_posted_(false)
+	, b_udp_gso_(false)
+#endif
+#ifdef RUDP_BATCH_RECV
+	, b_udp_gro_(false)
+#endif
 {
 	this->set_obj_desc("basic_shared_udp_layer");
 	socket_.open(local_edp.protocol(), ec);
@@ -197,6 +450,37 @@ basic_shared_udp_layer::basic_shared_udp_layer(io_service& ios,
 	socket_.set_option(asio::socket_base::reuse_address(false),ec);
 	socket_.set_option(do_not_fragment(false),ec);
 	ec.clear();
+	if (s_path_mtu_discovery_)
+	{
+		//the flows probe the path MTU themselves, so nothing may be fragmented
+		if (local_edp.address().is_v6())
+		{
+#ifdef IPV6_DONTFRAG
+			typedef boost::asio::detail::socket_option::boolean<IPPROTO_IPV6, IPV6_DONTFRAG> 
+				ipv6_do_not_fragment;
+			socket_.set_option(ipv6_do_not_fragment(true),ec);
+#else
+			ec=asio::error::operation_not_supported;
+#endif
+		}
+		else
+		{
+			typedef boost::asio::detail::socket_option::integer<IPPROTO_IP, IP_OPT_DONT_FRAG> 
+				do_not_fragment_value;
+#ifdef IP_PMTUDISC_PROBE
+			//DF, but do not take the path MTU learned from ICMP
+			socket_.set_option(do_not_fragment_value(IP_PMTUDISC_PROBE),ec);
+#else
+			socket_.set_option(do_not_fragment_value(DONT_FRAG_VALUE),ec);
+#endif
+		}
+		if (!ec)
+		{
+			b_path_mtu_discovery_=true;
+			recv_buffer_size_=MAX_MTU_SIZE+(mtu_size-MTU_SIZE);
+		}
+		ec.clear();
+	}
 	socket_.set_option(asio::socket_base::receive_buffer_size(1024*1024),ec);
 	if (ec)
 		socket_.set_option(asio::socket_base::receive_buffer_size(512*1024),ec);
@@ -206,6 +490,24 @@ basic_shared_udp_layer::basic_shared_udp_layer(io_service& ios,
 		socket_.set_option(asio::socket_base::send_buffer_size(1024*1024),ec);
 
 	ec.clear();
+#ifdef RUDP_REUSE_PORT
+	if (reusePort)
+	{
+		socket_.set_option(reuse_port(true),ec);
+		if (ec)
+		{
+			LOG(
+				LogError("unable to set SO_REUSEPORT, error:%d, %s",
+				ec.value(),ec.message().c_str());
+			);
+			error_code err;
+			socket_.close(err);
+			return;
+		}
+	}
+#else
+	UNUSED_PARAMETER(reusePort);
+#endif
 	socket_.bind(local_edp, ec);
 	if (ec)
 	{
@@ -237,7 +539,53 @@ basic_shared_udp_layer::basic_shared_udp_layer(io_service& ios,
 			s_shared_this_type_pool_.insert(std::make_pair(local_endpoint_, this));
 		}
 	}
-	recv_buffer_.recreate(mtu_size);
+	recv_buffer_pool_=raw_buffer_pool::create(recv_buffer_size_,MAX_CACHED_RECV_BUFFERS);
+	__renew_recv_buffer(recv_buffer_);
+#ifdef RUDP_BATCH_RECV
+	if (s_recv_batch_size_>1)
+	{
+		b_batch_recv_=true;
+		batch_recv_buffers_.resize(s_recv_batch_size_);
+		for (std::size_t i=0;i<batch_recv_buffers_.size();++i)
+			__renew_recv_buffer(batch_recv_buffers_[i]);
+		batch_recv_msgs_.resize(s_recv_batch_size_);
+		batch_recv_iovecs_.resize(s_recv_batch_size_);
+		batch_recv_addrs_.resize(s_recv_batch_size_);
+
+		if (s_udp_gro_enabled_)
+		{
+			error_code err;
+			socket_.set_option(udp_gro(true),err);
+			if (!err)
+			{
+				//a coalesced datagram can be as large as 64k
+				b_udp_gro_=true;
+				for (std::size_t i=0;i<batch_recv_buffers_.size();++i)
+					batch_recv_buffers_[i].recreate(MAX_GRO_BYTES);
+				batch_recv_ctrls_.resize(s_recv_batch_size_);
+			}
+		}
+	}
+#endif
+#ifdef RUDP_BATCH_SEND
+	if (s_send_batch_size_>1)
+	{
+		b_batch_send_=true;
+		send_queue_.reserve(s_send_batch_size_);
+		batch_send_msgs_.resize(s_send_batch_size_);
+		batch_send_iovecs_.resize(s_send_batch_size_*(MAX_DATAGRAM_BUFS+1));
+		batch_send_ctrls_.resize(s_send_batch_size_);
+		batch_send_first_dgram_.resize(s_send_batch_size_+1);
+
+		//probe UDP GSO, segment size is given for each super buffer by cmsg
+		if (s_udp_gso_enabled_)
+		{
+			error_code err;
+			socket_.set_option(udp_segment(0),err);
+			b_udp_gso_=!err;
+		}
+	}
+#endif
 #ifdef RUDP_SCRAMBLE
 	zero_8_bytes_.resize(8);
 	memset(buffer_cast<char*>(zero_8_bytes_),0,zero_8_bytes_.size());
@@ -246,14 +594,40 @@ basic_shared_udp_layer::basic_shared_udp_layer(io_service& ios,
 
 basic_shared_udp_layer::~basic_shared_udp_layer()
 {
+	shared_ptr successor;//released out of the lock
 	{
 		fast_mutex::scoped_lock lock(s_shared_this_type_pool_mutex_);
-		s_shared_this_type_pool_.erase(local_endpoint_);
+		this_type_container::iterator itr=s_shared_this_type_pool_.find(local_endpoint_);
+		if (itr!=s_shared_this_type_pool_.end()&&itr->second==this)
+		{
+			s_shared_this_type_pool_.erase(itr);
+			//let another shard of the port represent it
+			if (shard_group_)
+			{
+				fast_mutex::scoped_lock groupLock(shard_group_->mutex);
+				for (std::size_t i=0;i<shard_group_->shards.size();++i)
+				{
+					successor=shard_group_->shards[i].lock();
+					if (successor&&successor.get()!=this)
+					{
+						s_shared_this_type_pool_.insert(std::make_pair(local_endpoint_,successor.get()));
+						break;
+					}
+				}
+			}
+		}
 		LOG(
 			std::cout<<"basic_shared_udp_layer size="<<s_shared_this_type_pool_.size()<<"\n"
 			);
 	}
 	close_without_protector();
+	if (recv_buffer_pool_)
+		recv_buffer_pool_->close();//buffers still in use are freed as usual
+	if (pacing_timer_)
+	{
+		pacing_timer_->cancel();
+		pacing_timer_->time_signal().clear();
+	}
 	//if(lingerSendTimer_)
 	//{
 	//	lingerSendTimer_->cancel();
@@ -261,12 +635,16 @@ basic_shared_udp_layer::~basic_shared_udp_layer()
 	//}
 
 	BOOST_ASSERT(acceptors_.empty());
-	DEBUG_SCOPE(
-		for (std::size_t i=0;i<flows_.size();++i)
-		{
-			BOOST_ASSERT(flows_[i].flow==NULL);
-		}
-		);
+	for (std::size_t i=0;i<flows_.size();++i)
+	{
+		DEBUG_SCOPE(
+			for (std::size_t j=0;flows_[i]&&j<FLOW_CHUNK_SIZE;++j)
+			{
+				BOOST_ASSERT(!flows_[i][j].is_registered());
+			}
+			);
+		delete[] flows_[i];
+	}
 }
 
 void basic_shared_udp_layer::start()
@@ -283,34 +661,28 @@ bool basic_shared_udp_layer::is_shared_endpoint(const endpoint_type& endpoint)
 	return s_shared_this_type_pool_.find(endpoint)!=s_shared_this_type_pool_.end(); 
 }
 
-//#define _LOST_TEST
-#ifdef _LOST_TEST
-#	define _LOST_RATE 0.25
-#endif
 void basic_shared_udp_layer::handle_receive(const error_code& ec, 
 	std::size_t bytes_transferred)
 {
 	//OBJ_PROTECTOR(protector);
 	if (state_!=STARTED)
 		return;
-	if (!ec)
+#ifdef RUDP_BATCH_RECV
+	if (!ec&&b_batch_recv_)
 	{
-#if defined(_LOST_TEST) && defined(P2ENGINE_DEBUG)
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!! LOST_TEST is OPEN !!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		WARNING("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-		if (in_probability(1.0-_LOST_RATE))
+		__batch_receive();
+		__flush_send_queue();
+		async_receive();
+		return;
+	}
 #endif
+	if (!ec)
+	{
 		{
 			global_remote_to_local_speed_meter()+=bytes_transferred;
 			do_handle_received(recv_buffer_.buffer_ref(0,bytes_transferred));
-			recv_buffer_.recreate(mtu_size);
+			__renew_recv_buffer(recv_buffer_);
+			__flush_send_queue();
 		}
 		async_receive();
 	}
@@ -341,7 +713,7 @@ void basic_shared_udp_layer::handle_receive(const error_code& ec,
 			}
 			else if(len>0)
 			{
-				if (len<2*mtu_size)
+				if (len<2*recv_buffer_size_)
 				{
 					recv_buffer_.recreate(len);
 					bytes_transferred =socket_.receive(
@@ -349,7 +721,7 @@ void basic_shared_udp_layer::handle_receive(const error_code& ec,
 					global_remote_to_local_speed_meter()+=bytes_transferred;
 					if (!err)
 						do_handle_received(recv_buffer_.buffer_ref(0,bytes_transferred));
-					recv_buffer_.recreate(mtu_size);
+					__renew_recv_buffer(recv_buffer_);
 				}
 				else
 				{
@@ -394,6 +766,14 @@ void basic_shared_udp_layer::async_receive()
 			boost::bind(&this_type::handle_receive,SHARED_OBJ_FROM_THIS,_1, _2)
 			));
 	}
+#ifdef RUDP_BATCH_RECV
+	if (b_batch_recv_)
+	{
+		//wait for readable, then drain the socket by recvmmsg in handle_receive
+		socket_.async_receive(asio::null_buffers(),*recv_handler_);
+		return;
+	}
+#endif
 	error_code ec;
 	if (socket_.available(ec)>0&&!ec&&++continuous_recv_cnt_<2)
 	{
@@ -414,11 +794,148 @@ void basic_shared_udp_layer::async_receive()
 	}
 }
 
+#ifdef RUDP_BATCH_RECV
+void basic_shared_udp_layer::__batch_receive()
+{
+	using p2engine::buffer_cast;
+
+	const std::size_t batchSize=batch_recv_msgs_.size();
+	for (std::size_t i=0;i<batchSize;++i)
+	{
+		BOOST_ASSERT(batch_recv_buffers_[i].size()>=recv_buffer_size_);
+		batch_recv_iovecs_[i].iov_base=buffer_cast<char*>(batch_recv_buffers_[i]);
+		batch_recv_iovecs_[i].iov_len=batch_recv_buffers_[i].size();
+
+		mmsghdr& msg=batch_recv_msgs_[i];
+		memset(&msg,0,sizeof(msg));
+		msg.msg_hdr.msg_name=&batch_recv_addrs_[i];
+		msg.msg_hdr.msg_namelen=sizeof(batch_recv_addrs_[i]);
+		msg.msg_hdr.msg_iov=&batch_recv_iovecs_[i];
+		msg.msg_hdr.msg_iovlen=1;
+		if (b_udp_gro_)
+		{
+			msg.msg_hdr.msg_control=batch_recv_ctrls_[i].buf;
+			msg.msg_hdr.msg_controllen=sizeof(batch_recv_ctrls_[i].buf);
+		}
+	}
+
+	int cnt=::recvmmsg(socket_.native_handle(),&batch_recv_msgs_[0],
+		(unsigned int)batchSize,MSG_DONTWAIT,NULL);
+	++recv_batch_stats_.syscalls;
+	if (cnt<0)
+	{
+		if (errno==ENOSYS||errno==EINVAL)
+		{
+			//kernel does not support recvmmsg, fall back to one datagram per receive
+			LOG(
+				LogWarning("recvmmsg is not supported(errno=%d), "
+				"basic_shared_udp_layer fall back to receive_from",errno);
+			);
+			b_batch_recv_=false;
+			if (b_udp_gro_)
+			{
+				//receive_from can not split the coalesced datagrams
+				error_code ec;
+				socket_.set_option(udp_gro(false),ec);
+				b_udp_gro_=false;
+			}
+		}
+		return;
+	}
+
+	std::size_t bytesTransferred=0;
+	for (int i=0;i<cnt&&state_==STARTED;++i)
+	{
+		mmsghdr& msg=batch_recv_msgs_[i];
+		bytesTransferred+=msg.msg_len;
+		++recv_batch_stats_.datagrams;
+		if (msg.msg_hdr.msg_flags&MSG_TRUNC)
+			continue;//too long, drop it
+		if (msg.msg_hdr.msg_namelen>sender_endpoint_.capacity())
+			continue;
+		memcpy(sender_endpoint_.data(),&batch_recv_addrs_[i],msg.msg_hdr.msg_namelen);
+		sender_endpoint_.resize(msg.msg_hdr.msg_namelen);
+
+		safe_buffer& buf=batch_recv_buffers_[i];
+		if (!b_udp_gro_)
+		{
+			do_handle_received(buf.buffer_ref(0,msg.msg_len));
+			__renew_recv_buffer(buf);
+			continue;
+		}
+
+		//the kernel may have coalesced several datagrams of the same flow into 
+		//one buffer, split them by the segment size it reports. Each segment
+		//is copied out so that the large receive buffer can be reused at once.
+		std::size_t segSize=msg.msg_len;
+		for (cmsghdr* cmsg=CMSG_FIRSTHDR(&msg.msg_hdr);cmsg;
+			cmsg=CMSG_NXTHDR(&msg.msg_hdr,cmsg))
+		{
+			if (cmsg->cmsg_level==SOL_UDP&&cmsg->cmsg_type==UDP_GRO)
+			{
+				int gsoSize=0;
+				memcpy(&gsoSize,CMSG_DATA(cmsg),sizeof(gsoSize));
+				if (gsoSize>0)
+					segSize=gsoSize;
+				break;
+			}
+		}
+		const char* p=buffer_cast<const char*>(buf);
+		if (segSize<msg.msg_len)
+			++recv_batch_stats_.gro_datagrams;
+		for (std::size_t off=0;off<msg.msg_len&&state_==STARTED;off+=segSize)
+		{
+			std::size_t len=std::min(segSize,msg.msg_len-off);
+			if (segSize<msg.msg_len)
+				++recv_batch_stats_.gro_segments;
+			if (len>recv_buffer_size_)
+			{
+				do_handle_received(safe_buffer(p+off,len));
+				continue;
+			}
+			safe_buffer seg;
+			__renew_recv_buffer(seg);
+			memcpy(buffer_cast<char*>(seg),p+off,len);
+			do_handle_received(seg.buffer_ref(0,len));
+		}
+	}
+	global_remote_to_local_speed_meter()+=bytesTransferred;
+}
+#endif
+
 error_code basic_shared_udp_layer::register_acceptor(const void* acc,
 	const std::string& domainName,
 	const recvd_request_handler_type& callBack,
 	error_code& ec
 	)
+{
+	//a connect request may be hashed to any shard of the port
+	std::vector<shared_ptr> shards=__shards();
+	for (std::size_t i=0;i<shards.size();++i)
+	{
+		shards[i]->__register_acceptor(acc,domainName,callBack,ec);
+		if (ec)
+		{
+			for (std::size_t j=0;j<i;++j)
+				shards[j]->__unregister_acceptor(acc);
+			break;
+		}
+	}
+	return ec;
+}
+
+void basic_shared_udp_layer::unregister_acceptor(const void*acptor)
+{
+	std::vector<shared_ptr> shards=__shards();
+	for (std::size_t i=0;i<shards.size();++i)
+		shards[i]->__unregister_acceptor(acptor);
+}
+
+error_code basic_shared_udp_layer::__register_acceptor(const void* acc,
+	const std::string& domainName,
+	const recvd_request_handler_type& callBack,
+	error_code& ec
+	)
 {
 	fast_mutex::scoped_lock lockAcceptor(acceptor_mutex_);
 
@@ -441,40 +958,33 @@ void basic_shared_udp_layer::register_flow(const void* flow,
 
 	fast_mutex::scoped_lock lock(flow_mutex_);
 
-	while(released_id_catch_.size()>0)
-	{
-		if (!released_id_keeper_.is_keeped(released_id_catch_.front()))
-		{
-			id_allocator_.release_id(released_id_catch_.front());
-			released_id_catch_.pop_front();
-		}
-		else
-		{
-			break;
-		}
-	}
+	__recycle_flow_ids();
 
 	id=id_allocator_.alloc_id();
-	if (id>=INVALID_FLOWID)
+	if (__to_wire_flow_id(id)>=INVALID_FLOWID)
 	{
-		__release_flow_id(id);
+		id_allocator_.release_id(id);//never published
 		ec=asio::error::no_descriptors;
 		id=INVALID_FLOWID;
 		return;//too much,drop it
 	}
 	else
 	{			
-		if (static_cast<uint32_t>(flows_.size())<=id)
+		flow_slot* chunk=flows_[id>>FLOW_CHUNK_BITS];
+		if (!chunk)
 		{
-			if (flows_.size()==0)
-				flows_.reserve(512);
-			flows_.resize(id+1);
+			chunk=new flow_slot[FLOW_CHUNK_SIZE];
+			//the slots must be visible before the chunk is
+			store_release(flows_[id>>FLOW_CHUNK_BITS],chunk);
 		}
-		BOOST_ASSERT(!flows_[id].flow&&!flows_[id].handler);
-		flows_[id].flow=const_cast<void*>(flow);
-		flows_[id].handler=callBack;
+		flow_slot& slot=chunk[id&(FLOW_CHUNK_SIZE-1)];
+		BOOST_ASSERT(!slot.is_registered());
+		slot.flow=const_cast<void*>(flow);
+		slot.handler=callBack;
+		slot.next_generation();//publish
 		ec.clear();
 		++flows_cnt_;
+		id=__to_wire_flow_id(id);
 	}
 }
 
@@ -482,10 +992,13 @@ void basic_shared_udp_layer::unregister_flow(uint32_t flow_id,void* flow)
 {
 	fast_mutex::scoped_lock lock(flow_mutex_);
 
-	if (flow_id!=INVALID_FLOWID&&flow_id<flows_.size())
+	flow_id=__to_local_flow_id(flow_id);
+	flow_slot* slot=__flow_slot(flow_id);
+	if (slot&&slot->is_registered())
 	{
-		BOOST_ASSERT(flows_[flow_id].flow==flow);
+		BOOST_ASSERT(slot->flow==flow);
 		UNUSED_PARAMETER(flow);
+		slot->next_generation();//receivers will not dispatch to it any more
 		__release_flow_id(flow_id);
 	}
 	else
@@ -501,16 +1014,37 @@ void basic_shared_udp_layer::unregister_flow(uint32_t flow_id,void* flow)
 void basic_shared_udp_layer::__release_flow_id(int id)
 {
 	--flows_cnt_;
-	flows_[id].reset();
 	lingerSends_.erase(id);
 
 	released_id_catch_.push_back(id);
 	released_id_keeper_.try_keep(id, seconds(64));//we don't reuse the id in a short period 
+	__recycle_flow_ids();
+}
+
+void basic_shared_udp_layer::__renew_recv_buffer(safe_buffer& buf)
+{
+	raw_buffer::intrusive_ptr rawBuf;
+	if (recv_buffer_pool_)
+		rawBuf=recv_buffer_pool_->alloc();
+	if (rawBuf)
+		buf.recreate(rawBuf,recv_buffer_size_);
+	else
+		buf.recreate(recv_buffer_size_);
+}
+
+void basic_shared_udp_layer::__recycle_flow_ids()
+{
 	while(released_id_catch_.size()>0)
 	{
-		if (!released_id_keeper_.is_keeped(released_id_catch_.front()))
+		int id=released_id_catch_.front();
+		if (!released_id_keeper_.is_keeped(id))
 		{
-			id_allocator_.release_id(released_id_catch_.front());
+			//no receiver can be still in the handler after so long a time
+			flow_slot* slot=__flow_slot(id);
+			BOOST_ASSERT(slot&&!slot->is_registered());
+			slot->flow=NULL;
+			slot->handler=recvd_data_handler_type();
+			id_allocator_.release_id(id);
 			released_id_catch_.pop_front();
 		}
 		else
@@ -520,7 +1054,17 @@ void basic_shared_udp_layer::__release_flow_id(int id)
 	}
 }
 
-void  basic_shared_udp_layer::unregister_acceptor(const void*acptor)
+basic_shared_udp_layer::flow_slot* basic_shared_udp_layer::__flow_slot(uint32_t id)const
+{
+	if (id>=INVALID_FLOWID)
+		return NULL;
+	flow_slot* chunk=load_acquire(flows_[id>>FLOW_CHUNK_BITS]);
+	if (!chunk)
+		return NULL;
+	return &chunk[id&(FLOW_CHUNK_SIZE-1)];
+}
+
+void  basic_shared_udp_layer::__unregister_acceptor(const void*acptor)
 {
 	fast_mutex::scoped_lock lock(acceptor_mutex_);
 
@@ -545,6 +1089,29 @@ std::size_t basic_shared_udp_layer::async_send_to(const safe_buffer& safebuffer,
 	std::size_t len=buffer_size(safebuffer);
 	if(len==0)
 		return 0;
+	if (__exceeds_simulated_path_mtu(len))
+		return len;
+	if (load_acquire(s_simulate_network_))
+	{
+		//the flow may reuse the buffer while the datagram waits
+		__simulate(safebuffer.clone(),ep);
+		return len;
+	}
+	__send_to(safebuffer,ep);
+	return len;
+}
+
+void basic_shared_udp_layer::__send_to(const safe_buffer& safebuffer,
+	const endpoint_type& ep)
+{
+	std::size_t len=buffer_size(safebuffer);
+#ifdef RUDP_BATCH_SEND
+	if (b_batch_send_)
+	{
+		__queue_send(&safebuffer,1,ep);
+		return;
+	}
+#endif
 
 #ifdef RUDP_SCRAMBLE
 	boost::array<asio::const_buffer,2> safe_sndbufs={{
@@ -553,7 +1120,6 @@ std::size_t basic_shared_udp_layer::async_send_to(const safe_buffer& safebuffer,
 	}};
 	socket_.async_send_to(safe_sndbufs,ep,s_dummy_callback);
 	global_local_to_remote_speed_meter()+=(len+zero_8_bytes_.size());
-	return len;
 	/*
 	boost::array<asio::const_buffer,2> sndbufs={{
 	asio::buffer(buffer_cast<const char*>(zero_8_bytes_),zero_8_bytes_.size()),
@@ -580,7 +1146,6 @@ std::size_t basic_shared_udp_layer::async_send_to(const safe_buffer& safebuffer,
 #else
 	global_local_to_remote_speed_meter()+=len;
 	socket_.async_send_to(safebuffer.to_asio_const_buffer(),ep,s_dummy_callback);
-	return len;
 	/*
 	socket_.send_to(
 	asio::buffer(buffer_cast<const char*>(safebuffer),buffer_size(safebuffer)),
@@ -600,6 +1165,469 @@ std::size_t basic_shared_udp_layer::async_send_to(const safe_buffer& safebuffer,
 #endif
 }
 
+basic_shared_udp_layer::send_batch_statistics 
+	basic_shared_udp_layer::send_batch_stats()const
+{
+#ifdef RUDP_BATCH_SEND
+	fast_mutex::scoped_lock lock(send_mutex_);
+	send_batch_statistics stats=send_batch_stats_;
+	stats.gso_layers=(b_udp_gso_?1:0);
+	return stats;
+#else
+	return send_batch_statistics();
+#endif
+}
+
+basic_shared_udp_layer::recv_batch_statistics 
+	basic_shared_udp_layer::recv_batch_stats()const
+{
+#ifdef RUDP_BATCH_RECV
+	recv_batch_statistics stats=recv_batch_stats_;
+	stats.gro_layers=(b_udp_gro_?1:0);
+	return stats;
+#else
+	return recv_batch_statistics();
+#endif
+}
+
+raw_buffer_pool::statistics basic_shared_udp_layer::recv_buffer_stats()const
+{
+	if (recv_buffer_pool_)
+		return recv_buffer_pool_->stats();
+	return raw_buffer_pool::statistics();
+}
+
+//a sharded port is kept in the pool by one of its shards only
+std::vector<basic_shared_udp_layer::shared_ptr> basic_shared_udp_layer::__all_layers()
+{
+	std::vector<shared_ptr> layers;
+	fast_mutex::scoped_lock lock(s_shared_this_type_pool_mutex_);
+	this_type_container::iterator itr=s_shared_this_type_pool_.begin();
+	for (;itr!=s_shared_this_type_pool_.end();++itr)
+	{
+		std::vector<shared_ptr> shards=itr->second->__shards();
+		layers.insert(layers.end(),shards.begin(),shards.end());
+	}
+	return layers;
+}
+
+basic_shared_udp_layer::send_batch_statistics 
+	basic_shared_udp_layer::total_send_batch_stats()
+{
+	send_batch_statistics total;
+	std::vector<shared_ptr> layers=__all_layers();
+	for (std::size_t i=0;i<layers.size();++i)
+	{
+		send_batch_statistics stats=layers[i]->send_batch_stats();
+		total.flushes+=stats.flushes;
+		total.syscalls+=stats.syscalls;
+		total.datagrams+=stats.datagrams;
+		total.fallbacks+=stats.fallbacks;
+		total.gso_sends+=stats.gso_sends;
+		total.gso_segments+=stats.gso_segments;
+		total.gso_layers+=stats.gso_layers;
+		total.max_batch=std::max(total.max_batch,stats.max_batch);
+		for (std::size_t j=0;j<sizeof(total.batch_histogram)/sizeof(total.batch_histogram[0]);++j)
+			total.batch_histogram[j]+=stats.batch_histogram[j];
+	}
+	return total;
+}
+
+basic_shared_udp_layer::recv_batch_statistics 
+	basic_shared_udp_layer::total_recv_batch_stats()
+{
+	recv_batch_statistics total;
+	std::vector<shared_ptr> layers=__all_layers();
+	for (std::size_t i=0;i<layers.size();++i)
+	{
+		recv_batch_statistics stats=layers[i]->recv_batch_stats();
+		total.syscalls+=stats.syscalls;
+		total.datagrams+=stats.datagrams;
+		total.gro_datagrams+=stats.gro_datagrams;
+		total.gro_segments+=stats.gro_segments;
+		total.gro_layers+=stats.gro_layers;
+	}
+	return total;
+}
+
+raw_buffer_pool::statistics basic_shared_udp_layer::total_recv_buffer_stats()
+{
+	raw_buffer_pool::statistics total;
+	std::vector<shared_ptr> layers=__all_layers();
+	for (std::size_t i=0;i<layers.size();++i)
+	{
+		raw_buffer_pool::statistics stats=layers[i]->recv_buffer_stats();
+		total.allocs+=stats.allocs;
+		total.reuses+=stats.reuses;
+		total.recycles+=stats.recycles;
+	}
+	return total;
+}
+
+basic_shared_udp_layer::pacing_statistics 
+	basic_shared_udp_layer::pacing_stats()const
+{
+	fast_mutex::scoped_lock lock(pacing_mutex_);
+	return pacing_stats_;
+}
+
+basic_shared_udp_layer::pacing_statistics 
+	basic_shared_udp_layer::total_pacing_stats()
+{
+	pacing_statistics total;
+	std::vector<shared_ptr> layers=__all_layers();
+	for (std::size_t i=0;i<layers.size();++i)
+	{
+		pacing_statistics stats=layers[i]->pacing_stats();
+		total.schedules+=stats.schedules;
+		total.wakeups+=stats.wakeups;
+		total.timer_fires+=stats.timer_fires;
+		total.max_pending=std::max(total.max_pending,stats.max_pending);
+	}
+	return total;
+}
+
+network_simulator::statistics basic_shared_udp_layer::simulator_stats()const
+{
+	fast_mutex::scoped_lock lock(simulator_mutex_);
+	return simulator_.stats();
+}
+
+network_simulator::statistics basic_shared_udp_layer::total_simulator_stats()
+{
+	network_simulator::statistics total;
+	std::vector<shared_ptr> layers=__all_layers();
+	for (std::size_t i=0;i<layers.size();++i)
+	{
+		network_simulator::statistics stats=layers[i]->simulator_stats();
+		total.datagrams+=stats.datagrams;
+		total.lost+=stats.lost;
+		total.overflowed+=stats.overflowed;
+		total.reordered+=stats.reordered;
+	}
+	return total;
+}
+
+void basic_shared_udp_layer::__simulate(const safe_buffer& safebuffer,
+	const endpoint_type& ep)
+{
+	network_conditions cond=simulated_network();
+	int64_t now=system_time::precise_tick_count();
+	long delay=-1;
+	{
+		fast_mutex::scoped_lock lock(simulator_mutex_);
+		if (!simulator_.push(safebuffer,ep,cond,now))
+			return;
+		int64_t due=simulator_.next_due();
+		if (!simulator_wakeup_||due<simulator_wakeup_)
+		{
+			simulator_wakeup_=due;
+			delay=(long)(due-now);
+		}
+	}
+	//the pacing timer wakes up the simulator too
+	if (delay>=0)
+	{
+		schedule_pacing(boost::bind(&this_type::__on_simulator_wakeup,
+			SHARED_OBJ_FROM_THIS),delay);
+	}
+}
+
+void basic_shared_udp_layer::__on_simulator_wakeup()
+{
+	std::vector<network_simulator::datagram> due;
+	long delay=-1;
+	{
+		fast_mutex::scoped_lock lock(simulator_mutex_);
+		int64_t now=system_time::precise_tick_count();
+		simulator_.pop_due(now,due);
+		simulator_wakeup_=0;
+		if (!simulator_.empty())
+		{
+			simulator_wakeup_=simulator_.next_due();
+			delay=(long)(simulator_wakeup_-now);
+		}
+	}
+	if (delay>=0)
+	{
+		schedule_pacing(boost::bind(&this_type::__on_simulator_wakeup,
+			SHARED_OBJ_FROM_THIS),delay);
+	}
+	if (state_!=STARTED)
+		return;
+	for (std::size_t i=0;i<due.size();++i)
+		__send_to(due[i].buf,due[i].ep);
+	__flush_send_queue();
+}
+
+void basic_shared_udp_layer::schedule_pacing(const pacing_handler_type& handler,
+	long delay_msec)
+{
+	int64_t due=system_time::precise_tick_count()+std::max(delay_msec,1L);
+	bool arm=false;
+	{
+		fast_mutex::scoped_lock lock(pacing_mutex_);
+		pacing_queue_.push_back(pacing_entry());
+		pacing_queue_.back().due=due;
+		pacing_queue_.back().handler=handler;
+		std::push_heap(pacing_queue_.begin(),pacing_queue_.end(),pacing_entry_later());
+		++pacing_stats_.schedules;
+		pacing_stats_.max_pending=std::max(pacing_stats_.max_pending,pacing_queue_.size());
+		if (!pacing_timer_due_||due<pacing_timer_due_)
+		{
+			pacing_timer_due_=due;
+			arm=true;
+		}
+	}
+	//the timer is only touched in the io_service of the layer
+	if (arm)
+		get_io_service().dispatch(boost::bind(&this_type::__arm_pacing_timer,SHARED_OBJ_FROM_THIS));
+}
+
+void basic_shared_udp_layer::__arm_pacing_timer()
+{
+	fast_mutex::scoped_lock lock(pacing_mutex_);
+	if (pacing_queue_.empty())
+		return;
+	if (!pacing_timer_)
+	{
+		pacing_timer_=precise_timer::create(get_io_service());
+		pacing_timer_->set_obj_desc("basic_shared_udp_layer::pacing_timer_");
+		pacing_timer_->time_signal().bind(&this_type::__on_pacing_timer,this VC9_BIND_BUG_PARAM_DUMMY);
+	}
+	pacing_timer_due_=pacing_queue_.front().due;
+	int64_t t=pacing_timer_due_-system_time::precise_tick_count();
+	pacing_timer_->async_wait(milliseconds(std::max(t,(int64_t)0)));
+}
+
+void basic_shared_udp_layer::__on_pacing_timer(VC9_BIND_BUG_PARAM)
+{
+	OBJ_PROTECTOR(protector);//the flows woken up may release the layer
+	{
+		fast_mutex::scoped_lock lock(pacing_mutex_);
+		int64_t now=system_time::precise_tick_count();
+		BOOST_ASSERT(pacing_fired_.empty());
+		while (!pacing_queue_.empty()&&pacing_queue_.front().due<=now)
+		{
+			std::pop_heap(pacing_queue_.begin(),pacing_queue_.end(),pacing_entry_later());
+			pacing_fired_.push_back(pacing_handler_type());
+			pacing_fired_.back().swap(pacing_queue_.back().handler);
+			pacing_queue_.pop_back();
+		}
+		++pacing_stats_.timer_fires;
+		pacing_stats_.wakeups+=pacing_fired_.size();
+		pacing_timer_due_=0;
+	}
+	__arm_pacing_timer();
+
+	//handlers may schedule again
+	std::vector<pacing_handler_type> fired;
+	fired.swap(pacing_fired_);
+	for (std::size_t i=0;i<fired.size();++i)
+		fired[i]();
+	fired.clear();
+	if (pacing_fired_.empty())
+		fired.swap(pacing_fired_);//keep the capacity
+}
+
+void basic_shared_udp_layer::__flush_send_queue()
+{
+#ifdef RUDP_BATCH_SEND
+	fast_mutex::scoped_lock lock(send_mutex_);
+	__do_flush_send_queue();
+#endif
+}
+
+#ifdef RUDP_BATCH_SEND
+std::size_t basic_shared_udp_layer::__queue_send(const safe_buffer* bufs, 
+	std::size_t cnt, const endpoint_type& ep)
+{
+	BOOST_ASSERT(cnt<=MAX_DATAGRAM_BUFS);
+	std::size_t len=0;
+	for (std::size_t i=0;i<cnt;++i)
+		len+=bufs[i].length();
+	if (len==0)
+		return 0;
+#ifdef RUDP_SCRAMBLE
+	global_local_to_remote_speed_meter()+=(len+zero_8_bytes_.size());
+#else
+	global_local_to_remote_speed_meter()+=len;
+#endif
+
+	fast_mutex::scoped_lock lock(send_mutex_);
+	send_queue_.push_back(pending_datagram());
+	pending_datagram& dgram=send_queue_.back();
+	dgram.ep=ep;
+	dgram.bufCnt=cnt;
+	for (std::size_t i=0;i<cnt;++i)
+		dgram.bufs[i]=bufs[i];
+
+	if (send_queue_.size()>=s_send_batch_size_||send_queue_.size()>=batch_send_msgs_.size())
+	{
+		__do_flush_send_queue();
+	}
+	else if (!b_send_flush_posted_)
+	{
+		//flush when the handlers that are running now have done
+		b_send_flush_posted_=true;
+		get_io_service().post(boost::bind(&this_type::__flush_send_queue,SHARED_OBJ_FROM_THIS));
+	}
+	return len;
+}
+
+void basic_shared_udp_layer::__do_flush_send_queue()
+{
+	//send_mutex_ must be locked
+	b_send_flush_posted_=false;
+	if (send_queue_.empty())
+		return;
+	if (!socket_.is_open())
+	{
+		send_queue_.clear();
+		return;
+	}
+
+	//a run of datagrams of the same size to the same endpoint is sent as one 
+	//super buffer and segmented by the kernel(UDP GSO). Only the last one of 
+	//the run can be shorter.
+	const std::size_t queSize=send_queue_.size();
+	BOOST_ASSERT(queSize<=batch_send_msgs_.size());
+	std::size_t msgCnt=0;
+	std::size_t iovCnt=0;
+	for (std::size_t i=0;i<queSize;++msgCnt)
+	{
+		const std::size_t iovBegin=iovCnt;
+		const endpoint_type& ep=send_queue_[i].ep;
+		const std::size_t segSize=__fill_send_iovecs(send_queue_[i],iovCnt);
+		std::size_t totalSize=segSize;
+		std::size_t segCnt=1;
+		batch_send_first_dgram_[msgCnt]=i++;
+		while(b_udp_gso_&&i<queSize&&segCnt<MAX_GSO_SEGMENTS&&send_queue_[i].ep==ep)
+		{
+			std::size_t len=__send_datagram_size(send_queue_[i]);
+			if (len>segSize||totalSize+len>MAX_GSO_BYTES)
+				break;
+			__fill_send_iovecs(send_queue_[i++],iovCnt);
+			totalSize+=len;
+			++segCnt;
+			if (len<segSize)
+				break;
+		}
+
+		mmsghdr& msg=batch_send_msgs_[msgCnt];
+		memset(&msg,0,sizeof(msg));
+		msg.msg_hdr.msg_name=const_cast<endpoint_type&>(ep).data();
+		msg.msg_hdr.msg_namelen=(socklen_t)ep.size();
+		msg.msg_hdr.msg_iov=&batch_send_iovecs_[iovBegin];
+		msg.msg_hdr.msg_iovlen=iovCnt-iovBegin;
+		if (segCnt>1)
+		{
+			msg.msg_hdr.msg_control=batch_send_ctrls_[msgCnt].buf;
+			msg.msg_hdr.msg_controllen=CMSG_SPACE(sizeof(uint16_t));
+			cmsghdr* cmsg=CMSG_FIRSTHDR(&msg.msg_hdr);
+			cmsg->cmsg_level=SOL_UDP;
+			cmsg->cmsg_type=UDP_SEGMENT;
+			cmsg->cmsg_len=CMSG_LEN(sizeof(uint16_t));
+			uint16_t gsoSize=(uint16_t)segSize;
+			memcpy(CMSG_DATA(cmsg),&gsoSize,sizeof(gsoSize));
+			++send_batch_stats_.gso_sends;
+			send_batch_stats_.gso_segments+=segCnt;
+		}
+	}
+	batch_send_first_dgram_[msgCnt]=queSize;
+
+	std::size_t sentMsg=0;
+	while(sentMsg<msgCnt)
+	{
+		int cnt=::sendmmsg(socket_.native_handle(),&batch_send_msgs_[sentMsg],
+			(unsigned int)(msgCnt-sentMsg),MSG_DONTWAIT);
+		++send_batch_stats_.syscalls;
+		if (cnt<=0)
+		{
+			if (cnt<0&&b_udp_gso_&&(errno==EINVAL||errno==EIO)
+				&&batch_send_msgs_[sentMsg].msg_hdr.msg_control)
+			{
+				//the kernel or the NIC rejects the segmentation
+				LOG(
+					LogWarning("UDP GSO send failed(errno=%d), "
+					"basic_shared_udp_layer disable GSO",errno);
+				);
+				b_udp_gso_=false;
+			}
+			else if (cnt<0&&(errno==ENOSYS||errno==EINVAL))
+			{
+				LOG(
+					LogWarning("sendmmsg is not supported(errno=%d), "
+					"basic_shared_udp_layer fall back to async_send_to",errno);
+				);
+				b_batch_send_=false;
+			}
+			break;
+		}
+		sentMsg+=cnt;
+	}
+	const std::size_t sent=batch_send_first_dgram_[sentMsg];
+	send_batch_stats_.datagrams+=sent;
+	send_batch_stats_.max_batch=std::max(send_batch_stats_.max_batch,queSize);
+	++send_batch_stats_.flushes;
+	std::size_t slot=0;
+	for (std::size_t n=queSize;n>1&&slot<7;n>>=1)
+		++slot;
+	++send_batch_stats_.batch_histogram[slot];
+
+	//the socket buffer is full or sendmmsg failed, let asio queue the rest
+	for (std::size_t i=sent;i<queSize;++i)
+	{
+		pending_datagram& dgram=send_queue_[i];
+		boost::array<asio::const_buffer,MAX_DATAGRAM_BUFS+1> sndbufs;
+		std::size_t bufCnt=0;
+#ifdef RUDP_SCRAMBLE
+		sndbufs[bufCnt++]=zero_8_bytes_.to_asio_const_buffer();
+#endif
+		for (std::size_t j=0;j<dgram.bufCnt;++j)
+			sndbufs[bufCnt++]=dgram.bufs[j].to_asio_const_buffer();
+		for (std::size_t j=bufCnt;j<sndbufs.size();++j)
+			sndbufs[j]=asio::const_buffer();
+		socket_.async_send_to(sndbufs,dgram.ep,s_dummy_callback);
+		++send_batch_stats_.fallbacks;
+	}
+	send_queue_.clear();
+}
+
+std::size_t basic_shared_udp_layer::__send_datagram_size(
+	const pending_datagram& dgram)const
+{
+#ifdef RUDP_SCRAMBLE
+	std::size_t len=zero_8_bytes_.size();
+#else
+	std::size_t len=0;
+#endif
+	for (std::size_t j=0;j<dgram.bufCnt;++j)
+		len+=dgram.bufs[j].length();
+	return len;
+}
+
+std::size_t basic_shared_udp_layer::__fill_send_iovecs(
+	const pending_datagram& dgram, std::size_t& iovCnt)
+{
+	std::size_t len=0;
+#ifdef RUDP_SCRAMBLE
+	batch_send_iovecs_[iovCnt].iov_base=buffer_cast<char*>(zero_8_bytes_);
+	batch_send_iovecs_[iovCnt].iov_len=zero_8_bytes_.size();
+	len+=zero_8_bytes_.size();
+	++iovCnt;
+#endif
+	for (std::size_t j=0;j<dgram.bufCnt;++j)
+	{
+		batch_send_iovecs_[iovCnt].iov_base=buffer_cast<char*>(dgram.bufs[j]);
+		batch_send_iovecs_[iovCnt].iov_len=dgram.bufs[j].length();
+		len+=dgram.bufs[j].length();
+		++iovCnt;
+	}
+	return len;
+}
+#endif
+
 void basic_shared_udp_layer::do_handle_received(const safe_buffer& buffer)
 {
 #ifdef RUDP_SCRAMBLE
@@ -618,6 +1646,16 @@ void basic_shared_udp_layer::do_handle_received(const safe_buffer& buffer)
 #endif
 }
 
+void basic_shared_udp_layer::__handle_forwarded_msg(safe_buffer& buffer, 
+	const endpoint_type& from)
+{
+	if (state_!=STARTED)
+		return;
+	sender_endpoint_=from;
+	do_handle_received_urdp_msg(buffer);
+	__flush_send_queue();
+}
+
 void basic_shared_udp_layer::do_handle_received_urdp_msg(safe_buffer& buffer)
 {
 	packet<packet_format_type> urdpHeaderDef(buffer);
@@ -625,11 +1663,15 @@ void basic_shared_udp_layer::do_handle_received_urdp_msg(safe_buffer& buffer)
 
 	if (is_conn_request_vistor<packet_format_type>()(urdpHeaderDef))
 	{
+		std::pair<const char*,std::size_t> domain
+			=get_demain_name_ref_vistor<packet_format_type>()(urdpHeaderDef,buffer);
+		domain_ref domainName={domain.first,domain.second};
+
 		fast_mutex::scoped_lock lockAcceptor(acceptor_mutex_);
 
-		std::string domainName=get_demain_name_vistor<packet_format_type>()(urdpHeaderDef,buffer);
 		//Ƿмһdomainϵacceptor
-		acceptor_container::iterator itr=acceptors_.find(domainName);
+		acceptor_container::iterator itr=acceptors_.find(domainName,
+			domain_ref_hash(),domain_ref_equal());
 		if (itr==acceptors_.end())
 		{
 			if (unreachable_endpoint_keeper_.try_keep(sender_endpoint_,seconds(2)))
@@ -655,8 +1697,9 @@ void basic_shared_udp_layer::do_handle_received_urdp_msg(safe_buffer& buffer)
 		else
 		{//ģһflow¼flow id
 			acceptor_element& acceptorElement= itr->second;
-			id.flow_id=acceptorElement.handler(id.remoteEndpoint);
-			BOOST_ASSERT(std::find(released_id_catch_.begin(),released_id_catch_.end(),id.flow_id)==released_id_catch_.end());
+			id.flow_id=acceptorElement.handler(id.remoteEndpoint,SHARED_OBJ_FROM_THIS);
+			BOOST_ASSERT(std::find(released_id_catch_.begin(),released_id_catch_.end(),
+				(int)__to_local_flow_id(id.flow_id))==released_id_catch_.end());
 			request_uuid_keeper_.try_keep(id,seconds(60));
 			dstPeerID=id.flow_id;
 		}
@@ -665,19 +1708,38 @@ void basic_shared_udp_layer::do_handle_received_urdp_msg(safe_buffer& buffer)
 	else
 	{
 		dstPeerID=get_dst_peer_id_vistor<packet_format_type>()(urdpHeaderDef);
+		if (shard_group_&&dstPeerID!=INVALID_FLOWID&&dstPeerID%shard_count_!=shard_index_)
+		{
+			//the flow is owned by another shard(an active flow whose replies 
+			//are hashed here, or any flow after a shard of a steered group
+			//has been closed), hand the packet over to it.
+			shared_ptr owner;
+			{
+				fast_mutex::scoped_lock lock(shard_group_->mutex);
+				std::size_t ownerIndex=dstPeerID%shard_count_;
+				if (ownerIndex<shard_group_->shards.size())
+					owner=shard_group_->shards[ownerIndex].lock();
+			}
+			if (owner)
+			{
+				owner->get_io_service().post(boost::bind(
+					&this_type::__handle_forwarded_msg,owner,buffer,sender_endpoint_
+					));
+			}
+			return;
+		}
 	}
+	dstPeerID=__to_local_flow_id(dstPeerID);
 
-	fast_mutex::scoped_lock lockFlow(flow_mutex_);
-	if(dstPeerID!=INVALID_FLOWID
-		&&dstPeerID<(uint32_t)flows_.size()
-		&&flows_[dstPeerID].flow
-		&&flows_[dstPeerID].handler
-		//&&(*(flows_[dstPeerID].handler)
-		)
+	flow_slot* slot=__flow_slot(dstPeerID);
+	uint32_t generation=(slot?slot->current_generation():0);
+	if (generation&1)
 	{
-		BOOST_ASSERT(std::find(released_id_catch_.begin(),released_id_catch_.end(),dstPeerID)==released_id_catch_.end());
-		lockFlow.unlock();
-		flows_[dstPeerID].handler(buffer,sender_endpoint_);
+		//the handler was written before the generation was published. It is
+		//not dispatched to if the flow has been unregistered since.
+		const recvd_data_handler_type& handler=slot->handler;
+		if (slot->current_generation()==generation)
+			handler(buffer,sender_endpoint_);
 	}
 	else
 	{
@@ -0,0 +1,78 @@
+#include "p2engine/push_warning_option.hpp"
+#include <algorithm>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/random.hpp"
+#include "p2engine/rdp/network_simulator.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(urdp);
+
+network_simulator::network_simulator()
+	:link_free_(0.0),order_(0)
+{
+}
+
+bool network_simulator::push(const safe_buffer& buf, const endpoint_type& ep, 
+							 const network_conditions& cond, int64_t now)
+{
+	++stats_.datagrams;
+
+	//the bottleneck sends one datagram after another
+	double departure=(double)now;
+	if (cond.bandwidth>0.0)
+	{
+		double start=std::max(link_free_, (double)now);
+		double queued=(start-(double)now)*cond.bandwidth/1000.0;
+		if (cond.queue_bytes&&queued+buf.size()>(double)cond.queue_bytes)
+		{
+			++stats_.overflowed;
+			return false;
+		}
+		link_free_=start+buf.size()*1000.0/cond.bandwidth;
+		departure=link_free_;
+	}
+
+	if (cond.loss_rate>0.0&&in_probability(cond.loss_rate))
+	{
+		++stats_.lost;
+		return false;
+	}
+
+	long delay=cond.delay_msec;
+	if (cond.jitter_msec>0)
+		delay+=random<long>(0, cond.jitter_msec+1);
+	if (cond.reorder_rate>0.0&&in_probability(cond.reorder_rate))
+	{
+		++stats_.reordered;
+		delay+=std::max(cond.delay_msec, 1L);
+	}
+
+	queue_.push_back(datagram());
+	datagram& dgram=queue_.back();
+	dgram.buf=buf;
+	dgram.ep=ep;
+	dgram.due=(int64_t)departure+delay;
+	dgram.order=order_++;
+	std::push_heap(queue_.begin(), queue_.end(), datagram_later());
+	return true;
+}
+
+void network_simulator::pop_due(int64_t now, std::vector<datagram>& out)
+{
+	while (!queue_.empty()&&queue_.front().due<=now)
+	{
+		std::pop_heap(queue_.begin(), queue_.end(), datagram_later());
+		out.push_back(queue_.back());
+		queue_.pop_back();
+	}
+}
+
+int64_t network_simulator::next_due()const
+{
+	BOOST_ASSERT(!queue_.empty());
+	return queue_.front().due;
+}
+
+NAMESPACE_END(urdp);
+NAMESPACE_END(p2engine);
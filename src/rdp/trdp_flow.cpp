@@ -23,6 +23,23 @@ inline int64_t NOW(){
 	return system_time::tick_count();
 }
 
+namespace
+{
+	//a gathered write takes at most so many messages(two buffers each), or
+	//goes on till it has so many bytes
+	const std::size_t MAX_GATHER_MSGS=64;
+	const std::size_t MAX_GATHER_BYTES=64*1024;
+
+	//the socket is read into chunks of so many bytes(or of a message if it
+	//is larger), a read is not issued for less than MIN_READ bytes
+	const std::size_t RECV_CHUNK=32*1024;
+	const std::size_t MIN_READ=2*1024;
+
+	//a message of less bytes is copied out of the chunk, so that one kept
+	//by the application does not hold the whole chunk
+	const std::size_t MIN_SLICE=512;
+}
+
 trdp_flow::trdp_flow(io_service& ios, bool realTimeUtility, bool passiveMode)
 	:basic_engine_object(ios)
 	,socket_impl_(ios)
@@ -31,6 +48,12 @@ trdp_flow::trdp_flow(io_service& ios, bool realTimeUtility, bool passiveMode)
 	,is_realtime_utility_(realTimeUtility)
 	,resolver_(ios)
 	,sending_(false)
+	,recv_begin_(0)
+	,recv_end_(0)
+	,reads_(0)
+	,read_msgs_(0)
+	,writes_(0)
+	,written_msgs_(0)
 	,remote_to_local_lost_rate_(-1)
 	,local_to_remote_lost_rate_(-1)
 	,id_for_lost_rate_(0)
@@ -62,10 +85,11 @@ void trdp_flow::__init()
 	flowid_=random<uint32_t>(0,INVALID_FLOWID);
 	connection_=NULL;
 	sending_=false;
-	qued_sending_size_=0;
-	while(!send_bufs_.empty())
-		send_bufs_.pop();
+	write_time_=0;
+	send_bufs_.clear();
 	//can_send_=false;
+	recv_chunk_.reset();
+	recv_begin_=recv_end_=0;
 	recv_state_=RECVED;
 	state_=(is_passive_?OPENED:INIT);
 	ping_interval_=seconds(15);
@@ -314,15 +338,8 @@ void trdp_flow::__waiting_domain_coro(const error_code& ec, std::size_t len,
 			shared_layer_sptr sharedLayer=shared_layer_.lock();
 			if (sharedLayer)
 			{
-				acceptor_type* acc=sharedLayer->find_acceptor(
-					std::string(buffer_cast<char*>(recv_buf_),recv_buf_.length())
-					);
-				if (acc)
-				{
-					accept(error_code());//,SHARED_OBJ_FROM_THIS
-					acc->accept_flow(SHARED_OBJ_FROM_THIS);
-				}
-				else
+				std::string domainName(buffer_cast<char*>(recv_buf_),recv_buf_.length());
+				if (!sharedLayer->accept_flow(domainName,SHARED_OBJ_FROM_THIS))
 					accept(asio::error::connection_refused);
 			}
 		}
@@ -424,10 +441,9 @@ void trdp_flow::connect(const endpoint_type& remote_edp, const std::string& doma
 void trdp_flow::__close(bool greacful)
 {
 	set_cancel();
-	while(!send_bufs_.empty())
-	{
-		send_bufs_.pop();
-	}
+	send_bufs_.clear();
+	recv_chunk_.reset();
+	recv_begin_=recv_end_=0;
 
 	if (conn_timer_)
 	{
@@ -460,19 +476,34 @@ error_code trdp_flow::ping(error_code& ec)
 		return ec;
 	}
 	ec.clear();
-	if (is_open())
+	get_io_service().dispatch(make_alloc_handler(
+		boost::bind(&this_type::__send_ping,SHARED_OBJ_FROM_THIS)
+		));
+	return ec;
+}
+
+void trdp_flow::__send_ping()
+{
+	if (state_==CONNECTED&&is_open())
 	{
 		safe_buffer buf;
 		safe_buffer_io io(&buf);
 		io<<(int64_t)NOW();
 		__send(buf,(char)PING_PKT,false);
 	}
-	return ec;
 }
 
 void trdp_flow::ping_interval(const time_duration& t)
 {
-	BOOST_ASSERT(ping_timer_&&!ping_timer_->time_signal().empty());
+	get_io_service().dispatch(make_alloc_handler(
+		boost::bind(&this_type::__set_ping_interval,SHARED_OBJ_FROM_THIS,t)
+		));
+}
+
+void trdp_flow::__set_ping_interval(const time_duration& t)
+{
+	//the flow may have been closed before this runs
+	BOOST_ASSERT(!ping_timer_||!ping_timer_->time_signal().empty());
 	if (t!=ping_interval_)
 	{
 		ping_interval_=t;
@@ -483,11 +514,20 @@ void trdp_flow::ping_interval(const time_duration& t)
 
 void trdp_flow::keep_async_receiving()
 {
-	if (is_recv_blocked_&&recv_state_!=RECVING)
-	{
-		is_recv_blocked_=false;
-		do_keep_receiving(error_code(),recv_buf_.size(),op_stamp());
-	}
+	get_io_service().dispatch(make_alloc_handler(
+		boost::bind(&this_type::__keep_async_receiving,SHARED_OBJ_FROM_THIS)
+		));
+}
+
+void trdp_flow::__keep_async_receiving()
+{
+	if (!is_recv_blocked_)
+		return;
+	is_recv_blocked_=false;
+	//a read in progress, or the buffered messages being processed, go on
+	//by themselves
+	if (recv_state_!=RECVING)
+		do_keep_receiving(error_code(),0,op_stamp());
 }
 
 void trdp_flow::do_keep_receiving(error_code ec, std::size_t len, 
@@ -497,65 +537,104 @@ void trdp_flow::do_keep_receiving(error_code ec, std::size_t len,
 	if(is_canceled_op(stamp)||state_==CLOSED)
 		return;
 
-	uint16_t packetLen;
-	char* p=&recv_header_buf_[0];
 	CORO_REENTER(coro)
 	{
 		for(;;)
 		{
-			//in case of chaos, do not check "is_recv_blocked_" 
-			//while reading length and data, yield async receive len
+			//the messages already read go first, they stop when
+			//"is_recv_blocked_" is set
 			recv_state_=RECVING;
-			CORO_YIELD(asio::async_read(socket_impl_,
-				asio::buffer(&recv_header_buf_[0],2),
-				asio::transfer_all(),
-				make_alloc_handler(boost::bind(&this_type::do_keep_receiving,
-				SHARED_OBJ_FROM_THIS,_1,_2,stamp,coro)))
-				);
-			if (ec)
-			{
-				__to_close_state(ec,stamp);
-				return;
-			}
-			p=&recv_header_buf_[0];
-			packetLen=read_uint16_ntoh(p);
-			if (packetLen==0)
+			if (!__process_buffered(stamp))
 			{
 				recv_state_=RECVED;
-				//check "is_recv_blocked_" before reading the next packet
-				if (is_recv_blocked_)
-					return;
-				continue;
+				return;
 			}
 
-			recv_buf_.recreate(packetLen);
-			//yield async receive data
-			CORO_YIELD(asio::async_read(socket_impl_,
-				asio::buffer(buffer_cast<char*>(recv_buf_),packetLen),
-				asio::transfer_at_least(packetLen),
+			//yield async receive as much as the socket has
+			__prepare_recv_chunk();
+			CORO_YIELD(socket_impl_.async_read_some(
+				asio::buffer(buffer_cast<char*>(recv_chunk_)+recv_end_,
+				recv_chunk_.length()-recv_end_),
 				make_alloc_handler(boost::bind(&this_type::do_keep_receiving,
 				SHARED_OBJ_FROM_THIS,_1,_2,stamp,coro)))
 				);
-			recv_state_=RECVED;
 			if (ec)
 			{
+				recv_state_=RECVED;
 				__to_close_state(ec,stamp);
 				return;
 			}
+			recv_end_+=len;
+			++reads_;
+		}
+	}
+}
 
-			//read a packet successfully. check "is_recv_blocked_" before processing it
-			//if is_recv_blocked_ is false, process the packet
-			if (is_recv_blocked_)
-				return;
-			if (!__process_data(stamp))
-				return;
+bool trdp_flow::__process_buffered(op_stamp_t stamp)
+{
+	while (recv_end_-recv_begin_>=2)
+	{
+		if (is_recv_blocked_)
+			return false;
+
+		char* p=buffer_cast<char*>(recv_chunk_)+recv_begin_;
+		uint16_t packetLen=read_uint16_ntoh(p);
+		if (recv_end_-recv_begin_<2+(std::size_t)packetLen)
+			break;
+		recv_begin_+=2;
+		if (packetLen==0)
+			continue;
+
+		//a slice of the chunk, which is never written again where it lies. Its
+		//capacity ends with the message, so a write to it(or to a copy) goes
+		//to a new buffer instead of over the messages after it
+		if (packetLen<MIN_SLICE)
+		{
+			recv_buf_=safe_buffer(p+2,packetLen);
+		}
+		else
+		{
+			recv_buf_=recv_chunk_.buffer_ref(recv_begin_,packetLen);
+			recv_buf_.limit_capacity();
+		}
+		recv_begin_+=packetLen;
+		++read_msgs_;
+		if (!__process_data(stamp))
+			return false;
+		//on_received may have closed the flow
+		if(is_canceled_op(stamp)||state_==CLOSED)
+			return false;
+	}
+	return !is_recv_blocked_;
+}
 
-			//check "is_recv_blocked_" before reading the next packet
-			if (is_recv_blocked_)
-				return;
+void trdp_flow::__prepare_recv_chunk()
+{
+	//the bytes of the message at recv_begin_
+	std::size_t pending=recv_end_-recv_begin_;
+	std::size_t need=2;
+	if (pending>=2)
+	{
+		char* p=buffer_cast<char*>(recv_chunk_)+recv_begin_;
+		need+=read_uint16_ntoh(p);
+	}
+	//goes on in the chunk if the message fits and there is room for a read
+	//worth it, or the message is on the way; the bytes before recv_end_ are
+	//never overwritten, so the slices delivered stay valid
+	std::size_t cap=recv_chunk_.length();
+	if (cap>=recv_begin_+need&&(cap-recv_end_>=MIN_READ||pending>0))
+		return;
 
-		}
+	//a new chunk, and the head of the message is moved to it
+	safe_buffer chunk((std::max)(RECV_CHUNK,need));
+	if (pending>0)
+	{
+		memcpy(buffer_cast<char*>(chunk),
+			buffer_cast<char*>(recv_chunk_)+recv_begin_,pending);
 	}
+	recv_chunk_=chunk;
+	recv_begin_=0;
+	recv_end_=pending;
 }
 
 void trdp_flow::__async_resolve_connect_coro(error_code err, 
@@ -725,10 +804,8 @@ bool trdp_flow::__process_data(op_stamp_t stamp)
 				__to_close_state(ec,stamp);
 				return false;
 			}
-			safe_buffer pingReply;
-			safe_buffer_io io(&pingReply);
-			io.write(buffer_cast<char*>(recv_buf_),p2engine::buffer_size(recv_buf_));
-			__send(pingReply,(char)PONG_PKT,false);
+			//echoes the time in place
+			__send(recv_buf_,(char)PONG_PKT,false);
 		}
 		return true;
 	case (char)PONG_PKT:
@@ -821,8 +898,30 @@ error_code trdp_flow::__open(error_code& ec)
 	return ec;
 }
 
+void trdp_flow::__send_message(const safe_buffer& buffer, uint16_t msgType,
+							   sendmode mode)
+{
+	switch (mode)
+	{
+	case UNRELIABLE_SEND:
+		//if the unrealiable packets queued are too many, we drop it. The
+		//reliable ones are left out, they would block live messages
+		//behind a big piece
+		if (send_bufs_.unreliable_bytes()>8*1024)
+			return;
+		__send(buffer,(char)DATA_PKT,false,&msgType);
+		break;
+	case SEMIRELIABLE_SEND:
+		__send(buffer,(char)DATA_PKT,false,&msgType);
+		break;
+	default:
+		__send(buffer,(char)DATA_PKT,true,&msgType);
+		break;
+	}
+}
+
 void trdp_flow::__send(const safe_buffer& buffer, char type, bool alertWritable,
-					   uint16_t* msgType, bool fromQue)
+					   uint16_t* msgType)
 {
 	if (state_!=CONNECTED)
 	{
@@ -833,80 +932,109 @@ void trdp_flow::__send(const safe_buffer& buffer, char type, bool alertWritable,
 		return;
 	}
 
-	//if is sending, push this packet into sendque
-	if ((!send_bufs_.empty()&&!fromQue)||sending_)
+	const msec_type MAX_TIME=(std::numeric_limits<msec_type>::max)();
+	msec_type now=NOW();
+	//the socket has taken nothing for 10s
+	if (sending_&&write_time_+10000<now)
 	{
-		const msec_type MAX_TIME=(std::numeric_limits<msec_type>::max)();
-		msec_type now=NOW();
-		if (!send_bufs_.empty()
-			&&send_bufs_.front().outTime!=MAX_TIME
-			&&send_bufs_.front().outTime+10000<now
-			)
-		{
-			error_code ec=asio::error::connection_aborted;
-			get_io_service().post(make_alloc_handler(
-				boost::bind(&this_type::__to_close_state,SHARED_OBJ_FROM_THIS,ec,op_stamp())
-				));
-			return;
-		}
-
-		send_emlment elm;
-		elm.buf=buffer;
-		elm.alertWritable=alertWritable;
-		elm.msgType=(msgType?(*msgType):(INVALID_MSGTYPE));
-		if (alertWritable)
-			elm.outTime=MAX_TIME;
-		else
-			elm.outTime=now+250;//un-reliable packets, will be discard if they could not be sent with 250ms
-		send_bufs_.push(elm);
-
-		if (send_bufs_.size()>4096)
-		{
-
-		}
-
+		error_code ec=asio::error::connection_aborted;
+		get_io_service().post(make_alloc_handler(
+			boost::bind(&this_type::__to_close_state,SHARED_OBJ_FROM_THIS,ec,op_stamp())
+			));
 		return;
 	}
 
-	++id_for_lost_rate_;
+	//every packet goes through the que, so that those sent while a write is
+	//in progress are gathered into the next one
+	send_emlment elm;
+	elm.buf=buffer;
+	elm.type=type;
+	elm.alertWritable=alertWritable;
+	elm.msgType=(msgType?(*msgType):(INVALID_MSGTYPE));
+	if (alertWritable)
+		elm.outTime=MAX_TIME;
+	else
+		elm.outTime=now+250;//un-reliable packets, will be discard if they could not be sent with 250ms
+	send_bufs_.push(elm,type!=DATA_PKT);
+	__expire_queued(now);
 
-	safe_buffer len;
-	safe_buffer_io io(&len);
-	io<<uint16_t(2+buffer.length()+(msgType?2:0));
-	io<<(char)id_for_lost_rate_;
-	io<<(char)type;
-	if (msgType)
-		io<<uint16_t(*msgType);
+	if (!sending_)
+		__write_queued();
+}
 
-	out_speed_meter_+=len.length()+buffer.length();
-	global_local_to_remote_speed_meter()+=len.length()+buffer.length();
-	__local_to_remote_lost_rate(&id_for_lost_rate_);
+void trdp_flow::__write_queued()
+{
+	BOOST_ASSERT(!sending_);
 
-	if(buffer.length()>0)
+	msec_type now=NOW();
+	safe_buffer headers;
+	safe_buffer_io io(&headers);
+	std::size_t headerEnds[MAX_GATHER_MSGS];
+	std::size_t bytes=0;
+	bool alertWritable=false;
+	write_bufs_.clear();
+	__expire_queued(now);
+	send_emlment elm;
+	while (write_bufs_.size()<MAX_GATHER_MSGS&&bytes<MAX_GATHER_BYTES
+		&&send_bufs_.pop(elm))
 	{
-		boost::array<p2engine::asio_const_buffers_1,2> vec=
-		{
-			{
-				len.to_asio_const_buffers_1(),
-					buffer.to_asio_const_buffers_1()
-			}
-		};
-		asio::async_write(socket_impl_,vec,
-			asio::transfer_all(),
-			make_alloc_handler(boost::bind(&this_type::__handle_sent_packet,
-			SHARED_OBJ_FROM_THIS,_1,_2,alertWritable,op_stamp()))
-			);
+		++id_for_lost_rate_;
+		bool hasMsgType=(elm.msgType!=INVALID_MSGTYPE);
+		io<<uint16_t(2+elm.buf.length()+(hasMsgType?2:0));
+		io<<(char)id_for_lost_rate_;
+		io<<(char)elm.type;
+		if (hasMsgType)
+			io<<uint16_t(elm.msgType);
+		__local_to_remote_lost_rate(&id_for_lost_rate_);
+
+		headerEnds[write_bufs_.size()]=headers.length();
+		bytes+=elm.buf.length();
+		alertWritable=(alertWritable||elm.alertWritable);
+		write_bufs_.push_back(elm.buf);
 	}
-	else
+	if (write_bufs_.empty())
+		return;
+
+	//[header|payload] of each packet, the empty payloads are left out
+	write_iovecs_.clear();
+	const char* h=buffer_cast<const char*>(headers);
+	std::size_t headerBegin=0;
+	for (std::size_t i=0;i<write_bufs_.size();++i)
 	{
-		asio::async_write(socket_impl_,len.to_asio_const_buffers_1(),
-			asio::transfer_all(),
-			make_alloc_handler(boost::bind(&this_type::__handle_sent_packet,
-			SHARED_OBJ_FROM_THIS,_1,_2,alertWritable,op_stamp()))
-			);
+		write_iovecs_.push_back(asio::const_buffer(h+headerBegin,
+			headerEnds[i]-headerBegin));
+		headerBegin=headerEnds[i];
+		if (write_bufs_[i].length()>0)
+		{
+			write_iovecs_.push_back(asio::const_buffer(
+				buffer_cast<const char*>(write_bufs_[i]),write_bufs_[i].length()));
+		}
 	}
-
+	++writes_;
+	written_msgs_+=write_bufs_.size();
+	write_bufs_.push_back(headers);//kept till the write completes
+
+	bytes+=headers.length();
+	out_speed_meter_+=bytes;
+	global_local_to_remote_speed_meter()+=bytes;
+
+	asio::async_write(socket_impl_,gathered_buffers(write_iovecs_),
+		asio::transfer_all(),
+		make_alloc_handler(boost::bind(&this_type::__handle_sent_packet,
+		SHARED_OBJ_FROM_THIS,_1,_2,alertWritable,op_stamp()))
+		);
 	sending_=true;
+	write_time_=now;
+}
+
+void trdp_flow::__expire_queued(msec_type now)
+{
+	//not sent because of timeout, remember id++ and calculate local to remote lost rate
+	for (std::size_t n=send_bufs_.expire(now);n>0;--n)
+	{
+		++id_for_lost_rate_;
+		local_to_remote_lost_rate();
+	}
 }
 
 void trdp_flow::__handle_sent_packet(const error_code& ec, std::size_t bytes_trans,
@@ -930,23 +1058,8 @@ void trdp_flow::__handle_sent_packet(const error_code& ec, std::size_t bytes_tra
 	if(is_canceled_op(stamp)||state_==CLOSED)
 		return;
 
-	int64_t now=NOW();
-	while (!sending_&&!send_bufs_.empty())
-	{
-		send_emlment elm=send_bufs_.front();
-		send_bufs_.pop();
-		if (elm.outTime>=now)
-		{
-			uint16_t*  pMsgType=((elm.msgType==INVALID_MSGTYPE)?NULL:&elm.msgType);
-			__send(elm.buf,DATA_PKT,elm.alertWritable,pMsgType,true);
-		}
-		else
-		{//not sent because of timeout, remember id++ and calculate local to remote lost rate
-			++id_for_lost_rate_;
-			local_to_remote_lost_rate();
-		}
-	}
-
+	if (!sending_&&!send_bufs_.empty())
+		__write_queued();
 }
 
 void trdp_flow::__to_close_state(const error_code& ec, op_stamp_t stamp)
@@ -0,0 +1,196 @@
+#include "p2engine/push_warning_option.hpp"
+#include <algorithm>
+#include <limits>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/rdp/trdp_send_scheduler.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(trdp);
+
+namespace
+{
+	inline bool is_unreliable(const trdp_send_element& elm)
+	{
+		return elm.outTime!=(std::numeric_limits<int64_t>::max)();
+	}
+}
+
+trdp_send_scheduler::trdp_send_scheduler()
+	:size_(0)
+	,bytes_(0)
+	,unreliable_bytes_(0)
+{
+}
+
+void trdp_send_scheduler::push(const element_type& elm, bool control)
+{
+	++size_;
+	bytes_+=elm.buf.length();
+	if (control)
+	{
+		control_.push_back(elm);
+		return;
+	}
+
+	type_queue& q=__queue_of(elm.msgType);
+	if (is_unreliable(elm))
+	{
+		q.unreliable.push_back(elm);
+		unreliable_bytes_+=elm.buf.length();
+	}
+	else
+	{
+		q.reliable.push_back(elm);
+	}
+	__activate(q);
+}
+
+trdp_send_scheduler::type_queue& trdp_send_scheduler::__queue_of(uint16_t msgType)
+{
+	type_queue_map::iterator itr=queues_.find(msgType);
+	if (itr==queues_.end())
+		return fifo_;
+	return itr->second;
+}
+
+void trdp_send_scheduler::__activate(type_queue& q)
+{
+	if (q.active||q.empty())
+		return;
+	q.active=true;
+	q.deficit=0;
+	round_.push_back(&q);
+}
+
+std::size_t trdp_send_scheduler::expire(msec_type now)
+{
+	std::size_t dropped=0;
+	for (std::size_t i=0;i<round_.size();++i)
+	{
+		std::deque<element_type>& q=round_[i]->unreliable;
+		while (!q.empty()&&q.front().outTime<now)
+		{
+			--size_;
+			bytes_-=q.front().buf.length();
+			unreliable_bytes_-=q.front().buf.length();
+			q.pop_front();
+			++dropped;
+		}
+	}
+	return dropped;
+}
+
+void trdp_send_scheduler::__take(std::deque<element_type>& q, element_type& elm)
+{
+	elm=q.front();
+	q.pop_front();
+	--size_;
+	bytes_-=elm.buf.length();
+	if (&q!=&control_&&is_unreliable(elm))
+		unreliable_bytes_-=elm.buf.length();
+}
+
+bool trdp_send_scheduler::pop(element_type& elm)
+{
+	if (!control_.empty())
+	{
+		__take(control_, elm);
+		return true;
+	}
+
+	while (!round_.empty())
+	{
+		type_queue& q=*round_.front();
+		if (q.empty())//all of it expired
+		{
+			q.active=false;
+			round_.pop_front();
+			continue;
+		}
+
+		std::deque<element_type>& head=(q.unreliable.empty()?q.reliable:q.unreliable);
+		long len=(long)head.front().buf.length();
+		//alone in the round, it need not earn the deficit
+		if (round_.size()==1)
+			q.deficit=std::max(q.deficit, len);
+		if (q.deficit>=len)
+		{
+			q.deficit-=len;
+			__take(head, elm);
+			if (q.empty())
+			{
+				q.active=false;
+				round_.pop_front();
+			}
+			return true;
+		}
+		//its turn is over, it earns the quantum for the next one
+		q.deficit+=(long)QUANTUM*q.weight;
+		round_.push_back(round_.front());
+		round_.pop_front();
+	}
+	return false;
+}
+
+void trdp_send_scheduler::clear()
+{
+	control_.clear();
+	fifo_.unreliable.clear();
+	fifo_.reliable.clear();
+	fifo_.deficit=0;
+	fifo_.active=false;
+	//the weights are kept
+	for (type_queue_map::iterator itr=queues_.begin();itr!=queues_.end();++itr)
+	{
+		itr->second.unreliable.clear();
+		itr->second.reliable.clear();
+		itr->second.deficit=0;
+		itr->second.active=false;
+	}
+	round_.clear();
+	size_=bytes_=unreliable_bytes_=0;
+}
+
+void trdp_send_scheduler::weight(uint16_t msgType, int w)
+{
+	type_queue_map::iterator itr=queues_.find(msgType);
+	if (itr==queues_.end())
+	{
+		itr=queues_.insert(std::make_pair(msgType, type_queue())).first;
+		__move_type(msgType, fifo_.unreliable, itr->second.unreliable);
+		__move_type(msgType, fifo_.reliable, itr->second.reliable);
+		__activate(itr->second);
+	}
+	itr->second.weight=std::min<int>(std::max<int>(w, 1), MAX_WEIGHT);
+}
+
+void trdp_send_scheduler::__move_type(uint16_t msgType, 
+	std::deque<element_type>& from, std::deque<element_type>& to)
+{
+	std::deque<element_type> rest;
+	for (std::size_t i=0;i<from.size();++i)
+	{
+		if (from[i].msgType==msgType)
+			to.push_back(from[i]);
+		else
+			rest.push_back(from[i]);
+	}
+	from.swap(rest);
+}
+
+int trdp_send_scheduler::weight(uint16_t msgType)const
+{
+	type_queue_map::const_iterator itr=queues_.find(msgType);
+	if (itr==queues_.end())
+		return DEFAULT_WEIGHT;
+	return itr->second.weight;
+}
+
+bool trdp_send_scheduler::weighted(uint16_t msgType)const
+{
+	return queues_.find(msgType)!=queues_.end();
+}
+
+NAMESPACE_END(trdp);
+NAMESPACE_END(p2engine);
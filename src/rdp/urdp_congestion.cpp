@@ -0,0 +1,227 @@
+#include "p2engine/push_warning_option.hpp"
+#include <map>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/mutex.hpp"
+#include "p2engine/rdp/urdp_congestion.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(urdp);
+
+namespace
+{
+	typedef std::map<std::string, congestion_control_type> domain_cc_map;
+
+	domain_cc_map& domain_cc()
+	{
+		static domain_cc_map domainCC;
+		return domainCC;
+	}
+	fast_mutex& domain_cc_mutex()
+	{
+		static fast_mutex mutex;
+		return mutex;
+	}
+}
+
+urdp_congestion_controller* urdp_congestion_controller::create(
+	congestion_control_type type, uint32_t mss, uint32_t cwnd, uint32_t ssthresh)
+{
+	switch (type)
+	{
+	case CC_LEDBAT:
+		return new ledbat_congestion_controller(mss, cwnd, ssthresh);
+	case CC_RENO:
+	default:
+		return new urdp_congestion_controller(mss, cwnd, ssthresh);
+	}
+}
+
+void urdp_congestion_controller::domain_congestion_control(
+	const std::string& domainName, congestion_control_type type)
+{
+	fast_mutex::scoped_lock lock(domain_cc_mutex());
+	if (type==CC_RENO)
+		domain_cc().erase(domainName);
+	else
+		domain_cc()[domainName]=type;
+}
+
+congestion_control_type urdp_congestion_controller::domain_congestion_control(
+	const std::string& domainName)
+{
+	fast_mutex::scoped_lock lock(domain_cc_mutex());
+	domain_cc_map::const_iterator itr=domain_cc().find(domainName);
+	if (itr!=domain_cc().end())
+		return itr->second;
+	return CC_RENO;
+}
+
+//
+// Reno
+//
+void urdp_congestion_controller::on_ack(uint32_t ackedBytes, uint32_t inFlight,
+	uint32_t ackSegs)
+{
+	UNUSED_PARAMETER(inFlight);
+	//a stretch ACK(see urdp_flow::ack_frequency) counts as the ACKs per 2
+	//segments it stands for, so that fewer ACKs do not slow the growth. A
+	//cumulative ACK after a hole or a RTO acks much more than that, it must
+	//not burst the window(RFC3465, L=2*SMSS without ACK frequency).
+	uint32_t credit=std::min(ackedBytes, std::max<uint32_t>(ackSegs, 2)*mss_);
+	uint32_t acks=std::max<uint32_t>(1, credit/(2*mss_));
+	// Slow start, congestion avoidance
+	if (cwnd_ < ssthresh_)
+		cwnd_ += acks*mss_;
+	else
+		cwnd_ += (uint32_t)std::max((uint64_t)1, (uint64_t)acks*mss_*mss_/cwnd_);
+}
+
+void urdp_congestion_controller::on_fast_retransmit(uint32_t inFlight)
+{
+	ssthresh_ = std::max((inFlight*3)/4, 3*mss_);//ssthresh_ = std::max(inFlight / 2, 2 * mss_);
+}
+
+void urdp_congestion_controller::on_dup_ack()
+{
+	//(Fast Recover)
+	cwnd_ += mss_;
+}
+
+void urdp_congestion_controller::on_partial_ack(uint32_t ackedBytes)
+{
+	cwnd_ += mss_ - std::min(ackedBytes, cwnd_);
+}
+
+void urdp_congestion_controller::on_recovery_exit(uint32_t inFlight)
+{
+	cwnd_=std::min(ssthresh_, inFlight + mss_);
+}
+
+void urdp_congestion_controller::on_timeout(uint32_t inFlight)
+{
+	ssthresh_ = std::max(inFlight*3/4, 2*mss_);
+	cwnd_=std::max(ssthresh_/2, 2*mss_);//cwnd_=2*mss_;
+}
+
+void urdp_congestion_controller::on_idle()
+{
+	cwnd_ =std::max(2*mss_, cwnd_/2);
+}
+
+//
+// LEDBAT
+//
+ledbat_congestion_controller::ledbat_congestion_controller(uint32_t mss,
+	uint32_t cwnd, uint32_t ssthresh)
+	: urdp_congestion_controller(mss, cwnd, ssthresh)
+	, base_minute_(0)
+	, base_index_(0)
+	, current_index_(0)
+	, sample_cnt_(0)
+{
+	for (int i=0;i<BASE_HISTORY;++i)
+		base_history_[i]=-1;
+	for (int i=0;i<CURRENT_FILTER;++i)
+		current_history_[i]=-1;
+}
+
+void ledbat_congestion_controller::on_rtt_sample(long rtt, time32_type now)
+{
+	if (rtt<0)
+		return;
+
+	//the base delay is the min of the last BASE_HISTORY minutes, so that a
+	//route change is noticed in minutes
+	time32_type minute=now/(60*1000);
+	if (sample_cnt_==0)
+	{
+		base_minute_=minute;
+		base_history_[base_index_]=rtt;
+	}
+	else if (minute!=base_minute_)
+	{
+		base_minute_=minute;
+		base_index_=(base_index_+1)%BASE_HISTORY;
+		base_history_[base_index_]=rtt;
+	}
+	else if (rtt<base_history_[base_index_])
+	{
+		base_history_[base_index_]=rtt;
+	}
+
+	current_index_=(current_index_+1)%CURRENT_FILTER;
+	current_history_[current_index_]=rtt;
+	++sample_cnt_;
+}
+
+long ledbat_congestion_controller::base_delay()const
+{
+	long d=-1;
+	for (int i=0;i<BASE_HISTORY;++i)
+	{
+		if (base_history_[i]>=0&&(d<0||base_history_[i]<d))
+			d=base_history_[i];
+	}
+	return d;
+}
+
+long ledbat_congestion_controller::current_delay()const
+{
+	long d=-1;
+	for (int i=0;i<CURRENT_FILTER;++i)
+	{
+		if (current_history_[i]>=0&&(d<0||current_history_[i]<d))
+			d=current_history_[i];
+	}
+	return d;
+}
+
+long ledbat_congestion_controller::queuing_delay()const
+{
+	if (sample_cnt_==0)
+		return -1;
+	return current_delay()-base_delay();
+}
+
+void ledbat_congestion_controller::on_ack(uint32_t ackedBytes, uint32_t inFlight,
+	uint32_t ackSegs)
+{
+	ackedBytes=std::min(ackedBytes, std::max<uint32_t>(ackSegs, 2)*mss_);
+	long queuingDelay=queuing_delay();
+	if (queuingDelay<0)
+	{
+		//no delay sample yet, grow as congestion avoidance
+		cwnd_ += (uint32_t)std::max((uint64_t)1, (uint64_t)mss_*(uint64_t)mss_/cwnd_);
+		return;
+	}
+
+	double offTarget=double(TARGET_DELAY-queuingDelay)/TARGET_DELAY;
+	double delta=offTarget*ackedBytes*mss_/cwnd_;//GAIN=1
+	double cwnd=(double)cwnd_+delta;
+
+	//do not grow faster than the data in flight allows(ALLOWED_INCREASE=1)
+	double maxAllowed=(double)inFlight+ackedBytes+mss_;
+	if (cwnd>maxAllowed)
+		cwnd=std::max((double)cwnd_, maxAllowed);
+	if (cwnd<2.0*mss_)
+		cwnd=2.0*mss_;
+	cwnd_=(uint32_t)cwnd;
+}
+
+void ledbat_congestion_controller::on_fast_retransmit(uint32_t inFlight)
+{
+	UNUSED_PARAMETER(inFlight);
+	cwnd_=std::max(cwnd_/2, 2*mss_);
+	ssthresh_=cwnd_;
+}
+
+void ledbat_congestion_controller::on_timeout(uint32_t inFlight)
+{
+	UNUSED_PARAMETER(inFlight);
+	ssthresh_=std::max(cwnd_/2, 2*mss_);
+	cwnd_=2*mss_;
+}
+
+NAMESPACE_END(urdp);
+NAMESPACE_END(p2engine);
@@ -0,0 +1,189 @@
+#include "p2engine/push_warning_option.hpp"
+#include <cstring>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/io.hpp"
+#include "p2engine/rdp/urdp_fec.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(urdp);
+
+namespace
+{
+	void xor_in(std::vector<char>& acc, std::size_t offset, const char* p,
+		std::size_t len)
+	{
+		if (acc.size()<offset+len)
+			acc.resize(offset+len, 0);
+		char* q=&acc[offset];
+		for (std::size_t i=0;i<len;++i)
+			q[i]^=p[i];
+	}
+
+	void xor_in_length(std::vector<char>& acc, std::size_t len)
+	{
+		char l[2]={(char)((len>>8)&0xff), (char)(len&0xff)};
+		xor_in(acc, 0, l, 2);
+	}
+
+	const std::size_t MAX_GROUPS=1024;
+}
+
+//
+// encoder
+//
+uint8_t urdp_fec_encoder::group_size(double lostRate)
+{
+	//one parity recovers one packet of a group, so the group must be small
+	//enough that two are seldom lost together
+	if (lostRate<0)//not known
+		return 8;
+	if (lostRate>0.2)
+		return 2;
+	if (lostRate>0.1)
+		return 4;
+	if (lostRate>0.05)
+		return 6;
+	if (lostRate>0.01)
+		return 10;
+	return 16;
+}
+
+urdp_fec_encoder::urdp_fec_encoder()
+	:group_(0),count_(0),size_(0)
+{
+}
+
+void urdp_fec_encoder::open(uint8_t groupSize)
+{
+	BOOST_ASSERT(empty());
+	BOOST_ASSERT(groupSize>0&&groupSize<=MAX_GROUP_SIZE);
+	size_=groupSize;
+}
+
+void urdp_fec_encoder::add(uint16_t pktID, uint16_t msgType, const safe_buffer& payload)
+{
+	BOOST_ASSERT(!full());
+	char head[4];
+	char* p=head;
+	write_uint16_hton(pktID, p);
+	write_uint16_hton(msgType, p);
+	xor_in_length(parity_, 4+payload.size());
+	xor_in(parity_, 2, head, 4);
+	xor_in(parity_, 6, buffer_cast<const char*>(payload), payload.size());
+	++count_;
+}
+
+void urdp_fec_encoder::close()
+{
+	++group_;
+	count_=0;
+	size_=0;
+	parity_.clear();
+}
+
+//
+// decoder
+//
+urdp_fec_decoder::group_state* urdp_fec_decoder::__group(uint16_t group,
+														 time32_type now)
+{
+	group_map::iterator itr=groups_.find(group);
+	if (itr!=groups_.end())
+		return &itr->second;
+
+	for (itr=groups_.begin();itr!=groups_.end();)
+	{
+		if ((time32_type)(itr->second.expire-now)<0)
+			groups_.erase(itr++);
+		else
+			++itr;
+	}
+	if (groups_.size()>=MAX_GROUPS)
+		return NULL;
+
+	group_state& g=groups_[group];
+	g.expire=now+GROUP_LIFETIME;
+	g.count=0;
+	g.received=0;
+	g.done=false;
+	return &g;
+}
+
+bool urdp_fec_decoder::on_data(uint16_t group, uint8_t index, const safe_buffer& body,
+							   time32_type now, safe_buffer& recovered, bool& duplicated)
+{
+	duplicated=false;
+	if (index>=urdp_fec_encoder::MAX_GROUP_SIZE)
+		return false;
+	group_state* g=__group(group, now);
+	if (!g)
+		return false;
+	if (g->done)
+	{
+		//every packet of the group has been received or recovered
+		duplicated=true;
+		return false;
+	}
+	if (g->bodies.size()<=index)
+		g->bodies.resize(index+1);
+	if (g->bodies[index].size()!=0)
+	{
+		duplicated=true;
+		return false;
+	}
+	g->bodies[index]=body;
+	++g->received;
+	return __try_recover(*g, recovered);
+}
+
+bool urdp_fec_decoder::on_parity(uint16_t group, uint8_t count, const safe_buffer& parity,
+								 time32_type now, safe_buffer& recovered)
+{
+	if (count==0||count>urdp_fec_encoder::MAX_GROUP_SIZE||parity.size()<2)
+		return false;
+	group_state* g=__group(group, now);
+	if (!g||g->done||g->count)
+		return false;
+	g->count=count;
+	g->parity=parity;
+	return __try_recover(*g, recovered);
+}
+
+bool urdp_fec_decoder::__try_recover(group_state& g, safe_buffer& recovered)
+{
+	if (!g.count||g.received+1<g.count)
+		return false;
+
+	bool ok=false;
+	if (g.received+1==g.count)
+	{
+		//XOR the received out of the parity, the missing one is left
+		const char* p=buffer_cast<const char*>(g.parity);
+		std::vector<char> acc(p, p+g.parity.size());
+		for (std::size_t i=0;i<g.bodies.size()&&i<g.count;++i)
+		{
+			const safe_buffer& body=g.bodies[i];
+			if (body.size()==0)
+				continue;
+			xor_in_length(acc, body.size());
+			xor_in(acc, 2, buffer_cast<const char*>(body), body.size());
+		}
+		std::size_t len=((std::size_t)(unsigned char)acc[0]<<8)|(unsigned char)acc[1];
+		if (len>=4&&len+2<=acc.size())
+		{
+			recovered=safe_buffer(len);
+			memcpy(buffer_cast<char*>(recovered), &acc[2], len);
+			ok=true;
+		}
+	}
+
+	//all received, or just recovered; the late ones are of no use any more
+	g.done=true;
+	g.parity=safe_buffer();
+	std::vector<safe_buffer>().swap(g.bodies);
+	return ok;
+}
+
+NAMESPACE_END(urdp);
+NAMESPACE_END(p2engine);
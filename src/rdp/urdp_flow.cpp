@@ -1,5 +1,7 @@
 #include "p2engine/safe_buffer_io.hpp"
 #include "p2engine/atomic.hpp"
+#include "p2engine/singleton.hpp"
+#include "p2engine/mutex.hpp"
 #include "p2engine/rdp/urdp_visitor.hpp"
 #include "p2engine/rdp/urdp_flow.hpp"
 #include "p2engine/rdp/const_define.hpp"
@@ -15,6 +17,12 @@ namespace
 	const time32_type DEF_RTO  =  3*1000; // 3 seconds (RFC1122, Sec 4.2.3.1)
 	const time32_type MAX_RTO  =  8*1000;// (RFC is 60 seconds)
 	const time32_type ACK_DELAY =  100; // 100 milliseconds
+	const uint32_t DEFAULT_ACK_EVERY = 2; // segments per ACK
+
+	//the ACK frequency field, see CAP_ACK_FREQUENCY
+	const int ACK_FREQUENCY_DELAY_BITS=10;
+	const uint32_t MAX_ACK_FREQUENCY_SEGS=(1<<(16-ACK_FREQUENCY_DELAY_BITS))-1;
+	const time32_type MAX_ACK_FREQUENCY_DELAY=(1<<ACK_FREQUENCY_DELAY_BITS)-1;
 
 	const time32_type DEFAULT_TIMEOUT = 10*1000; 
 	const time32_type CLOSED_TIMEOUT = 60 * 1000; // If the connection is closed, once per minute
@@ -25,6 +33,106 @@ namespace
 
 	const time32_type MIN_CLOCK_CHECK_TIME=30;
 
+	//capabilities this side supports, see urdp_capability
+	const uint16_t LOCAL_CAPS=CAP_SACK|CAP_PMTU_PROBE|CAP_FEC|CAP_ACK_FREQUENCY
+		|CAP_BUNDLE|CAP_FAST_OPEN|CAP_MIGRATION|CAP_WINDOW_SCALE;
+
+	//a hole is taken as lost when so many segments above it have been SACKed
+	//(RFC6675 DupThresh), and at most so many holes are resent per SACK.
+	const int SACK_DUP_THRESH=3;
+	const int MAX_SACK_REXMIT_PER_ACK=2;
+
+	//a paced flow may send a burst of so many ms of its rate(but no less 
+	//than PACING_MIN_BURST segments), which covers the timer granularity
+	const time32_type PACING_QUANTUM=4;
+	const uint32_t PACING_MIN_BURST=2;
+
+	//path MTU discovery. A size is taken as too large after PMTU_MAX_PROBES
+	//probes are lost, the search stops when the range is narrower than 
+	//PMTU_SEARCH_STEP and is tried again after PMTU_RAISE_TIMER(RFC8899).
+	//So many successive RTOs are taken as a black hole.
+	const int PMTU_MAX_PROBES=3;
+	const uint32_t PMTU_SEARCH_STEP=32;
+	const time32_type PMTU_RAISE_TIMER=600*1000;
+	const int PMTU_BLACK_HOLE_RTOS=2;
+	//a full sized IPv4 ethernet frame, the most likely path MTU, is tried first
+	const uint32_t PMTU_ETHERNET_MSS=1500-20-8-8-24;//IP, UDP, scramble, urdp header
+
+	//the parity of a FEC group is sent when it is full or when its first 
+	//packet has waited so long(ms), which bounds the delay of recovery
+	const time32_type FEC_FLUSH_DELAY=20;
+
+	//the window field is in units of 1<<WINDOW_SCALE_SHIFT bytes when 
+	//CAP_WINDOW_SCALE is negotiated, which bounds the receive buffer
+	const int WINDOW_SCALE_SHIFT=6;
+	const uint32_t MAX_RECV_BUF_SIZE=0xffffu<<WINDOW_SCALE_SHIFT;
+	const uint32_t MAX_SND_BUF_SIZE=MAX_RECV_BUF_SIZE*3/2;
+	const std::size_t DEFAULT_BUFFER_MEMORY_LIMIT=64*1024*1024;
+
+	//the handshake is sent before the capabilities are known
+	inline bool unscaled_window(int control)
+	{
+		return control==CTRL_CONNECT||control==CTRL_CONNECT_ACK
+			||control==CTRL_CONNECT_DATA||control==CTRL_PUNCH;
+	}
+
+	//what the buffers of all flows have grown beyond their defaults
+	class buffer_memory
+	{
+	public:
+		buffer_memory():limit_(DEFAULT_BUFFER_MEMORY_LIMIT),used_(0){}
+
+		//returns what is granted, which may be less than bytes
+		std::size_t reserve(std::size_t bytes)
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			bytes=std::min(bytes, (limit_>used_?limit_-used_:0));
+			used_+=bytes;
+			return bytes;
+		}
+		void release(std::size_t bytes)
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			BOOST_ASSERT(used_>=bytes);
+			used_-=bytes;
+		}
+		void limit(std::size_t bytes)
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			limit_=bytes;
+		}
+		std::size_t limit()const
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			return limit_;
+		}
+		std::size_t used()const
+		{
+			fast_mutex::scoped_lock lock(mutex_);
+			return used_;
+		}
+
+	private:
+		mutable fast_mutex mutex_;
+		std::size_t limit_;
+		std::size_t used_;
+	};
+	buffer_memory s_buffer_memory;
+
+	//a new endpoint of the remote is given up if it does not answer so many
+	//challenges, each waits an rto
+	const int PATH_CHALLENGE_MAX=3;
+	//no new challenge is started sooner than this after the last one ended,
+	//or PATH_REFUSED_INTERVAL after the old endpoint proved to be alive
+	const time32_type PATH_CHALLENGE_INTERVAL=1000;
+	const time32_type PATH_REFUSED_INTERVAL=30*1000;
+
+	//the sub-header of a message in a CTRL_BUNDLE is [length|pktID|msgType],
+	//the highest bit of length is set if the message is semireliable
+	const std::size_t BUNDLE_HEADER_SIZE=6;
+	const uint16_t BUNDLE_SEMIRELIABLE=0x8000;
+	const uint16_t BUNDLE_LENGTH_MASK=0x7fff;
+
 	template<typename Type>
 	inline Type bound(Type lower, Type middle, Type upper) 
 	{	
@@ -53,6 +161,8 @@ DEBUG_SCOPE(
 std::set<urdp_flow*> s_urdp_flow_map;
 #endif
 
+bool urdp_flow::s_default_pacing_=false;
+
 
 boost::shared_ptr<urdp_flow> urdp_flow::create_for_active_connect(connection_sptr sock, 
 																  io_service& ios, 
@@ -85,13 +195,14 @@ boost::shared_ptr<urdp_flow> urdp_flow::create_for_passive_connect(io_service& i
 	obj->m_token=shared_layer_type::create_flow_token(sharedLayer, obj.get(), 
 		boost::move(boost::bind(&this_type::called_by_sharedlayer_on_recvd, obj.get(), _1, _2)), 
 		ec);
-	obj->m_timer->async_wait(milliseconds(IDLE_TIMEOUT));//if nothing happened in IDLE_TIMEOUT, close
+	obj->m_timer.async_wait(IDLE_TIMEOUT);//if nothing happened in IDLE_TIMEOUT, close
 	return obj;
 }
 
 urdp_flow::urdp_flow(io_service& ios)
 	: basic_engine_object(ios)
 	, m_state(INIT)
+	, m_timer(ios)
 	, remote_to_local_lost_rate_(-1)
 	, local_to_remote_lost_rate_(-1)
 	, in_speed_meter_(milliseconds(2000))
@@ -136,17 +247,8 @@ void urdp_flow::__init()
 
 	this->next_op_stamp();
 
-	if (m_timer)
-	{
-		m_timer->cancel();
-		m_timer->time_signal().clear();
-	}
-	else
-	{
-		m_timer=timer_type::create(get_io_service());
-		m_timer->set_obj_desc("urdp_flow::m_timer");
-	}
-	m_timer->time_signal().bind(&this_type::__on_clock, this VC9_BIND_BUG_PARAM_DUMMY);
+	m_timer.cancel();
+	m_timer.set_handler(boost::bind(&this_type::__on_clock, this VC9_BIND_BUG_PARAM_DUMMY));
 	m_t_close_base=now+IDLE_TIMEOUT;//we will close this if not connected in 20 seconds.
 	m_t_last_on_clock=now;
 
@@ -159,28 +261,59 @@ void urdp_flow::__init()
 	m_state = INIT;
 	m_snd_wnd=RECV_BUF_SIZE/2;
 	m_rcv_wnd = RECV_BUF_SIZE;
+	m_rcv_buf = RECV_BUF_SIZE;
+	m_snd_buf = SND_BUF_SIZE;
+	m_buf_reserved = 0;
+	m_rcv_space = 0;
+	m_t_rcv_space = now;
 	m_snd_una=m_snd_nxt=random<uint32_t>(0xff, 0x7fffffff);
 	m_slen = 0;
+	m_sent_bytes = m_retransmitted_bytes = 0;
 	//m_rcv_nxt=0;//it will be inited when shakehand
 	m_rlen = 0;
 	m_detect_readable = true;
 	m_detect_writable = false;
 	m_t_ack = 0;
+	m_ack_every = DEFAULT_ACK_EVERY;
+	m_ack_delay = ACK_DELAY;
+	m_delayed_segs = 0;
+	m_ack_freq_segs = 0;
+	m_ack_freq_rtt = 0.0;
 
 	//m_msslevel = 0;
 	//m_largest = 0;
 	//m_mtu_advise = MAX_PACKET;
 	m_mss =MTU_SIZE;//DEFAULT_MSS;
+	m_pmtu_state=PMTU_DISABLED;//started when connected
+	m_pmtu_lo=m_pmtu_hi=m_mss;
+	m_pmtu_probe_size=0;
+	m_pmtu_probe_cnt=0;
+	m_pmtu_rto_cnt=0;
+	m_t_pmtu=0;
+	m_t_fec_flush=0;
+	m_path_nonce=0;
+	m_path_old_nonce=0;
+	m_path_challenge_cnt=0;
+	m_t_path_challenge=0;
+	m_t_path_allowed=0;
+	b_path_validated_=false;
+	m_bundle.reset();
+	m_bundle_len=0;
+	m_bundle_delay=0;
+	m_t_bundle_flush=0;
 
 	m_t_rto_base = 0;
 
-	m_cwnd = 2 * m_mss;
-	m_ssthresh = RECV_BUF_SIZE;
+	m_cc.reset(urdp_congestion_controller::create(CC_RENO, m_mss, 2*m_mss, 
+		RECV_BUF_SIZE));
 	m_t_lastrecv = m_t_lastsend = m_t_lasttraffic = now;
 
 	m_dup_acks = 0;
 	m_recover = 0;
 
+	m_caps = 0;//negotiated when shakehand
+	m_sack_rexmit_nxt = m_snd_una;
+
 	m_t_recent =0;
 	m_lastack =m_rcv_nxt;
 
@@ -196,6 +329,18 @@ void urdp_flow::__init()
 	b_close_called_=false;
 	b_timer_posted_=false;
 	b_ignore_all_pkt_=false;
+	b_cc_assigned_=false;
+
+	b_pacing_=s_default_pacing_;
+	b_pacing_scheduled_=false;
+	m_pacing_credit=0;
+
+	b_bundling_=true;
+	b_bundle_posted_=false;
+	b_zero_copy_send_=false;
+	b_fast_reconnect_=false;
+	b_fast_open_=false;
+	m_t_pacing=now;
 }
 
 void urdp_flow::called_by_sharedlayer_on_recvd(const safe_buffer& buf, 
@@ -209,7 +354,7 @@ void urdp_flow::called_by_sharedlayer_on_recvd(const safe_buffer& buf,
 			b_ignore_all_pkt_=true;//we will not send to remote RST again
 		}
 	}
-	BOOST_ASSERT(m_shutdown==SD_NONE||!m_socket||m_t_close_base&&!m_timer->is_idle());
+	BOOST_ASSERT(m_shutdown==SD_NONE||!m_socket||m_t_close_base&&!m_timer.is_idle());
 }
 
 uint32_t urdp_flow::flow_id()const
@@ -247,11 +392,37 @@ void urdp_flow::async_connect(const endpoint_type& remoteEnp,
 		t=time_out;
 	}
 	BOOST_ASSERT(t>milliseconds(500));
-	m_timer->async_wait(t);
+	m_timer.async_wait((long)t.total_milliseconds());
 	m_t_close_base=now+t.total_milliseconds();
 	m_remote_endpoint=remoteEnp;
+	m_domain=domainName;
 	b_active_=true;
 	m_state = SYN_SENT;
+	if (!b_cc_assigned_)
+		__set_congestion_control(
+		urdp_congestion_controller::domain_congestion_control(domainName));
+
+	urdp_session_ticket ticket;
+	if (b_fast_reconnect_&&domainName.length()+2<=m_mss/2
+		&&session_cache().get(remoteEnp, domainName, ticket)
+		&&(ticket.caps&CAP_FAST_OPEN))
+	{
+		b_fast_open_=true;
+		__apply_ticket(ticket);
+
+		//the connect request is sent after on_connected, with what is sent 
+		//in it(see fast_reconnect)
+		safe_buffer request(2+domainName.length());
+		char* p=buffer_cast<char*>(request);
+		write_uint16_hton((uint16_t)domainName.length(), p);
+		memcpy(p, domainName.c_str(), domainName.length());
+		__queue(buffer_cast<char*>(request), request.size(), CTRL_CONNECT_DATA, m_mss);
+		get_io_service().post(boost::bind(&this_type::__on_fast_connect, 
+			SHARED_OBJ_FROM_THIS, this->op_stamp())
+			);
+		__schedule_timer(now);
+		return;
+	}
 
 	//send connect request 
 	__queue(domainName.c_str(), domainName.length(), CTRL_CONNECT);
@@ -259,6 +430,87 @@ void urdp_flow::async_connect(const endpoint_type& remoteEnp,
 	__schedule_timer(now);
 }
 
+urdp_session_cache& urdp_flow::session_cache()
+{
+	return singleton<urdp_session_cache>::instance();
+}
+
+void urdp_flow::__apply_ticket(const urdp_session_ticket& ticket)
+{
+	//a new session id, or the remote may take the request for a resent one
+	//of the last flow
+	if (m_session_id==ticket.session_id)
+		++m_session_id;
+	if (ticket.mss>=MIN_MTU_SIZE&&ticket.mss<=MAX_MTU_SIZE)
+		__adjust_mtu(ticket.mss);
+	if (ticket.srtt)
+	{
+		m_srtt=ticket.srtt;
+		m_rttvar=ticket.rttvar;
+		m_rto=bound(MIN_RTO, m_srtt + std::max((time32_type)1, m_rttvar<<2), MAX_RTO);
+	}
+	if (ticket.window)
+		m_snd_wnd=ticket.window;
+	//slow start ends where the last flow got to(RFC2140)
+	if (ticket.cwnd)
+	{
+		m_cc.reset(urdp_congestion_controller::create(m_cc->type(), m_mss, 
+			m_cc->cwnd(), std::max(ticket.cwnd, 2*m_mss)));
+	}
+}
+
+void urdp_flow::__save_ticket()
+{
+	if (!b_active_||!(m_caps&CAP_FAST_OPEN))
+		return;
+	urdp_session_ticket ticket;
+	ticket.session_id=m_session_id;
+	ticket.caps=m_caps;
+	ticket.mss=m_mss;
+	ticket.window=m_snd_wnd;
+	ticket.cwnd=m_cc->cwnd();
+	ticket.srtt=m_srtt;
+	ticket.rttvar=m_rttvar;
+	session_cache().put(m_remote_endpoint, m_domain, ticket);
+}
+
+void urdp_flow::__on_fast_connect(op_stamp_t mark)
+{
+	if (is_canceled_op(mark)||m_state==CLOSED)
+		return;
+	if (!m_socket)
+	{
+		__close(true);
+		return;
+	}
+
+	//the connect timeout is kept until the remote answers
+	m_establish_time=tick_now();
+	keep_async_receiving();
+	m_socket->on_connected(error_code());
+
+	if (m_state!=CLOSED)
+	{
+		__attempt_send();
+		__schedule_timer(tick_now());
+	}
+}
+
+void urdp_flow::congestion_control(congestion_control_type type)
+{
+	b_cc_assigned_=true;
+	__set_congestion_control(type);
+}
+
+void urdp_flow::__set_congestion_control(congestion_control_type type)
+{
+	if (m_cc->type()==type)
+		return;
+	//the new controller takes over the window the old one has reached
+	m_cc.reset(urdp_congestion_controller::create(type, m_mss, 
+		m_cc->cwnd(), m_cc->ssthresh()));
+}
+
 void urdp_flow::async_connect(const std::string& remote_host, int port, 
 							  const std::string&domainName, const time_duration& time_out
 							  )
@@ -356,7 +608,7 @@ void urdp_flow::async_send(const safe_buffer& buf, message_type msgType,
 			boost::bind(&this_type::__allert_writeable, this)
 			);
 	}
-	if (!(!reliable))//reliable or semireliable
+	if (!(!reliable)||m_t_bundle_flush)//reliable, semireliable or bundled
 		__schedule_timer(tick_now());
 }
 
@@ -374,7 +626,7 @@ safe_buffer urdp_flow::make_punch_packet(error_code& ec, const endpoint& externa
 		writer.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
 		writer.set_id_for_lost_detect(id_for_lost_rate_++);
 		writer.set_session_id(m_session_id);
-		writer.set_window((uint16_t)std::min(m_rcv_wnd, (uint32_t)0xffff));//any value
+		writer.set_window(__window_field(CTRL_PUNCH));//any value
 		writer.set_time_sending((uint16_t)scape_zero(now));//any value
 		writer.set_time_echo(m_t_recent+((uint16_t)(now)-m_t_recent_now));//any value
 		writer.set_seqno(m_snd_nxt);//any value
@@ -462,7 +714,9 @@ void urdp_flow::__on_clock(VC9_BIND_BUG_PARAM)
 		} 
 		else 
 		{
-			//send the oldest unacked packet
+			//send the oldest unacked packet, and the holes SACKed before may be
+			//lost again
+			m_sack_rexmit_nxt=m_snd_una;
 			if (!__transmit(m_retrans_slist.begin(), now)) 
 			{
 				//std::cout<<int((void*)this)<<"~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~retrans timed_out\n";
@@ -472,8 +726,14 @@ void urdp_flow::__on_clock(VC9_BIND_BUG_PARAM)
 			haveSentReliableMsg=true;
 			long nInFlight =mod_minus(m_snd_nxt, m_snd_una);
 			BOOST_ASSERT(nInFlight>0);
-			m_ssthresh = std::max((uint32_t)nInFlight*3/4, 2*m_mss);
-			m_cwnd=std::max(m_ssthresh/2, 2*m_mss);//m_cwnd=2*m_mss;
+			m_cc->on_timeout((uint32_t)nInFlight);
+			if (m_pmtu_rto_cnt<0xff)
+				++m_pmtu_rto_cnt;
+			if (m_pmtu_rto_cnt>=PMTU_BLACK_HOLE_RTOS&&m_pmtu_state!=PMTU_DISABLED
+				&&m_mss>MIN_MTU_SIZE)
+			{
+				__on_pmtu_black_hole(now);
+			}
 			m_t_rto_base=scape_zero(now);//m_rto_base=0 means not set, so we use 1
 			__incress_rto();
 		}
@@ -482,22 +742,19 @@ void urdp_flow::__on_clock(VC9_BIND_BUG_PARAM)
 	//is it time to send next unreliable packet?
 	while(!m_unreliable_slist.empty())
 	{
-		SUnraliableSegmentList::iterator itr=m_unreliable_slist.begin();
-		SUnraliableSegment& seg = const_cast<SUnraliableSegment&>(*itr);
-		if (mod_less_equal(seg.timeout, now))
-		{
-			__packet_as_unreliable_and_sendout(seg, now);
-			if(seg.remainXmit<=0)
-				m_unreliable_slist.erase(itr);
-			else
-			{
-				SUnraliableSegment segcpy=seg;
-				m_unreliable_slist.erase(itr);
-				m_unreliable_slist.insert(segcpy);
-			}
-		}
-		else
+		if (!mod_less_equal(m_unreliable_slist.front().timeout, now))
 			break;
+
+		//the top goes to the back before sending changes its timeout(the key
+		//of the heap), then it is pushed again with the new timeout or dropped
+		std::pop_heap(m_unreliable_slist.begin(), m_unreliable_slist.end(), 
+			SUnraliableSegmentLater());
+		__send_unreliable(m_unreliable_slist.back(), now);
+		if(m_unreliable_slist.back().remainXmit<=0)
+			m_unreliable_slist.pop_back();
+		else
+			std::push_heap(m_unreliable_slist.begin(), m_unreliable_slist.end(), 
+				SUnraliableSegmentLater());
 	}
 
 	// Check for ping timeout 
@@ -538,8 +795,65 @@ void urdp_flow::__on_clock(VC9_BIND_BUG_PARAM)
 		__incress_rto();
 	}
 
+	// Check if the challenge of a new endpoint of the remote is lost, or
+	// the new endpoint has answered and the old one has not in an rto
+	if (m_t_path_challenge&&mod_less_equal(m_t_path_challenge, now))
+	{
+		m_t_path_challenge=0;
+		if (m_state == ESTABLISHED&&b_path_validated_)
+			__migrate(now);
+		else if (m_state == ESTABLISHED&&m_path_challenge_cnt<PATH_CHALLENGE_MAX)
+			__send_path_challenge(now);
+		else
+			__end_path_challenge(now, PATH_CHALLENGE_INTERVAL);
+	}
+
+	// Check if the bundle has waited long enough
+	if (m_t_bundle_flush&&mod_less_equal(m_t_bundle_flush, now))
+	{
+		if (m_state == ESTABLISHED)
+			__packet_bundle_and_sendout(now);
+		else
+			m_t_bundle_flush=0;
+	}
+
+	// Check if the parity of the FEC group has waited long enough
+	if (m_t_fec_flush&&mod_less_equal(m_t_fec_flush, now))
+	{
+		if (m_state == ESTABLISHED)
+			__packet_fec_parity_and_sendout(now);
+		else
+			m_t_fec_flush=0;
+	}
+
+	// Check if the path MTU probe is lost, or it's time to search again
+	if (m_state == ESTABLISHED&&m_t_pmtu&&mod_less_equal(m_t_pmtu, now))
+	{
+		m_t_pmtu=0;
+		if (m_pmtu_probe_size)
+		{
+			__on_pmtu_probe_timeout(now);
+		}
+		else if (m_pmtu_state==PMTU_ERROR)
+		{
+			m_pmtu_state=PMTU_BASE;
+			m_pmtu_probe_size=MIN_MTU_SIZE;
+			m_pmtu_probe_cnt=0;
+			__send_pmtu_probe(now);
+		}
+		else if (m_pmtu_lo<MAX_MTU_SIZE)
+		{
+			//one step up first, it goes on searching only if the path changed
+			m_pmtu_state=PMTU_SEARCHING;
+			m_pmtu_hi=MAX_MTU_SIZE;
+			m_pmtu_probe_size=std::min<uint32_t>(m_pmtu_lo+PMTU_SEARCH_STEP, MAX_MTU_SIZE);
+			m_pmtu_probe_cnt=0;
+			__send_pmtu_probe(now);
+		}
+	}
+
 	// Check if it's time to _send delayed acks
-	if (!haveSentReliableMsg&&m_t_ack&&mod_less_equal(m_t_ack+ACK_DELAY, now)) 
+	if (!haveSentReliableMsg&&m_t_ack&&mod_less_equal(m_t_ack+m_ack_delay, now)) 
 	{
 		__packet_as_reliable_and_sendout(m_snd_nxt, CTRL_ACK, NULL, now);
 		haveSentReliableMsg=true;
@@ -688,19 +1002,23 @@ void urdp_flow::__to_closed_state()
 	}
 
 	BOOST_ASSERT(m_self_holder);
+	if (b_fast_open_&&m_state==SYN_SENT)
+		session_cache().erase(m_remote_endpoint, m_domain);//never answered
+	else if (m_state>=ESTABLISHED)
+		__save_ticket();//with what has been learned since
 	m_state=CLOSED;
 	m_token.reset();
-	if (m_timer)
-	{
-		m_timer->cancel();
-		m_timer.reset();
-	}
+	m_timer.cancel();
 	m_socket=NULL;
 	m_acceptor.reset();
 	m_slist.clear();
 	m_retrans_slist.clear();
-	m_rlist.clear();
+	m_rring.clear();
+	__release_buffers();
 	m_t_rto_base=0;
+	m_bundle.reset();
+	m_bundle_len=0;
+	m_t_bundle_flush=0;
 
 	//To close state we must reset self_holder_, otherwise, we cant delete this_ptr
 	//because of the "cycles of shared_ptr". 
@@ -730,8 +1048,8 @@ void urdp_flow::__schedule_timer(time32_type now, bool calledInOnClock)
 	BOOST_ASSERT(m_self_holder);
 
 	//if expire soon, do not reschedule
-	bool isIdle=m_timer->is_idle();
-	int64_t expireTimeFromNow=m_timer->expires_from_now().total_milliseconds();
+	bool isIdle=m_timer.is_idle();
+	long expireTimeFromNow=m_timer.expires_from_now();
 	if (!isIdle&&expireTimeFromNow>0&&expireTimeFromNow<MIN_CLOCK_CHECK_TIME)
 		return;
 
@@ -755,11 +1073,11 @@ void urdp_flow::__schedule_timer(time32_type now, bool calledInOnClock)
 		else
 		{
 			if(isIdle||t<expireTimeFromNow)
-				m_timer->async_wait(milliseconds(t));
-			BOOST_ASSERT(!m_timer->is_idle());
+				m_timer.async_wait(t);
+			BOOST_ASSERT(!m_timer.is_idle());
 		}
 	}
-	BOOST_ASSERT((!m_timer->is_idle()||b_timer_posted_)||!m_t_close_base);
+	BOOST_ASSERT((!m_timer.is_idle()||b_timer_posted_)||!m_t_close_base);
 }
 
 int urdp_flow::__can_let_transport_read() 
@@ -777,20 +1095,8 @@ int urdp_flow::__can_let_transport_read()
 	//check reliable packet
 	if (m_rlen < 4) //lent(2byte), msgType(2byte)
 		return 0;
-	RSegmentList::iterator itr(m_rlist.begin());
-
-	BOOST_ASSERT(itr->buf.size()>=1);
 	char bufForLen[2];
-	bufForLen[0]=buffer_cast<const char*>(itr->buf)[0];
-	if (itr->buf.size()>=2)
-	{
-		bufForLen[1]=buffer_cast<const char*>(itr->buf)[1];
-	}
-	else
-	{
-		++itr;
-		bufForLen[1]=buffer_cast<const char*>(itr->buf)[0];//0, not 1 !!!!
-	}
+	m_rring.peek(bufForLen, 2);
 	const char* pbufForLen=bufForLen;
 	uint16_t packetLen=read_uint16_ntoh(pbufForLen);
 	uint32_t maxReadLen = packetLen+4;//the length not include lent(2byte)and msgType(2byte), so, +4
@@ -828,36 +1134,18 @@ int urdp_flow::__recv(safe_buffer& buf, error_code& ec)
 	}
 
 	//read reliable packet
+	buf=safe_buffer(maxReadLen);
+	m_rring.read(buffer_cast<char*>(buf), maxReadLen);
+	m_rlen -=maxReadLen;
+	m_rcv_space += maxReadLen;
 	safe_buffer_io io(&buf);
-	io.prepare(maxReadLen);
-	int readLen=0;
-	while (maxReadLen-readLen>0)
-	{
-		RSegmentList::iterator itr=m_rlist.begin();
-		RSegment& segment=const_cast<RSegment&>(*itr);
-		int lenth=(std::min<int>)(maxReadLen-readLen, segment.buf.size());
-		io.write(buffer_cast<char*>(segment.buf), lenth);
-		segment.buf=segment.buf.buffer_ref(lenth);//consume(lenth);
-		m_rlen -=lenth;
-		readLen+=lenth;
-
-		if (segment.buf.size()==0)
-		{
-			m_rlist.erase(m_rlist.begin());
-		}
-		else
-		{
-			segment.seq+=lenth;//the seq+lenth MUST be greater than (++itr)->seq.
-			break;
-		}
-	}
-	BOOST_ASSERT(maxReadLen==readLen);
+	__tune_recv_buffer(tick_now());
 
-	if ((RECV_BUF_SIZE - m_rlen - m_rcv_wnd) >=(std::min<uint32_t>)(RECV_BUF_SIZE / 2, m_mss)) 
+	if ((m_rcv_buf - m_rlen - m_rcv_wnd) >=(std::min<uint32_t>)(m_rcv_buf / 2, m_mss)) 
 	{
 		bool bWasClosed = (m_rcv_wnd == 0); // !?! Not sure about this was closed business
 
-		m_rcv_wnd = RECV_BUF_SIZE - m_rlen;
+		m_rcv_wnd = m_rcv_buf - m_rlen;
 
 		if (bWasClosed) 
 			__attempt_send(sfImmediateAck);
@@ -872,7 +1160,14 @@ int urdp_flow::__recv(safe_buffer& buf, error_code& ec)
 int urdp_flow::__send(safe_buffer buf, uint16_t msgType, 
 					  boost::logic::tribool reliable, error_code& ec)
 {
-	if (!m_socket||m_state != ESTABLISHED) 
+	if (m_socket&&m_state==SYN_SENT&&b_fast_open_)
+	{
+		//the remote flow is not known yet, the reliable messages are queued
+		//after the connect request and the others(semireliable too) dropped
+		if (reliable!=true)
+			return (int)buf.size();
+	}
+	else if (!m_socket||m_state != ESTABLISHED) 
 	{
 		BOOST_ASSERT(m_socket);//if __send is called, m_socket should not be NULL 
 		ec=asio::error::not_connected;
@@ -893,10 +1188,14 @@ int urdp_flow::__send(safe_buffer buf, uint16_t msgType,
 		write_uint16_hton(bufLen, ptoHeader);
 		write_uint16_hton((uint16_t)msgType, ptoHeader);
 		__queue(header, 4, CTRL_DATA, buf.size());
-		int written = __queue(buffer_cast<char*>(buf), bufLen, CTRL_DATA, 0);//write data
+		int written;
+		if (b_zero_copy_send_&&bufLen>=m_mss)
+			written = (int)__queue_ref(buf, CTRL_DATA);
+		else
+			written = __queue(buffer_cast<char*>(buf), bufLen, CTRL_DATA, 0);//write data
 		__attempt_send();
 
-		if (m_slen >= SND_BUF_SIZE) 
+		if (m_slen >= m_snd_buf) 
 		{
 			m_detect_writable = true;
 			ec=asio::error::would_block;
@@ -907,9 +1206,14 @@ int urdp_flow::__send(safe_buffer buf, uint16_t msgType,
 	else//semireliable&unreliable
 	{
 		size_t bufLen=buf.size();
-		BOOST_ASSERT(bufLen<=2*m_mss);
-		if (bufLen>2*m_mss||bufLen==0)
+		size_t maxLen=2*std::max<size_t>(m_mss, MTU_SIZE);
+		BOOST_ASSERT(bufLen<=maxLen);
+		if (bufLen>maxLen||bufLen==0)
 			return (int)bufLen;//do not send packet with length>mss
+		//with DF set a datagram longer than the path MTU is never delivered
+		//(it is not fragmented), so it is dropped here
+		if (bufLen>m_mss&&m_token&&m_token->shared_layer->is_path_mtu_discovery())
+			return (int)bufLen;
 
 		time32_type now=tick_now();
 
@@ -918,6 +1222,12 @@ int urdp_flow::__send(safe_buffer buf, uint16_t msgType,
 		seg.msgType=msgType;
 		seg.pktID=++m_unreliable_pktid;
 
+		if ((m_caps&CAP_FEC)&&fec(msgType))
+		{
+			__send_fec(seg, now);
+			return (int)bufLen;
+		}
+
 		if (!reliable)//unreliable
 		{
 			BOOST_ASSERT(reliable.value==boost::logic::tribool::false_value);
@@ -944,9 +1254,13 @@ int urdp_flow::__send(safe_buffer buf, uint16_t msgType,
 				seg.remainXmit=1;
 			}
 		}
-		__packet_as_unreliable_and_sendout(seg, now);
+		__send_unreliable(seg, now);
 		if (seg.remainXmit>0)
-			m_unreliable_slist.insert(seg);
+		{
+			m_unreliable_slist.push_back(seg);
+			std::push_heap(m_unreliable_slist.begin(), m_unreliable_slist.end(), 
+				SUnraliableSegmentLater());
+		}
 		return (int)bufLen;//ȳȴmssֱӶ
 	}
 }
@@ -959,15 +1273,7 @@ uint32_t urdp_flow::__queue(const char * data, std::size_t len, uint8_t ctrlType
 	std::size_t writeLen=0;
 	while (len-writeLen>0)
 	{
-		// We can concatenate data if the last segment is the same type
-		// (control v. regular data), and has not been transmitted yet
-		if (ctrlType==CTRL_DATA
-			&& !m_slist.empty() 
-			&& (m_slist.back().xmit == 0)
-			&& (m_slist.back().ctrlType == ctrlType) 
-			&& (m_slist.back().buf.size()<m_mss)
-			//&& (m_slist.back().buf.size()-m_mss>8)//
-			) 
+		if (__appendable(ctrlType)) 
 		{
 			safe_buffer& bf=m_slist.back().buf;
 			std::size_t canWriteLen=std::min(m_mss-bf.size(), len-writeLen);
@@ -999,6 +1305,48 @@ uint32_t urdp_flow::__queue(const char * data, std::size_t len, uint8_t ctrlType
 	return (uint32_t)writeLen;
 }
 
+uint32_t urdp_flow::__queue_ref(const safe_buffer& buf, uint8_t ctrlType)
+{
+	BOOST_ASSERT(m_self_holder);
+
+	const char* data=buffer_cast<const char*>(buf);
+	std::size_t len=buf.size();
+	std::size_t writeLen=0;
+
+	//fill up the last segment first, so that the slices are whole segments
+	if (__appendable(ctrlType))
+	{
+		writeLen=__queue(data, std::min(m_mss-m_slist.back().buf.size(), len), 
+			ctrlType);
+	}
+	while (len-writeLen>=m_mss)
+	{
+		SSegment sseg(m_snd_una + m_slen, ctrlType);
+		sseg.buf=buf.buffer_ref(writeLen, m_mss);
+		sseg.shared=true;
+		writeLen+=m_mss;
+		m_slen+=m_mss;
+		m_slist.push_back(sseg);
+	}
+	//the tail is copied, the next writes may be appended to it
+	if (len>writeLen)
+		writeLen+=__queue(data+writeLen, len-writeLen, ctrlType);
+	return (uint32_t)writeLen;
+}
+
+bool urdp_flow::__appendable(uint8_t ctrlType)const
+{
+	// We can concatenate data if the last segment is the same type
+	// (control v. regular data), and has not been transmitted yet
+	return ctrlType==CTRL_DATA
+		&& !m_slist.empty() 
+		&& (m_slist.back().xmit == 0)
+		&& (m_slist.back().ctrlType == ctrlType
+		||m_slist.back().ctrlType == CTRL_CONNECT_DATA) 
+		&& !m_slist.back().shared
+		&& (m_slist.back().buf.size()<m_mss);
+}
+
 int urdp_flow::__packet_as_unreliable_and_sendout(SUnraliableSegment& seg, time32_type now) 
 {
 	BOOST_ASSERT(m_self_holder);
@@ -1006,27 +1354,53 @@ int urdp_flow::__packet_as_unreliable_and_sendout(SUnraliableSegment& seg, time3
 	double remoteToLocalLostrate=(remote_to_local_lost_rate_<0.0?0.0:remote_to_local_lost_rate_);
 
 	const size_t format_size=unreliable_packet_format_type::format_size();
-	safe_buffer urdp_header_buf(format_size+4);//4 bytes for pktID and msgType
+	const size_t fec_size=(seg.control==CTRL_FEC_DATA?4:0);
+	safe_buffer urdp_header_buf(format_size+fec_size+4);//4 bytes for pktID and msgType
 
 	packet<unreliable_packet_format_type> urdp_header(urdp_header_buf,true);
-	urdp_header.set_control(seg.control);
+	//a pending delayed ACK goes with the message instead of on its own
+	const bool bundleAck=(m_t_ack&&(m_caps&CAP_ACK_FREQUENCY));
+	urdp_header.set_control(bundleAck?(seg.control|CTRL_FLAG_ACK):seg.control);
 	urdp_header.set_peer_id(seg.control==CTRL_CONNECT?m_token->flow_id:m_remote_peer_id);
 	urdp_header.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
 	urdp_header.set_id_for_lost_detect(id_for_lost_rate_++);
 	urdp_header.set_session_id(m_session_id);
-	urdp_header.set_window((uint16_t)std::min(m_rcv_wnd, (uint32_t)0xffff));
+	urdp_header.set_window(__window_field(seg.control));
 
 	//write packet chunk header
 	char* ptoHeader=buffer_cast<char*>(urdp_header.buffer())+format_size;
+	if (fec_size)
+	{
+		//FEC segments are sent only once, just when added to the group
+		write_uint16_hton(m_fec_encoder.group(), ptoHeader);
+		write_uint8(m_fec_encoder.count(), ptoHeader);
+		write_uint8(m_fec_encoder.size(), ptoHeader);
+	}
 	write_uint16_hton((uint16_t)seg.pktID, ptoHeader);
 	write_uint16_hton((uint16_t)seg.msgType, ptoHeader);
 
 	size_t dataLen=seg.buf.length();
-	boost::array<safe_buffer, 2> bufVec={{urdp_header.buffer(),seg.buf}};
 	error_code ec;
-	m_token->shared_layer->async_send_to(bufVec, m_remote_endpoint, ec);
+	if (bundleAck)
+	{
+		safe_buffer ackBuf(4);
+		char* pAck=buffer_cast<char*>(ackBuf);
+		write_uint32_hton(m_rcv_nxt, pAck);
+		boost::array<safe_buffer, 3> bufVec={{urdp_header.buffer(),seg.buf,ackBuf}};
+		m_token->shared_layer->async_send_to(bufVec, m_remote_endpoint, ec);
+		out_speed_meter_+=4;
 
-	out_speed_meter_+=(seg.buf.length()+format_size);
+		m_lastack = m_rcv_nxt;
+		m_t_ack = 0;
+		m_delayed_segs = 0;
+	}
+	else
+	{
+		boost::array<safe_buffer, 2> bufVec={{urdp_header.buffer(),seg.buf}};
+		m_token->shared_layer->async_send_to(bufVec, m_remote_endpoint, ec);
+	}
+
+	out_speed_meter_+=(seg.buf.length()+format_size+fec_size);
 
 	seg.remainXmit--;
 	m_t_lasttraffic=m_t_lastsend = now;
@@ -1045,17 +1419,38 @@ int urdp_flow::__packet_as_reliable_and_sendout(uint32_t seq, uint8_t control,
 	const size_t format_size=reliable_packet_format_type::format_size();
 	packet<reliable_packet_format_type> urdp_header;
 	urdp_header.set_control(control);
-	urdp_header.set_peer_id(control==CTRL_CONNECT?m_token->flow_id:m_remote_peer_id);
+	bool connectRequest=(control==CTRL_CONNECT||control==CTRL_CONNECT_DATA);
+	urdp_header.set_peer_id(connectRequest?m_token->flow_id:m_remote_peer_id);
 	//TODO:
 	//h.set_bandwidth_recving();
 	urdp_header.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
 	urdp_header.set_id_for_lost_detect(id_for_lost_rate_++);
 	urdp_header.set_session_id(m_session_id);
-	urdp_header.set_window((uint16_t)std::min(m_rcv_wnd, (uint32_t)0xffff));
+	urdp_header.set_window(__window_field(control));
 	urdp_header.set_time_sending((uint16_t)scape_zero(now));
 	urdp_header.set_time_echo(m_t_recent+((uint16_t)(now)-m_t_recent_now));
 	urdp_header.set_seqno(seq);
 	urdp_header.set_ackno(m_rcv_nxt);
+	if (connectRequest)
+		urdp_header.set_bandwidth_recving(LOCAL_CAPS);
+	else if (control==CTRL_CONNECT_ACK)
+		urdp_header.set_bandwidth_recving(m_caps);
+	else if (control==CTRL_DATA&&(m_caps&CAP_ACK_FREQUENCY))
+		urdp_header.set_bandwidth_recving(__ack_frequency_field());
+
+	//tell remote the out-of-order data we hold, so that it resends the holes only
+	safe_buffer sackBuf;
+	if (control==CTRL_ACK&&!data&&(m_caps&CAP_SACK))
+	{
+		char blocks[MAX_SACK_BLOCKS*8];
+		std::size_t cnt=__make_sack_blocks(blocks, MAX_SACK_BLOCKS);
+		if (cnt>0)
+		{
+			urdp_header.set_control(CTRL_SACK);
+			sackBuf=safe_buffer(blocks, cnt*8);
+			data=&sackBuf;
+		}
+	}
 
 	size_t dataLen=data?data->size():0;
 	out_speed_meter_+=(format_size+dataLen);
@@ -1075,6 +1470,7 @@ int urdp_flow::__packet_as_reliable_and_sendout(uint32_t seq, uint8_t control,
 
 	m_lastack = m_rcv_nxt;
 	m_t_ack = 0;//we have ACK remote
+	m_delayed_segs = 0;
 	m_t_lasttraffic=m_t_lastsend = now;
 	return dataLen;
 }
@@ -1090,7 +1486,7 @@ bool urdp_flow::__clock_check(time32_type now, long& nTimeout)
 	if (m_t_close_base)
 		nTimeout = std::min(nTimeout, mod_minus(*m_t_close_base, now));
 	if (m_t_ack)
-		nTimeout = std::min(nTimeout, mod_minus(m_t_ack + ACK_DELAY, now));
+		nTimeout = std::min(nTimeout, mod_minus(m_t_ack + m_ack_delay, now));
 	if (m_t_rto_base) 
 		nTimeout = std::min(nTimeout, mod_minus(m_t_rto_base + m_rto, now));
 	if (m_snd_wnd == 0)
@@ -1098,7 +1494,15 @@ bool urdp_flow::__clock_check(time32_type now, long& nTimeout)
 	if (m_state >= ESTABLISHED&&m_slist.empty()&&m_retrans_slist.empty())
 		nTimeout = std::min(nTimeout, mod_minus(m_t_lasttraffic + m_ping_interval, now));
 	if(!m_unreliable_slist.empty())
-		nTimeout = std::min(nTimeout, mod_minus(m_unreliable_slist.begin()->timeout, now));
+		nTimeout = std::min(nTimeout, mod_minus(m_unreliable_slist.front().timeout, now));
+	if (m_t_pmtu)
+		nTimeout = std::min(nTimeout, mod_minus(m_t_pmtu, now));
+	if (m_t_fec_flush)
+		nTimeout = std::min(nTimeout, mod_minus(m_t_fec_flush, now));
+	if (m_t_bundle_flush)
+		nTimeout = std::min(nTimeout, mod_minus(m_t_bundle_flush, now));
+	if (m_t_path_challenge)
+		nTimeout = std::min(nTimeout, mod_minus(m_t_path_challenge, now));
 
 	long lastCheckElapsed=mod_minus(now, m_t_last_on_clock);
 	BOOST_ASSERT(lastCheckElapsed>=0);
@@ -1161,37 +1565,94 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		//check session_id and remote_endpoint
 		if (m_state>=SYN_SENT)
 		{
-			if (urdp_header.get_session_id()!= m_session_id
-				||(m_state>=ESTABLISHED&&m_remote_endpoint!=from)
-				) 
+			if (urdp_header.get_session_id()!= m_session_id)
 				return false;
+			if (m_state>=ESTABLISHED&&m_remote_endpoint!=from)
+			{
+				if (m_state!=ESTABLISHED||!(m_caps&CAP_MIGRATION))
+					return false;
+				//the NAT of the remote may have been rebound, but nothing is
+				//taken from there before it answers a challenge
+				__process_new_path(sbuf, from, now);
+				return true;
+			}
 		}
 
 		m_t_lasttraffic = m_t_lastrecv = now;
-		m_snd_wnd = urdp_header.get_window();
+		m_snd_wnd = __peer_window(urdp_header.get_control(), urdp_header.get_window());
 		in_speed_meter_+=sbuf.length();
 
 		//calculate lost rate
 		__calculate_local_to_remote_lost_rate(urdp_header,now);
 
-		//is it unreliable msg
 		int ctrlType=urdp_header.get_control();
+
+		//strip the ACK bundled at the end of an unreliable packet
+		const safe_buffer* pkt=&sbuf;
+		safe_buffer ackStripped;
+		bool hasBundledAck=false;
+		uint32_t bundledAck=0;
+		if ((ctrlType&CTRL_FLAG_ACK)&&(m_caps&CAP_ACK_FREQUENCY))
+		{
+			ctrlType&=~CTRL_FLAG_ACK;
+			if ((CTRL_UNRELIABLE_DATA!=ctrlType&&CTRL_SEMIRELIABLE_DATA!=ctrlType
+				&&CTRL_FEC_DATA!=ctrlType&&CTRL_BUNDLE!=ctrlType)
+				||sbuf.size()<unreliable_format_size+8)
+				return false;
+			const char* pAck=buffer_cast<const char*>(sbuf)+sbuf.size()-4;
+			bundledAck=read_uint32_ntoh(pAck);
+			hasBundledAck=true;
+			ackStripped=sbuf.buffer_ref(0, sbuf.size()-4);
+			pkt=&ackStripped;
+		}
+
+		if (CTRL_PMTU_PROBE==ctrlType||CTRL_PMTU_PROBE_ACK==ctrlType)
+		{
+			if (ESTABLISHED==m_state)
+				__process_pmtu(ctrlType, sbuf, now);
+			return true;
+		}
+		if (CTRL_PATH_CHALLENGE==ctrlType||CTRL_PATH_RESPONSE==ctrlType)
+		{
+			if (ESTABLISHED==m_state)
+				__process_path(ctrlType, sbuf, from, now);
+			return true;
+		}
+
+		//is it unreliable msg
 		if (CTRL_UNRELIABLE_DATA==ctrlType
 			||CTRL_SEMIRELIABLE_DATA==ctrlType
 			)
 		{
-			if (sbuf.size()>=unreliable_format_size+4
+			if (pkt->size()>=unreliable_format_size+4
 				&&m_socket&&ESTABLISHED==m_state)
 			{
-				safe_buffer pkt=sbuf.buffer_ref(unreliable_format_size);
-				safe_buffer_io sbio(&pkt);
-				uint16_t id;
-				sbio>>id;
-				if (CTRL_UNRELIABLE_DATA==ctrlType||m_unreliable_rkeeper.try_keep(id, seconds(8)))
-				{
-					m_unreliable_rlist.push_back(pkt);
-					__allert_readable();
-				}
+				__deliver_unreliable(pkt->buffer_ref(unreliable_format_size),
+					CTRL_SEMIRELIABLE_DATA==ctrlType);
+				if (hasBundledAck)
+					__process_bundled_ack(bundledAck, now);
+				return true;
+			}
+			return false;
+		}
+		if (CTRL_BUNDLE==ctrlType)
+		{
+			if (m_socket&&ESTABLISHED==m_state&&__process_bundle(*pkt))
+			{
+				if (hasBundledAck&&ESTABLISHED==m_state)
+					__process_bundled_ack(bundledAck, now);
+				return true;
+			}
+			return false;
+		}
+		if (CTRL_FEC_DATA==ctrlType||CTRL_FEC_PARITY==ctrlType)
+		{
+			if (pkt->size()>=unreliable_format_size+4
+				&&m_socket&&ESTABLISHED==m_state)
+			{
+				__process_fec(ctrlType, *pkt, now);
+				if (hasBundledAck)
+					__process_bundled_ack(bundledAck, now);
 				return true;
 			}
 			return false;
@@ -1213,6 +1674,8 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 	bool notifyAccepet=false;
 	bool bConnect = false;
 	bool shouldImediateAck=false;
+	const char* sackData=NULL;
+	std::size_t sackLen=0;
 
 	uint32_t seqno=urdp_header.get_seqno();
 	uint32_t ackno=urdp_header.get_ackno();
@@ -1222,7 +1685,14 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 	case CTRL_NETWORK_UNREACHABLE:
 		if (urdp_header.get_session_id()==m_session_id)
 		{
-			if (m_state == SYN_SENT)
+			if (m_state == SYN_SENT&&b_fast_open_)
+			{
+				//connected is reported already, and the ticket is no good
+				session_cache().erase(m_remote_endpoint, m_domain);
+				m_dissconnect_reason|=DISCONN_REMOTE;
+				__allert_disconnected(asio::error::host_unreachable);
+			}
+			else if (m_state == SYN_SENT)
 				__allert_connected(asio::error::host_unreachable);
 			else
 			{
@@ -1240,7 +1710,13 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 
 			m_remote_peer_id=urdp_header.get_peer_id();
 			m_session_id=urdp_header.get_session_id();
+			m_caps=(uint16_t)(LOCAL_CAPS&urdp_header.get_bandwidth_recving());
 			m_lastack=m_rcv_nxt=seqno+rcvdDataLen;
+			if (!b_cc_assigned_)
+			{
+				__set_congestion_control(urdp_congestion_controller::
+					domain_congestion_control(std::string(data, rcvdDataLen)));
+			}
 			m_remote_endpoint=from;
 			m_t_recent =urdp_header.get_time_sending();
 			m_t_recent_now=now;
@@ -1256,6 +1732,43 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		}
 		return true;
 
+	case CTRL_CONNECT_DATA:
+		{
+			//[domain length|domain|data]
+			const char* p=data;
+			std::size_t domainLen=(rcvdDataLen<2?rcvdDataLen:read_uint16_ntoh(p));
+			if (rcvdDataLen<2+domainLen)
+				return false;
+			bConnect = true;
+			if (m_state == LISTEN)
+			{
+				//accepted at once, the data is delivered as CTRL_DATA below
+				m_state = ESTABLISHED;
+				notifyAccepet=true;
+
+				m_remote_peer_id=urdp_header.get_peer_id();
+				m_session_id=urdp_header.get_session_id();
+				m_caps=(uint16_t)(LOCAL_CAPS&urdp_header.get_bandwidth_recving());
+				m_lastack=m_rcv_nxt=seqno+2+(uint32_t)domainLen;
+				if (!b_cc_assigned_)
+				{
+					__set_congestion_control(urdp_congestion_controller::
+						domain_congestion_control(std::string(p, domainLen)));
+				}
+				m_remote_endpoint=from;
+				m_t_recent =urdp_header.get_time_sending();
+				m_t_recent_now=now;
+				__start_pmtu_discovery(now);
+
+				char myPeerID[4];
+				char* pMyPeerID=myPeerID;
+				write_int32_hton(m_token->flow_id, pMyPeerID);
+				__queue(myPeerID, 4, CTRL_CONNECT_ACK);
+				shouldImediateAck=true;
+			}
+		}
+		break;
+
 	case CTRL_CONNECT_ACK:
 		if (m_state == SYN_SENT) 
 		{
@@ -1265,10 +1778,13 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 				return false;
 			//const char* pHisPeerID=data;
 			m_remote_peer_id=read_uint32_ntoh(data);
+			m_caps=(uint16_t)(LOCAL_CAPS&urdp_header.get_bandwidth_recving());
 			m_state = ESTABLISHED;
 			m_lastack=m_rcv_nxt=seqno;
-			notifyConnected=true;// !!
+			__start_pmtu_discovery(now);
+			notifyConnected=!b_fast_open_;// !!
 			shouldImediateAck=true;
+			__save_ticket();
 		}
 		break;
 
@@ -1278,7 +1794,7 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		if (m_retrans_slist.size()==1)//must be request pkt
 		{
 			SSegment& seg=m_retrans_slist.front();
-			if (seg.ctrlType==CTRL_CONNECT)
+			if (seg.ctrlType==CTRL_CONNECT||seg.ctrlType==CTRL_CONNECT_DATA)
 			{
 				seg.xmit=1;//set to 1
 				__transmit(m_retrans_slist.begin(), now);//send conn request impdiatelly
@@ -1301,7 +1817,18 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		__allert_disconnected(error_code());
 		return true;
 
+	case CTRL_SACK:
+		//the payload is SACK blocks, not data
+		sackData=data;
+		sackLen=rcvdDataLen;
+		rcvdDataLen=0;
+		break;
+
 	case CTRL_DATA:
+		if (m_caps&CAP_ACK_FREQUENCY)
+			__apply_ack_frequency((uint16_t)urdp_header.get_bandwidth_recving());
+		break;
+
 	case CTRL_ACK:
 		break;
 
@@ -1335,77 +1862,24 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		{
 			long rtt = mod_minus((uint16_t)now, timeEcho);
 			__updata_rtt(rtt);
+			m_cc->on_rtt_sample(rtt, now);
 		}
 
-		m_snd_wnd = urdp_header.get_window();
-		uint32_t nAcked =mod_minus(ackno, m_snd_una);
-		m_snd_una = ackno;
-		m_slen -= nAcked;
-		BOOST_ASSERT(mod_less_equal(m_snd_una, m_snd_nxt));
-		if (m_snd_una == m_snd_nxt)
-			m_t_rto_base=0;
-		else if(!m_t_rto_base)
-			m_t_rto_base=scape_zero(now);
-
-		//printf("acked:------------------------------------------:%d\n", m_snd_una);
-
-		while (!m_retrans_slist.empty())
-		{
-			long eraseLen=mod_minus(m_snd_una, m_retrans_slist.front().seq);
-			BOOST_ASSERT(eraseLen>=0);
-			if (eraseLen>0)
-				m_retrans_slist.pop_front();
-			else
-				break;
-		}
-		if (m_retrans_slist.empty())
-			m_t_rto_base=0;
-
-		BOOST_ASSERT(m_retrans_slist.empty()||m_retrans_slist.front().seq==m_snd_una);
-
-		//fast retrans & fast recover
-		if (m_dup_acks >= 3) 
-		{
-			if (m_snd_una >= m_recover) 
-			{ 
-				//exit recovery
-				long nInFlight =mod_minus(m_snd_nxt, m_snd_una);
-				BOOST_ASSERT(nInFlight>=0);
-				m_cwnd=std::min(m_ssthresh, (uint32_t)nInFlight + m_mss);
-				m_dup_acks = 0;
-			} 
-			else 
-			{
-				//recovery retransmit
-				if (!__transmit(m_retrans_slist.begin(), now)) 
-				{
-					//std::cout << "recovery retransmit"<<m_retrans_slist.begin()->seq<<std::endl;;
-					__allert_disconnected(asio::error::timed_out);
-					return true;
-				}
-				m_cwnd += m_mss - std::min(nAcked, m_cwnd);
-			}
-		} 
-		else 
-		{
-			// Slow start, congestion avoidance
-			m_dup_acks = 0;
-			if (m_cwnd < m_ssthresh)
-				m_cwnd += m_mss;
-			else
-				m_cwnd += (uint32_t)std::max((uint64_t)1, (uint64_t)m_mss*(uint64_t)m_mss/m_cwnd);
-		}
+		m_snd_wnd = __peer_window(urdp_header.get_control(), urdp_header.get_window());
+		if (!__process_new_ack(ackno, now))
+			return true;
 
 		if ((m_state == SYN_RCVD) && !bConnect) 
 		{
 			m_state = ESTABLISHED;
 			notifyAccepet=true;
+			__start_pmtu_discovery(now);
 		}
 	} 
 	else if (ackno== m_snd_una) //!(m_snd_una<h.ackno<=m_snd_nxt)
 	{
 		// !?! Note, tcp says don't do this... but otherwise how does a closed window become open?
-		m_snd_wnd =urdp_header.get_window();
+		m_snd_wnd =__peer_window(urdp_header.get_control(), urdp_header.get_window());
 
 		// Check duplicate acks
 		if (rcvdDataLen > 0) 
@@ -1419,7 +1893,7 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 			if (m_dup_acks == 3) 
 			{ 
 				uint32_t nInFlight =mod_minus(m_snd_nxt, m_snd_una);
-				m_ssthresh = std::max((nInFlight*3)/4, 3*m_mss);//m_ssthresh = std::max(nInFlight / 2, 2 * m_mss);
+				m_cc->on_fast_retransmit(nInFlight);
 				m_recover = m_snd_nxt;
 				BOOST_ASSERT(!m_retrans_slist.empty());
 				if (!__transmit(m_retrans_slist.begin(), now)) 
@@ -1430,8 +1904,7 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 			} 
 			else if (m_dup_acks > 3)
 			{
-				//(Fast Recover)
-				m_cwnd += m_mss;
+				m_cc->on_dup_ack();
 			}
 		} 
 		else //!(m_snd_una != m_snd_nxt) 
@@ -1440,6 +1913,16 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		}
 	}
 
+	if (sackLen&&(m_caps&CAP_SACK))
+	{
+		__process_sack(sackData, sackLen);
+		if (!__retransmit_sack_holes(now))
+		{
+			__allert_disconnected(asio::error::timed_out);
+			return true;
+		}
+	}
+
 	// Conditions were acks must be sent:
 	// 1) Segment is too old (they missed an ACK) (immediately)
 	// 2) Segment is too new (we missed a segment) (immediately)
@@ -1452,10 +1935,10 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 	else if (rcvdDataLen != 0)
 		sflags = sfDelayedAck;
 
-	// Adjust the incoming segment to fit our receive buffer
-	if (seqno < m_rcv_nxt) 
+	// Adjust the incoming segment to fit our receive buffer(seqs wrap)
+	if (mod_less(seqno, m_rcv_nxt)) 
 	{
-		uint32_t nAdjust = m_rcv_nxt - seqno;
+		uint32_t nAdjust = (uint32_t)mod_minus(m_rcv_nxt, seqno);
 		if (nAdjust < rcvdDataLen) 
 		{
 			seqno += nAdjust;
@@ -1469,13 +1952,14 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 		}
 	}
 
-	if (!m_rlist.empty())
-	{
-		if (mod_minus(seqno+rcvdDataLen, m_rcv_nxt)>=RECV_BUF_SIZE)
-			rcvdDataLen=0;
-	}
+	//out of the receive buffer
+	long rcvdEnd=mod_minus(seqno+rcvdDataLen, m_rcv_nxt);
+	if (rcvdEnd<0||rcvdEnd>=(long)m_rcv_buf)
+		rcvdDataLen=0;
 
-	bool bIgnoreData = (urdp_header.get_control()!=CTRL_DATA) || (m_shutdown != SD_NONE);
+	//the domain of CTRL_CONNECT_DATA is before m_rcv_nxt, so only data is left
+	bool bIgnoreData = (urdp_header.get_control()!=CTRL_DATA
+		&&urdp_header.get_control()!=CTRL_CONNECT_DATA) || (m_shutdown != SD_NONE);
 	bool bNewData = false;
 
 	if (rcvdDataLen > 0) 
@@ -1490,45 +1974,23 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 			//uint32_t nOffset = seqno - m_rcv_nxt;
 			//memcpy(m_rbuf + m_rlen + nOffset, seg.data, seg.len);
 			//std::cout<<" seqno------:"<< seqno<<"   m_rcv_nxt:"<<m_rcv_nxt<<std::endl;
-			RSegment rseg;
-			rseg.seq=seqno;
-			safe_buffer_io io(&(rseg.buf));
-			io.write(data, rcvdDataLen);
-			std::pair<RSegmentList::iterator, bool >insertRst=m_rlist.insert(rseg);
-
-			/*		if (m_rlist.size()>15)
-			{
-			bool t=m_detect_readable;
-			//std::cout<<"sd"<<std::endl;
-			}*/
-
-			if (insertRst.second)
-			{
-				if (m_rcv_wnd<rcvdDataLen)
-					m_rcv_wnd=0;
-				else
-					m_rcv_wnd -= rcvdDataLen;
-			}
+			if (m_rlen==0)
+				m_rring.rebase(m_rcv_nxt);
+			uint32_t newLen=(uint32_t)m_rring.write(seqno, data, rcvdDataLen, m_rcv_nxt);
+			if (m_rcv_wnd<newLen)
+				m_rcv_wnd=0;
+			else
+				m_rcv_wnd -= newLen;
 
 			if (seqno == m_rcv_nxt) 
 			{
-				//BOOST_ASSERT(insertRst.second);
-				//m_rlen += rcvdDataLen;
-				//m_rcv_nxt += rcvdDataLen;
-				//m_rcv_wnd -= rcvdDataLen;
-				RSegmentList::iterator it = m_rlist.begin();
-				while ((it != m_rlist.end()) && mod_less_equal(it->seq , m_rcv_nxt)) 
+				uint32_t rcvNxt=m_rring.advance(m_rcv_nxt);
+				if (mod_less(m_rcv_nxt, rcvNxt))
 				{
-					uint32_t seqEnd=it->seq + it->buf.size();
-					if (mod_less(m_rcv_nxt, seqEnd))
-					{
-						bNewData = true;
-						//sflags = sfImmediateAck; // (Fast Recovery)
-						int nAdjust =mod_minus(seqEnd, m_rcv_nxt);
-						m_rlen += nAdjust;
-						m_rcv_nxt += nAdjust;
-					}
-					++it;
+					bNewData = true;
+					//sflags = sfImmediateAck; // (Fast Recovery)
+					m_rlen += mod_minus(rcvNxt, m_rcv_nxt);
+					m_rcv_nxt = rcvNxt;
 				}
 			} 
 		}
@@ -1558,7 +2020,7 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 	// If we make room in the _send queue, notify the user
 	// The goal it to make sure we always have at least enough data to fill the
 	// window. We'd like to notify the app when we are halfway to that point.
-	const uint32_t kIdealRefillSize = (SND_BUF_SIZE + RECV_BUF_SIZE) / 2;
+	const uint32_t kIdealRefillSize = (m_snd_buf + m_rcv_buf) / 2;
 	if (m_detect_writable && (m_slen < kIdealRefillSize)) 
 	{
 		//m_detect_writable = false;
@@ -1576,7 +2038,7 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 	{
 		__allert_writeable();
 	}
-	if (notifyReadable)
+	if (notifyReadable&&!notifyAccepet)//an accepted flow reads when accepted
 	{
 		__allert_readable();
 	}
@@ -1588,28 +2050,264 @@ bool urdp_flow::__process(const safe_buffer& sbuf, const endpoint_type& from)
 	return true;
 }
 
-void urdp_flow::__allert_connected(const error_code & ec)
+//the part of an ACK of new data that a bundled ACK has too. Returns false if
+//the flow is disconnected
+bool urdp_flow::__process_new_ack(uint32_t ackno, time32_type now)
 {
-	m_establish_time=tick_now();
-	m_t_close_base.reset();
-
-	BOOST_ASSERT(b_active_);
-	if(!m_socket||is_canceled_op(op_stamp()))
-	{
-		__close(true);
-		return;
+	BOOST_ASSERT(mod_less(m_snd_una, ackno)&&mod_less_equal(ackno, m_snd_nxt));
+
+	uint32_t nAcked =mod_minus(ackno, m_snd_una);
+	m_snd_una = ackno;
+	m_pmtu_rto_cnt=0;
+	m_slen -= nAcked;
+	BOOST_ASSERT(mod_less_equal(m_snd_una, m_snd_nxt));
+	if (m_snd_una == m_snd_nxt)
+		m_t_rto_base=0;
+	else if(!m_t_rto_base)
+		m_t_rto_base=scape_zero(now);
+
+	//printf("acked:------------------------------------------:%d\n", m_snd_una);
+
+	while (!m_retrans_slist.empty())
+	{
+		long eraseLen=mod_minus(m_snd_una, m_retrans_slist.front().seq);
+		BOOST_ASSERT(eraseLen>=0);
+		if (eraseLen>0)
+			m_retrans_slist.pop_front();
+		else
+			break;
 	}
+	if (m_retrans_slist.empty())
+		m_t_rto_base=0;
 
-	if (!ec)
-	{
-		if (resolver_)
-			resolver_.reset();
-		keep_async_receiving();
-		m_socket->on_connected(ec);
-	}
-	else
+	BOOST_ASSERT(m_retrans_slist.empty()||m_retrans_slist.front().seq==m_snd_una);
+
+	//fast retrans & fast recover
+	if (m_dup_acks >= 3) 
 	{
-		m_socket->on_connected(ec);
+		if (m_snd_una >= m_recover) 
+		{ 
+			//exit recovery
+			long nInFlight =mod_minus(m_snd_nxt, m_snd_una);
+			BOOST_ASSERT(nInFlight>=0);
+			m_cc->on_recovery_exit((uint32_t)nInFlight);
+			m_dup_acks = 0;
+		} 
+		else 
+		{
+			//recovery retransmit
+			if (!__transmit(m_retrans_slist.begin(), now)) 
+			{
+				//std::cout << "recovery retransmit"<<m_retrans_slist.begin()->seq<<std::endl;;
+				__allert_disconnected(asio::error::timed_out);
+				return false;
+			}
+			m_cc->on_partial_ack(nAcked);
+		}
+	} 
+	else 
+	{
+		// Slow start, congestion avoidance
+		m_dup_acks = 0;
+		uint32_t ackSegs=DEFAULT_ACK_EVERY;
+		if ((m_caps&CAP_ACK_FREQUENCY)&&m_ack_freq_segs)
+			ackSegs=std::min(std::max(m_ack_freq_segs, DEFAULT_ACK_EVERY), MAX_ACK_FREQUENCY_SEGS);
+		m_cc->on_ack(nAcked, mod_minus(m_snd_nxt, m_snd_una), ackSegs);
+	}
+	__tune_send_buffer();
+	return true;
+}
+
+uint16_t urdp_flow::__window_field(int control)const
+{
+	uint32_t wnd=m_rcv_wnd;
+	if ((m_caps&CAP_WINDOW_SCALE)&&!unscaled_window(control))
+		wnd>>=WINDOW_SCALE_SHIFT;
+	return (uint16_t)std::min(wnd, (uint32_t)0xffff);
+}
+
+uint32_t urdp_flow::__peer_window(int control, uint32_t window)const
+{
+	if ((m_caps&CAP_WINDOW_SCALE)&&!unscaled_window(control))
+		return window<<WINDOW_SCALE_SHIFT;
+	return window;
+}
+
+void urdp_flow::__grow_buffer(uint32_t& bufSize, uint32_t want, uint32_t maxSize)
+{
+	want=std::min(want, maxSize);
+	if (want<=bufSize)
+		return;
+	uint32_t granted=(uint32_t)s_buffer_memory.reserve(want-bufSize);
+	bufSize+=granted;
+	m_buf_reserved+=granted;
+}
+
+void urdp_flow::__tune_recv_buffer(time32_type now)
+{
+	//the user reads at most a window in an rtt. If it has read more than 
+	//half of the buffer in the last one, the window may be what limits the
+	//flow, and the buffer grows to twice that(dynamic right sizing).
+	if (!(m_caps&CAP_WINDOW_SCALE)||m_srtt==0
+		||mod_less(now, m_t_rcv_space+m_srtt))
+		return;
+	if (m_rcv_space>m_rcv_buf/2)
+	{
+		uint32_t oldBuf=m_rcv_buf;
+		__grow_buffer(m_rcv_buf, 2*m_rcv_space, MAX_RECV_BUF_SIZE);
+		m_rcv_wnd+=m_rcv_buf-oldBuf;
+	}
+	m_rcv_space=0;
+	m_t_rcv_space=now;
+}
+
+void urdp_flow::__tune_send_buffer()
+{
+	//twice what may be in flight, so that the user refills it in time
+	uint32_t inFlight=std::min(m_snd_wnd, m_cc->cwnd());
+	if (2*inFlight>m_snd_buf)
+		__grow_buffer(m_snd_buf, 2*inFlight, MAX_SND_BUF_SIZE);
+}
+
+void urdp_flow::__release_buffers()
+{
+	if (m_buf_reserved)
+		s_buffer_memory.release(m_buf_reserved);
+	m_buf_reserved=0;
+}
+
+void urdp_flow::buffer_memory_limit(std::size_t bytes)
+{
+	s_buffer_memory.limit(bytes);
+}
+
+std::size_t urdp_flow::buffer_memory_limit()
+{
+	return s_buffer_memory.limit();
+}
+
+std::size_t urdp_flow::buffer_memory_used()
+{
+	return s_buffer_memory.used();
+}
+
+void urdp_flow::__process_bundled_ack(uint32_t ackno, time32_type now)
+{
+	//no timestamps nor SACK blocks, it only acks new data
+	if (m_state!=ESTABLISHED
+		||!mod_less(m_snd_una, ackno)||!mod_less_equal(ackno, m_snd_nxt))
+	{
+		return;
+	}
+	if (!__process_new_ack(ackno, now))
+		return;
+	__attempt_send();
+	__schedule_timer(now);
+	if (m_detect_writable&&(m_slen<(m_snd_buf+m_rcv_buf)/2))
+		__allert_writeable();
+}
+
+bool urdp_flow::__has_out_of_order_data()const
+{
+	return m_rring.has_out_of_order();
+}
+
+std::size_t urdp_flow::__make_sack_blocks(char* p, std::size_t maxBlocks)const
+{
+	//the out-of-order blocks of the receive ring are merged already
+	const urdp_recv_ring::block_list& blocks=m_rring.blocks();
+	std::size_t cnt=0;
+	for (;cnt<blocks.size()&&cnt<maxBlocks;++cnt)
+	{
+		write_uint32_hton(blocks[cnt].first, p);
+		write_uint32_hton(blocks[cnt].second, p);
+	}
+	return cnt;
+}
+
+void urdp_flow::__process_sack(const char* p, std::size_t len)
+{
+	for (std::size_t i=0;i+8<=len&&i<MAX_SACK_BLOCKS*8;i+=8)
+	{
+		uint32_t blockBegin=read_uint32_ntoh(p);
+		uint32_t blockEnd=read_uint32_ntoh(p);
+		if (!mod_less(blockBegin, blockEnd)
+			||mod_less(blockBegin, m_snd_una)
+			||mod_less(m_snd_nxt, blockEnd)
+			)
+		{
+			continue;//invalid or out of date
+		}
+		SSegmentList::iterator itr=m_retrans_slist.lower_bound(blockBegin, 
+			&this_type::__segment_seq_less);
+		for (;itr!=m_retrans_slist.end();++itr)
+		{
+			if (mod_less(blockEnd, itr->seq+(uint32_t)itr->buf.size()))
+				break;
+			itr->sacked=true;
+		}
+	}
+}
+
+bool urdp_flow::__retransmit_sack_holes(time32_type now)
+{
+	//find the last hole that has at least SACK_DUP_THRESH segments SACKed 
+	//above it, the holes below it are lost.
+	int sackedAbove=0;
+	SSegmentList::iterator lastLost=m_retrans_slist.end();
+	SSegmentList::iterator itr=m_retrans_slist.end();
+	while (itr!=m_retrans_slist.begin())
+	{
+		--itr;
+		if (itr->sacked)
+		{
+			++sackedAbove;
+		}
+		else if (sackedAbove>=SACK_DUP_THRESH)
+		{
+			lastLost=itr;
+			break;
+		}
+	}
+	if (lastLost==m_retrans_slist.end())
+		return true;
+
+	int rexmitCnt=0;
+	++lastLost;
+	for (itr=m_retrans_slist.begin();itr!=lastLost;++itr)
+	{
+		if (itr->sacked||mod_less(itr->seq, m_sack_rexmit_nxt))
+			continue;
+		if (!__transmit(itr, now))
+			return false;
+		if (++rexmitCnt>=MAX_SACK_REXMIT_PER_ACK)
+			break;
+	}
+	return true;
+}
+
+void urdp_flow::__allert_connected(const error_code & ec)
+{
+	m_establish_time=tick_now();
+	m_t_close_base.reset();
+
+	BOOST_ASSERT(b_active_);
+	if(!m_socket||is_canceled_op(op_stamp()))
+	{
+		__close(true);
+		return;
+	}
+
+	if (!ec)
+	{
+		if (resolver_)
+			resolver_.reset();
+		keep_async_receiving();
+		m_socket->on_connected(ec);
+	}
+	else
+	{
+		m_socket->on_connected(ec);
 		__to_closed_state();
 	}
 }
@@ -1661,7 +2359,7 @@ void urdp_flow::__allert_writeable()
 		return;
 	}
 
-	if (m_slen<SND_BUF_SIZE)
+	if (m_slen<m_snd_buf)
 	{
 		m_detect_writable=false;
 		m_socket->on_writeable();
@@ -1751,7 +2449,16 @@ bool urdp_flow::__transmit(const SSegmentList::iterator& itr, time32_type now)
 		__packet_as_reliable_and_sendout(seg.seq, seg.ctrlType, &seg.buf, now);
 
 	if (seg.xmit == 0) 
+	{
 		m_snd_nxt += seg.buf.size();
+		m_sent_bytes += seg.buf.size();
+	}
+	else 
+	{
+		m_retransmitted_bytes += seg.buf.size();
+		if (mod_less(m_sack_rexmit_nxt, seg.seq+(uint32_t)seg.buf.size()))
+			m_sack_rexmit_nxt=seg.seq+(uint32_t)seg.buf.size();
+	}
 	seg.xmit += 1;
 
 	if (!m_t_rto_base)
@@ -1767,11 +2474,22 @@ void urdp_flow::__attempt_send(SendFlags sflags)
 	time32_type now = tick_now();
 
 	if (mod_minus(now, m_t_lastsend) > static_cast<long>(m_rto))
-		m_cwnd =std::max(2*m_mss, m_cwnd/2);
+		m_cc->on_idle();
+
+	if (sflags == sfDelayedAck)
+		++m_delayed_segs;
+
+	//data segments do not carry SACK blocks, so a hole is reported by an 
+	//ACK of its own
+	if (sflags == sfImmediateAck && !m_slist.empty() 
+		&& (m_caps&CAP_SACK) && __has_out_of_order_data())
+	{
+		__packet_as_reliable_and_sendout(m_snd_nxt, CTRL_ACK, NULL, now);
+	}
 
 	while (true)
 	{
-		uint32_t cwnd = m_cwnd;
+		uint32_t cwnd = m_cc->cwnd();
 		if ((m_dup_acks == 1) || (m_dup_acks == 2)) 
 			cwnd += m_dup_acks * m_mss;// Limited Transmit
 		uint32_t nWindow = std::min(m_snd_wnd, cwnd);
@@ -1789,27 +2507,716 @@ void urdp_flow::__attempt_send(SendFlags sflags)
 		}
 
 		bool immediateAck=(nAvailable == 0||mod_less(m_snd_una, m_snd_nxt) && (nAvailable < m_mss));
+		//before the remote answers, only the connect request goes(see 
+		//fast_reconnect)
+		if (m_state<ESTABLISHED&&!m_slist.empty()&&m_slist.front().ctrlType==CTRL_DATA)
+			return;
 		if (m_slist.empty()) 
 		{
-			// If this is an immediate ack, or the second delayed ack
-			if ((sflags == sfImmediateAck) || immediateAck&&m_t_ack) 
+			// If this is an immediate ack, or enough segments wait for an ACK
+			// (see ack_frequency)
+			if ((sflags == sfImmediateAck) 
+				|| immediateAck&&m_t_ack&&m_delayed_segs>=m_ack_every) 
 				__packet_as_reliable_and_sendout(m_snd_nxt, CTRL_ACK, NULL, now);
-			else if(sflags != sfNone)
+			else if(sflags != sfNone&&!m_t_ack)
 				m_t_ack = scape_zero(now);
 			return;    
 		}
 
+		// Wait for the shared layer to wake us up if it is too early
+		if (b_pacing_&&!__pacing_permit(now))
+		{
+			if (sflags == sfImmediateAck)
+				__packet_as_reliable_and_sendout(m_snd_nxt, CTRL_ACK, NULL, now);
+			else if(sflags != sfNone&&!m_t_ack)
+				m_t_ack = scape_zero(now);
+			__schedule_pacing();
+			return;
+		}
+
 		// Find the next segment to transmit
 		BOOST_ASSERT(!m_slist.empty());
 		if (!__transmit(m_slist.begin(), now)) 
 			return;// TODO: consider closing socket
 		BOOST_ASSERT(!m_slist.empty());
+		if (b_pacing_)
+			m_pacing_credit-=m_slist.front().buf.size();
 		m_retrans_slist.push_back(m_slist.front());
 		m_slist.pop_front();
 		sflags = sfNone;
 	}
 }
 
+void urdp_flow::pacing(bool enable)
+{
+	if (b_pacing_==enable)
+		return;
+	b_pacing_=enable;
+	m_pacing_credit=0;
+	m_t_pacing=tick_now();
+	if (!enable&&m_state!=CLOSED&&!m_slist.empty())
+		__attempt_send();
+}
+
+uint32_t urdp_flow::__pacing_rate()const
+{
+	if (m_srtt<=0)
+		return 0;
+	//a little faster than cwnd/srtt, so that the window still limits the 
+	//flow and pacing only removes the bursts(as fast as twice to let the 
+	//window grow in slow start)
+	uint64_t rate=(uint64_t)m_cc->cwnd()*1000/m_srtt;
+	if (m_cc->cwnd()<m_cc->ssthresh())
+		rate*=2;
+	else
+		rate+=rate/4;
+	return (uint32_t)std::min<uint64_t>(rate, 0xffffffff);
+}
+
+bool urdp_flow::__pacing_permit(time32_type now)
+{
+	uint32_t rate=__pacing_rate();
+	if (!rate)
+		return true;
+
+	long elapsed=mod_minus(now, m_t_pacing);
+	if (elapsed>0)
+	{
+		m_pacing_credit+=(int64_t)rate*elapsed/1000;
+		m_t_pacing=now;
+	}
+	int64_t burst=std::max((int64_t)PACING_MIN_BURST*m_mss,
+		(int64_t)rate*PACING_QUANTUM/1000);
+	if (m_pacing_credit>burst)
+		m_pacing_credit=burst;
+	return m_pacing_credit>0;
+}
+
+void urdp_flow::__schedule_pacing()
+{
+	if (b_pacing_scheduled_||!m_token)
+		return;
+	uint32_t rate=__pacing_rate();
+	BOOST_ASSERT(rate>0&&m_pacing_credit<=0);
+	long delay=(long)(((1-m_pacing_credit)*1000+rate-1)/rate);
+	b_pacing_scheduled_=true;
+	m_token->shared_layer->schedule_pacing(
+		boost::bind(&this_type::__wake_for_pacing, &get_io_service(),
+		boost::weak_ptr<this_type>(SHARED_OBJ_FROM_THIS)),
+		delay);
+}
+
+//called in the io_service of the layer, which is not the flow's if the flow
+//runs on another thread(a shard or a pool)
+void urdp_flow::__wake_for_pacing(io_service* ios, boost::weak_ptr<urdp_flow> wflow)
+{
+	ios->dispatch(boost::bind(&this_type::__on_pacing, wflow));
+}
+
+void urdp_flow::__on_pacing(boost::weak_ptr<urdp_flow> wflow)
+{
+	shared_ptr flow=wflow.lock();
+	if (!flow)
+		return;
+	flow->b_pacing_scheduled_=false;
+	if (flow->m_state==CLOSED)
+		return;
+	flow->__attempt_send();
+	flow->__schedule_timer(tick_now());
+}
+
+void urdp_flow::__adjust_mtu(uint32_t mss)
+{
+	if (mss==m_mss)
+		return;
+	bool shrink=(mss<m_mss);
+	m_mss=mss;
+	m_cc->set_mss(mss);
+	if (shrink)
+	{
+		//the queued segments, and those to be resent, must not be longer either
+		__resegment(m_retrans_slist);
+		__resegment(m_slist);
+	}
+}
+
+void urdp_flow::__resegment(SSegmentList& slist)
+{
+	//the tail is copied out(unless it is a slice), for the last segment may 
+	//still be appended to
+	for (std::size_t i=0;i<slist.size();++i)
+	{
+		SSegment& seg=slist[i];
+		if (seg.buf.size()<=m_mss)
+			continue;
+		SSegment tail(seg.seq+m_mss, seg.ctrlType);
+		tail.xmit=seg.xmit;
+		tail.sacked=seg.sacked;
+		tail.shared=seg.shared;
+		if (seg.shared)
+		{
+			//slices are sliced again
+			tail.buf=seg.buf.buffer_ref(m_mss);
+			seg.buf=seg.buf.buffer_ref(0, m_mss);
+		}
+		else
+		{
+			const char* p=buffer_cast<const char*>(seg.buf);
+			tail.buf=safe_buffer(p+m_mss, seg.buf.size()-m_mss);
+			seg.buf=safe_buffer(p, m_mss);
+		}
+		slist.insert(slist.begin()+i+1, tail);
+	}
+}
+
+void urdp_flow::__start_pmtu_discovery(time32_type now)
+{
+	if (!m_token->shared_layer->is_path_mtu_discovery())
+		return;
+
+	//a remote that can not be probed keeps MTU_SIZE, as it was before DF;
+	//the search of the others starts from the minimum.
+	if (!(m_caps&CAP_PMTU_PROBE))
+		return;
+	__adjust_mtu(MIN_MTU_SIZE);
+
+	m_pmtu_state=PMTU_BASE;
+	m_pmtu_lo=MIN_MTU_SIZE;
+	m_pmtu_hi=MAX_MTU_SIZE;
+	m_pmtu_probe_size=MIN_MTU_SIZE;
+	m_pmtu_probe_cnt=0;
+	__send_pmtu_probe(now);
+}
+
+void urdp_flow::__send_pmtu_probe(time32_type now)
+{
+	BOOST_ASSERT(m_pmtu_probe_size>=MIN_MTU_SIZE&&m_pmtu_probe_size<=MAX_MTU_SIZE);
+	++m_pmtu_probe_cnt;
+	m_t_pmtu=scape_zero(now+m_rto);
+	__packet_pmtu_and_sendout(CTRL_PMTU_PROBE, m_pmtu_probe_size);
+}
+
+void urdp_flow::__pmtu_next_probe(time32_type now)
+{
+	if (m_pmtu_hi<m_pmtu_lo+PMTU_SEARCH_STEP)
+	{
+		m_pmtu_state=PMTU_SEARCH_COMPLETE;
+		m_pmtu_probe_size=0;
+		m_t_pmtu=scape_zero(now+PMTU_RAISE_TIMER);
+		return;
+	}
+	m_pmtu_state=PMTU_SEARCHING;
+	if (m_pmtu_lo<PMTU_ETHERNET_MSS&&PMTU_ETHERNET_MSS<=m_pmtu_hi)
+		m_pmtu_probe_size=PMTU_ETHERNET_MSS;
+	else
+		m_pmtu_probe_size=(m_pmtu_lo+m_pmtu_hi+1)/2;
+	m_pmtu_probe_cnt=0;
+	__send_pmtu_probe(now);
+}
+
+void urdp_flow::__on_pmtu_probe_acked(uint32_t mss, time32_type now)
+{
+	if (!m_pmtu_probe_size||mss!=m_pmtu_probe_size)
+		return;//a late ack of an old probe
+	m_pmtu_lo=mss;
+	if (mss>m_mss)
+		__adjust_mtu(mss);
+	__pmtu_next_probe(now);
+}
+
+void urdp_flow::__on_pmtu_probe_timeout(time32_type now)
+{
+	if (m_pmtu_probe_cnt<PMTU_MAX_PROBES)
+	{
+		__send_pmtu_probe(now);
+		return;
+	}
+	if (m_pmtu_state==PMTU_BASE)
+	{
+		//even the minimum does not get through, try again later
+		m_pmtu_state=PMTU_ERROR;
+		m_pmtu_probe_size=0;
+		m_t_pmtu=scape_zero(now+PMTU_RAISE_TIMER);
+		return;
+	}
+	m_pmtu_hi=m_pmtu_probe_size-1;
+	__pmtu_next_probe(now);
+}
+
+void urdp_flow::__on_pmtu_black_hole(time32_type now)
+{
+	//full sized segments keep being lost, the path MTU may have dropped
+	m_pmtu_hi=m_mss-1;
+	m_pmtu_lo=MIN_MTU_SIZE;
+	m_pmtu_rto_cnt=0;
+	__adjust_mtu(MIN_MTU_SIZE);
+	__pmtu_next_probe(now);
+}
+
+void urdp_flow::__packet_pmtu_and_sendout(uint8_t control, uint32_t mss)
+{
+	BOOST_ASSERT(m_self_holder);
+
+	double remoteToLocalLostrate=(remote_to_local_lost_rate_<0.0?0.0:remote_to_local_lost_rate_);
+
+	const size_t format_size=packet_format_type::format_size();
+	size_t len=format_size+4;
+	if (control==CTRL_PMTU_PROBE)
+		len=reliable_packet_format_type::format_size()+mss;
+	safe_buffer buf(len);
+	memset(buffer_cast<char*>(buf), 0, len);
+
+	//a lost probe says nothing about congestion, so it does not take an id
+	//of lost rate detection
+	packet<packet_format_type> urdp_header(buf,true);
+	urdp_header.set_control(control);
+	urdp_header.set_peer_id(m_remote_peer_id);
+	urdp_header.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
+	urdp_header.set_id_for_lost_detect((int8_t)(id_for_lost_rate_-1));
+	urdp_header.set_session_id(m_session_id);
+	urdp_header.set_window(__window_field(control));
+	char* p=buffer_cast<char*>(buf)+format_size;
+	write_uint32_hton(mss, p);
+
+	error_code ec;
+	m_token->shared_layer->async_send_to(buf, m_remote_endpoint, ec);
+	out_speed_meter_+=len;
+}
+
+void urdp_flow::__process_pmtu(int ctrlType, const safe_buffer& pkt, time32_type now)
+{
+	const size_t format_size=packet_format_type::format_size();
+	if (pkt.size()<format_size+4)
+		return;
+	const char* p=buffer_cast<const char*>(pkt)+format_size;
+	uint32_t mss=read_uint32_ntoh(p);
+	if (CTRL_PMTU_PROBE==ctrlType)
+	{
+		//a truncated probe is not acked
+		if (mss<=MAX_MTU_SIZE&&pkt.size()==reliable_packet_format_type::format_size()+mss)
+			__packet_pmtu_and_sendout(CTRL_PMTU_PROBE_ACK, mss);
+	}
+	else
+	{
+		__on_pmtu_probe_acked(mss, now);
+	}
+}
+
+void urdp_flow::__process_new_path(const safe_buffer& pkt, const endpoint_type& from, 
+								   time32_type now)
+{
+	packet<packet_format_type> urdp_header(pkt);
+	int ctrlType=urdp_header.get_control();
+	if (CTRL_PATH_CHALLENGE==ctrlType||CTRL_PATH_RESPONSE==ctrlType)
+	{
+		__process_path(ctrlType, pkt, from, now);
+		return;
+	}
+
+	//only a reliable packet that acks what has been sent starts a challenge,
+	//a stray one with the session id does not
+	if ((CTRL_DATA!=ctrlType&&CTRL_ACK!=ctrlType&&CTRL_SACK!=ctrlType)
+		||pkt.size()<reliable_packet_format_type::format_size())
+		return;
+	packet<reliable_packet_format_type> reliableHeader(pkt);
+	uint32_t ackno=reliableHeader.get_ackno();
+	if (!mod_less_equal(m_snd_una, ackno)||!mod_less_equal(ackno, m_snd_nxt))
+		return;
+	if (m_path_nonce)
+		return;//a challenge is going on
+	if (m_t_path_allowed&&mod_less(now, m_t_path_allowed))
+		return;//too soon after the last one
+
+	//the new endpoint must echo its nonce. The old one is challenged too:
+	//a NAT that has rebound does not deliver there any more, so if it is
+	//answered the remote is still where it was and the packets from the 
+	//new endpoint are forged(or a copy), the flow does not move.
+	m_path_candidate=from;
+	m_path_nonce=random<uint32_t>(1, 0xffffffff);
+	m_path_old_nonce=random<uint32_t>(1, 0xffffffff);
+	m_path_challenge_cnt=0;
+	b_path_validated_=false;
+	__send_path_challenge(now);
+	__schedule_timer(now);
+}
+
+void urdp_flow::__end_path_challenge(time32_type now, time32_type holdOff)
+{
+	m_path_nonce=0;
+	m_path_old_nonce=0;
+	m_t_path_challenge=0;
+	b_path_validated_=false;
+	m_t_path_allowed=scape_zero(now+holdOff);
+}
+
+void urdp_flow::__process_path(int ctrlType, const safe_buffer& pkt, 
+							   const endpoint_type& from, time32_type now)
+{
+	const size_t format_size=packet_format_type::format_size();
+	if (pkt.size()<format_size+4)
+		return;
+	const char* p=buffer_cast<const char*>(pkt)+format_size;
+	uint32_t nonce=read_uint32_ntoh(p);
+	if (CTRL_PATH_CHALLENGE==ctrlType)
+	{
+		//answered where it came from, which is what is being validated
+		__packet_path_and_sendout(CTRL_PATH_RESPONSE, nonce, from);
+	}
+	else if (m_path_old_nonce&&nonce==m_path_old_nonce&&from==m_remote_endpoint)
+	{
+		__end_path_challenge(now, PATH_REFUSED_INTERVAL);
+	}
+	else if (m_path_nonce&&nonce==m_path_nonce&&from==m_path_candidate
+		&&!b_path_validated_)
+	{
+		//moved to when the challenge of the old endpoint times out
+		b_path_validated_=true;
+		m_t_path_challenge=scape_zero(now+m_rto);
+	}
+}
+
+void urdp_flow::__send_path_challenge(time32_type now)
+{
+	++m_path_challenge_cnt;
+	__packet_path_and_sendout(CTRL_PATH_CHALLENGE, m_path_nonce, m_path_candidate);
+	__packet_path_and_sendout(CTRL_PATH_CHALLENGE, m_path_old_nonce, m_remote_endpoint);
+	m_t_path_challenge=scape_zero(now+m_rto);
+}
+
+void urdp_flow::__packet_path_and_sendout(uint8_t control, uint32_t nonce, 
+										  const endpoint_type& to)
+{
+	BOOST_ASSERT(m_self_holder);
+
+	double remoteToLocalLostrate=(remote_to_local_lost_rate_<0.0?0.0:remote_to_local_lost_rate_);
+
+	const size_t format_size=packet_format_type::format_size();
+	safe_buffer buf(format_size+4);
+
+	//like a probe of path MTU, it does not take an id of lost rate detection
+	packet<packet_format_type> urdp_header(buf,true);
+	urdp_header.set_control(control);
+	urdp_header.set_peer_id(m_remote_peer_id);
+	urdp_header.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
+	urdp_header.set_id_for_lost_detect((int8_t)(id_for_lost_rate_-1));
+	urdp_header.set_session_id(m_session_id);
+	urdp_header.set_window(__window_field(control));
+	char* p=buffer_cast<char*>(buf)+format_size;
+	write_uint32_hton(nonce, p);
+
+	error_code ec;
+	m_token->shared_layer->async_send_to(buf, to, ec);
+	out_speed_meter_+=buf.size();
+}
+
+void urdp_flow::__migrate(time32_type now)
+{
+	//only the port changes on a NAT rebinding, the path and so what the 
+	//congestion controller and PMTU discovery have learned stays; a new 
+	//address is a new path and they start over
+	bool newAddress=(m_path_candidate.address()!=m_remote_endpoint.address());
+	m_remote_endpoint=m_path_candidate;
+	__end_path_challenge(now, PATH_CHALLENGE_INTERVAL);
+	m_t_lasttraffic=m_t_lastrecv=now;
+	if (newAddress)
+	{
+		m_cc.reset(urdp_congestion_controller::create(m_cc->type(), m_mss, 
+			2*m_mss, RECV_BUF_SIZE));
+		__start_pmtu_discovery(now);
+	}
+
+	//what was sent to the old endpoint is likely lost
+	if (!m_retrans_slist.empty()&&!__transmit(m_retrans_slist.begin(), now))
+	{
+		__allert_disconnected(asio::error::timed_out);
+		return;
+	}
+	__attempt_send(sfImmediateAck);
+	__schedule_timer(now);
+}
+
+void urdp_flow::__send_fec(SUnraliableSegment& seg, time32_type now)
+{
+	if (m_fec_encoder.empty())
+	{
+		m_fec_encoder.open(urdp_fec_encoder::group_size(local_to_remote_lost_rate()));
+		m_t_fec_flush=scape_zero(now+FEC_FLUSH_DELAY);
+	}
+	seg.control=CTRL_FEC_DATA;
+	seg.remainXmit=1;
+	__packet_as_unreliable_and_sendout(seg, now);
+	m_fec_encoder.add(seg.pktID, seg.msgType, seg.buf);
+	if (m_fec_encoder.full())
+		__packet_fec_parity_and_sendout(now);
+}
+
+void urdp_flow::__packet_fec_parity_and_sendout(time32_type now)
+{
+	BOOST_ASSERT(m_self_holder);
+
+	m_t_fec_flush=0;
+	if (m_fec_encoder.empty())
+		return;
+
+	double remoteToLocalLostrate=(remote_to_local_lost_rate_<0.0?0.0:remote_to_local_lost_rate_);
+
+	const size_t format_size=unreliable_packet_format_type::format_size();
+	const std::vector<char>& parity=m_fec_encoder.parity();
+	safe_buffer buf(format_size+4+parity.size());
+
+	packet<unreliable_packet_format_type> urdp_header(buf,true);
+	urdp_header.set_control(CTRL_FEC_PARITY);
+	urdp_header.set_peer_id(m_remote_peer_id);
+	urdp_header.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
+	urdp_header.set_id_for_lost_detect(id_for_lost_rate_++);
+	urdp_header.set_session_id(m_session_id);
+	urdp_header.set_window(__window_field(CTRL_FEC_PARITY));
+
+	char* p=buffer_cast<char*>(buf)+format_size;
+	write_uint16_hton(m_fec_encoder.group(), p);
+	write_uint8(m_fec_encoder.count(), p);
+	write_uint8(m_fec_encoder.count(), p);
+	memcpy(p, &parity[0], parity.size());
+
+	error_code ec;
+	m_token->shared_layer->async_send_to(buf, m_remote_endpoint, ec);
+	out_speed_meter_+=buf.size();
+	m_t_lasttraffic=m_t_lastsend = now;
+
+	m_fec_encoder.close();
+}
+
+void urdp_flow::__process_fec(int ctrlType, const safe_buffer& pkt, time32_type now)
+{
+	const size_t format_size=unreliable_packet_format_type::format_size();
+	const char* p=buffer_cast<const char*>(pkt)+format_size;
+	uint16_t group=read_uint16_ntoh(p);
+	uint8_t index=read_uint8(p);
+	uint8_t count=read_uint8(p);
+
+	safe_buffer recovered;
+	bool ok;
+	if (CTRL_FEC_DATA==ctrlType)
+	{
+		if (pkt.size()<format_size+8)
+			return;
+		//the data packets are sent once, one that comes after it has been
+		//recovered is left out by the decoder
+		safe_buffer body=pkt.buffer_ref(format_size+4);
+		bool duplicated;
+		ok=m_fec_decoder.on_data(group, index, body, now, recovered, duplicated);
+		if (!duplicated)
+			__deliver_unreliable(body, false);
+	}
+	else
+	{
+		ok=m_fec_decoder.on_parity(group, count, pkt.buffer_ref(format_size+4),
+			now, recovered);
+	}
+	if (ok)
+		__deliver_unreliable(recovered, false);
+}
+
+void urdp_flow::__deliver_unreliable(const safe_buffer& pkt, bool dedup)
+{
+	//pkt is [pktID|msgType|payload], which __recv reads. The semireliable
+	//ones may arrive more than once.
+	if (dedup)
+	{
+		const char* p=buffer_cast<const char*>(pkt);
+		uint16_t id=read_uint16_ntoh(p);
+		if (!m_unreliable_rkeeper.try_keep(id, seconds(8)))
+			return;
+	}
+	m_unreliable_rlist.push_back(pkt);
+	__allert_readable();
+}
+
+void urdp_flow::__send_unreliable(SUnraliableSegment& seg, time32_type now)
+{
+	if (b_bundling_&&(m_caps&CAP_BUNDLE)
+		&&seg.buf.size()+BUNDLE_HEADER_SIZE<=m_mss/2)
+	{
+		__bundle(seg, now);
+	}
+	else
+	{
+		__packet_as_unreliable_and_sendout(seg, now);
+	}
+}
+
+void urdp_flow::__bundle(SUnraliableSegment& seg, time32_type now)
+{
+	const size_t format_size=unreliable_packet_format_type::format_size();
+	std::size_t subLen=BUNDLE_HEADER_SIZE+seg.buf.size();
+	//4 bytes are kept for a bundled ACK
+	if (m_bundle_len&&m_bundle_len+subLen+4>m_bundle.size())
+		__packet_bundle_and_sendout(now);
+	if (!m_bundle_len)
+	{
+		m_bundle=safe_buffer(format_size+m_mss+4);
+		m_bundle_len=format_size;
+		if (m_bundle_delay)
+		{
+			m_t_bundle_flush=scape_zero(now+m_bundle_delay);
+		}
+		else if (!b_bundle_posted_)
+		{
+			//sent when the handler that is running returns
+			b_bundle_posted_=true;
+			get_io_service().post(boost::bind(&this_type::__on_bundle_flush, 
+				SHARED_OBJ_FROM_THIS VC9_BIND_BUG_PARAM_DUMMY)
+				);
+		}
+	}
+
+	uint16_t len=(uint16_t)seg.buf.size();
+	if (seg.control==CTRL_SEMIRELIABLE_DATA)
+		len|=BUNDLE_SEMIRELIABLE;
+	char* p=buffer_cast<char*>(m_bundle)+m_bundle_len;
+	write_uint16_hton(len, p);
+	write_uint16_hton((uint16_t)seg.pktID, p);
+	write_uint16_hton((uint16_t)seg.msgType, p);
+	memcpy(p, buffer_cast<const char*>(seg.buf), seg.buf.size());
+	m_bundle_len+=subLen;
+
+	seg.remainXmit--;
+	seg.timeout=now+random(10, 30);
+}
+
+void urdp_flow::__on_bundle_flush(VC9_BIND_BUG_PARAM_DECLARE)
+{
+	b_bundle_posted_=false;
+	if (m_state==ESTABLISHED&&m_bundle_len&&!m_t_bundle_flush)
+		__packet_bundle_and_sendout(tick_now());
+}
+
+void urdp_flow::__packet_bundle_and_sendout(time32_type now)
+{
+	BOOST_ASSERT(m_self_holder);
+
+	m_t_bundle_flush=0;
+	if (!m_bundle_len)
+		return;
+
+	double remoteToLocalLostrate=(remote_to_local_lost_rate_<0.0?0.0:remote_to_local_lost_rate_);
+
+	packet<unreliable_packet_format_type> urdp_header(m_bundle,true);
+	const bool bundleAck=(m_t_ack&&(m_caps&CAP_ACK_FREQUENCY));
+	urdp_header.set_control(bundleAck?(CTRL_BUNDLE|CTRL_FLAG_ACK):CTRL_BUNDLE);
+	urdp_header.set_peer_id(m_remote_peer_id);
+	urdp_header.set_lostrate_recving(uint32_t(remoteToLocalLostrate/LOST_RATE_PRECISION));
+	urdp_header.set_id_for_lost_detect(id_for_lost_rate_++);
+	urdp_header.set_session_id(m_session_id);
+	urdp_header.set_window(__window_field(CTRL_BUNDLE));
+
+	if (bundleAck)
+	{
+		char* p=buffer_cast<char*>(m_bundle)+m_bundle_len;
+		write_uint32_hton(m_rcv_nxt, p);
+		m_bundle_len+=4;
+
+		m_lastack = m_rcv_nxt;
+		m_t_ack = 0;
+		m_delayed_segs = 0;
+	}
+
+	error_code ec;
+	m_token->shared_layer->async_send_to(m_bundle.buffer_ref(0, m_bundle_len), 
+		m_remote_endpoint, ec);
+	out_speed_meter_+=m_bundle_len;
+	m_t_lasttraffic=m_t_lastsend = now;
+
+	m_bundle.reset();
+	m_bundle_len=0;
+}
+
+bool urdp_flow::__process_bundle(const safe_buffer& pkt)
+{
+	//the whole packet is checked before any message is delivered
+	const size_t format_size=unreliable_packet_format_type::format_size();
+	const char* data=buffer_cast<const char*>(pkt);
+	std::size_t pos=format_size;
+	while (pos<pkt.size())
+	{
+		if (pos+BUNDLE_HEADER_SIZE>pkt.size())
+			return false;
+		const char* p=data+pos;
+		std::size_t len=(read_uint16_ntoh(p)&BUNDLE_LENGTH_MASK);
+		pos+=BUNDLE_HEADER_SIZE+len;
+	}
+	if (pos!=pkt.size()||pos==format_size)
+		return false;
+
+	pos=format_size;
+	while (pos<pkt.size()&&m_socket&&ESTABLISHED==m_state)
+	{
+		const char* p=data+pos;
+		uint16_t len=read_uint16_ntoh(p);
+		bool semireliable=((len&BUNDLE_SEMIRELIABLE)!=0);
+		len&=BUNDLE_LENGTH_MASK;
+		//the messages after it in the datagram are still queued, a write to
+		//the slice goes to a new buffer instead of over them
+		safe_buffer msg=pkt.buffer_ref(pos+2, 4+len);
+		msg.limit_capacity();
+		__deliver_unreliable(msg, semireliable);
+		pos+=BUNDLE_HEADER_SIZE+len;
+	}
+	return true;
+}
+
+void urdp_flow::bundling(bool enable, const time_duration& delay)
+{
+	m_bundle_delay=(time32_type)std::max<int64_t>(delay.total_milliseconds(), 0);
+	if (b_bundling_==enable)
+		return;
+	b_bundling_=enable;
+	if (!enable&&m_state==ESTABLISHED)
+		__packet_bundle_and_sendout(tick_now());
+}
+
+void urdp_flow::ack_frequency(uint32_t segments, double rttFraction)
+{
+	m_ack_freq_segs=segments;
+	m_ack_freq_rtt=(segments?rttFraction:0.0);
+}
+
+uint16_t urdp_flow::__ack_frequency_field()const
+{
+	if (!m_ack_freq_segs)
+		return 0;
+
+	//never so few ACKs that the window stalls waiting for them
+	uint32_t cwndSegs=m_cc->cwnd()/m_mss;
+	uint32_t segs=std::min(m_ack_freq_segs, std::max(DEFAULT_ACK_EVERY, cwndSegs/2));
+	segs=std::min(segs, MAX_ACK_FREQUENCY_SEGS);
+
+	time32_type delay=0;//the default of the remote
+	if (m_ack_freq_rtt>0.0&&m_srtt>0)
+	{
+		delay=(time32_type)(m_srtt*m_ack_freq_rtt);
+		delay=std::min(delay, std::min(m_rto/2, MAX_ACK_FREQUENCY_DELAY));
+		delay=std::max(delay, (time32_type)1);
+	}
+	return (uint16_t)((segs<<ACK_FREQUENCY_DELAY_BITS)|delay);
+}
+
+void urdp_flow::__apply_ack_frequency(uint16_t field)
+{
+	uint32_t segs=(field>>ACK_FREQUENCY_DELAY_BITS);
+	time32_type delay=(field&MAX_ACK_FREQUENCY_DELAY);
+	m_ack_every=(segs?segs:DEFAULT_ACK_EVERY);
+	m_ack_delay=(delay?delay:ACK_DELAY);
+}
+
+void urdp_flow::fec(message_type msgType, bool enable)
+{
+	if (enable)
+		m_fec_msg_types.insert(msgType);
+	else
+		m_fec_msg_types.erase(msgType);
+}
+
 void urdp_flow::__incress_rto()
 {
 	// Back off retransmit timer. Note: the limit is lower when connecting.
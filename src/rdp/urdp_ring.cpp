@@ -0,0 +1,156 @@
+#include "p2engine/push_warning_option.hpp"
+#include <cstring>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/rdp/urdp_ring.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(urdp);
+
+namespace
+{
+	//seq arithmetic, seqs wrap
+	inline int32_t seq_minus(uint32_t a, uint32_t b)
+	{
+		return (int32_t)(a-b);
+	}
+	inline bool seq_less(uint32_t a, uint32_t b)
+	{
+		return seq_minus(a, b)<0;
+	}
+}
+
+urdp_recv_ring::urdp_recv_ring()
+	:head_(0),base_(0)
+{
+}
+
+void urdp_recv_ring::rebase(uint32_t seq)
+{
+	//nothing is held, base can be anywhere
+	if (blocks_.empty())
+	{
+		base_=seq;
+		return;
+	}
+	int32_t d=seq_minus(seq, base_);
+	if (d<=0)
+		return;
+	if ((std::size_t)d>=buf_.size())
+	{
+		blocks_.clear();
+		base_=seq;
+		return;
+	}
+	head_=(head_+d)&(buf_.size()-1);
+	base_=seq;
+	while (!blocks_.empty()&&seq_less(blocks_.front().first, seq))
+	{
+		if (seq_less(seq, blocks_.front().second))
+			blocks_.front().first=seq;
+		else
+			blocks_.erase(blocks_.begin());
+	}
+}
+
+void urdp_recv_ring::__reserve(std::size_t len)
+{
+	if (len<=buf_.size())
+		return;
+	std::size_t cap=(buf_.empty()?(std::size_t)INIT_CAPACITY:buf_.size());
+	while (cap<len)
+		cap*=2;
+
+	//linearize, with base at 0
+	std::vector<char> buf(cap);
+	if (!buf_.empty())
+	{
+		std::size_t tail=buf_.size()-head_;
+		memcpy(&buf[0], &buf_[head_], tail);
+		if (head_)
+			memcpy(&buf[tail], &buf_[0], head_);
+	}
+	buf_.swap(buf);
+	head_=0;
+}
+
+std::size_t urdp_recv_ring::write(uint32_t seq, const char* data, std::size_t len,
+								  uint32_t rcvNxt)
+{
+	if (len==0||seq_less(seq, rcvNxt)||seq_less(rcvNxt, base_))
+		return 0;
+
+	//a stale or forged seq must not grow the ring without a bound
+	std::size_t offset=(std::size_t)seq_minus(seq, base_);
+	if (offset>=MAX_CAPACITY||len>MAX_CAPACITY-offset)
+		return 0;
+	__reserve(offset+len);
+	std::size_t mask=buf_.size()-1;
+	std::size_t pos=(head_+offset)&mask;
+	std::size_t first=std::min(len, buf_.size()-pos);
+	memcpy(&buf_[pos], data, first);
+	if (first<len)
+		memcpy(&buf_[0], data+first, len-first);
+
+	//merge [seq, segEnd) into the blocks, counting the bytes held before
+	const uint32_t segEnd=seq+(uint32_t)len;
+	uint32_t begin=seq, end=segEnd;
+	std::size_t held=0;
+	block_list::iterator itr=blocks_.begin();
+	while (itr!=blocks_.end()&&seq_less(itr->second, begin))
+		++itr;
+	while (itr!=blocks_.end()&&!seq_less(end, itr->first))
+	{
+		uint32_t overlapBegin=(seq_less(seq, itr->first)?itr->first:seq);
+		uint32_t overlapEnd=(seq_less(itr->second, segEnd)?itr->second:segEnd);
+		if (seq_less(overlapBegin, overlapEnd))
+			held+=seq_minus(overlapEnd, overlapBegin);
+		if (seq_less(itr->first, begin))
+			begin=itr->first;
+		if (seq_less(end, itr->second))
+			end=itr->second;
+		itr=blocks_.erase(itr);
+	}
+	blocks_.insert(itr, block_type(begin, end));
+	return len-held;
+}
+
+uint32_t urdp_recv_ring::advance(uint32_t rcvNxt)
+{
+	while (!blocks_.empty()&&!seq_less(rcvNxt, blocks_.front().first))
+	{
+		if (seq_less(rcvNxt, blocks_.front().second))
+			rcvNxt=blocks_.front().second;
+		blocks_.erase(blocks_.begin());
+	}
+	return rcvNxt;
+}
+
+void urdp_recv_ring::peek(char* out, std::size_t len)const
+{
+	BOOST_ASSERT(len<=buf_.size());
+	if (len==0)
+		return;
+	std::size_t first=std::min(len, buf_.size()-head_);
+	memcpy(out, &buf_[head_], first);
+	if (first<len)
+		memcpy(out+first, &buf_[0], len-first);
+}
+
+void urdp_recv_ring::read(char* out, std::size_t len)
+{
+	peek(out, len);
+	if (len)
+		head_=(head_+len)&(buf_.size()-1);
+	base_+=(uint32_t)len;
+}
+
+void urdp_recv_ring::clear()
+{
+	std::vector<char>().swap(buf_);
+	head_=0;
+	blocks_.clear();
+}
+
+NAMESPACE_END(urdp);
+NAMESPACE_END(p2engine);
@@ -0,0 +1,77 @@
+#include "p2engine/rdp/urdp_session_cache.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(urdp);
+
+urdp_session_cache::urdp_session_cache(std::size_t maxSize, long lifetime)
+	:max_size_(maxSize)
+	,lifetime_(lifetime)
+{
+	BOOST_ASSERT(max_size_>0);
+}
+
+void urdp_session_cache::put(const endpoint& edp, const std::string& domain, 
+							 const urdp_session_ticket& ticket)
+{
+	fast_mutex::scoped_lock lock(mutex_);
+	key_type key(edp, domain);
+	entry_map::iterator itr=index_.find(key);
+	if (itr!=index_.end())
+		__erase(itr);
+	else if (index_.size()>=max_size_)
+		__erase(index_.find(entries_.back().key));
+
+	entry e;
+	e.key=key;
+	e.ticket=ticket;
+	e.expiry=system_time::tick_count()+lifetime_;
+	entries_.push_front(e);
+	index_.insert(std::make_pair(key, entries_.begin()));
+}
+
+bool urdp_session_cache::get(const endpoint& edp, const std::string& domain, 
+							 urdp_session_ticket& ticket)
+{
+	fast_mutex::scoped_lock lock(mutex_);
+	entry_map::iterator itr=index_.find(key_type(edp, domain));
+	if (itr==index_.end())
+		return false;
+	if (itr->second->expiry<=system_time::tick_count())
+	{
+		__erase(itr);
+		return false;
+	}
+	ticket=itr->second->ticket;
+	entries_.splice(entries_.begin(), entries_, itr->second);
+	return true;
+}
+
+void urdp_session_cache::erase(const endpoint& edp, const std::string& domain)
+{
+	fast_mutex::scoped_lock lock(mutex_);
+	entry_map::iterator itr=index_.find(key_type(edp, domain));
+	if (itr!=index_.end())
+		__erase(itr);
+}
+
+void urdp_session_cache::clear()
+{
+	fast_mutex::scoped_lock lock(mutex_);
+	index_.clear();
+	entries_.clear();
+}
+
+std::size_t urdp_session_cache::size()const
+{
+	fast_mutex::scoped_lock lock(mutex_);
+	return index_.size();
+}
+
+void urdp_session_cache::__erase(entry_map::iterator itr)
+{
+	entries_.erase(itr->second);
+	index_.erase(itr);
+}
+
+NAMESPACE_END(urdp);
+NAMESPACE_END(p2engine);
@@ -0,0 +1,285 @@
+#include "p2engine/push_warning_option.hpp"
+#include <algorithm>
+#include <boost/bind.hpp>
+#include "p2engine/pop_warning_option.hpp"
+
+#include "p2engine/rdp/urdp_timing_wheel.hpp"
+
+NAMESPACE_BEGIN(p2engine);
+NAMESPACE_BEGIN(urdp);
+
+namespace
+{
+	//level_ of a timer that is due and taken out of its slot
+	const int LEVEL_DUE=-1;
+
+	inline void init_head(urdp_wheel_hook* head)
+	{
+		head->prev_=head->next_=head;
+	}
+	inline bool empty_list(const urdp_wheel_hook* head)
+	{
+		return head->next_==head;
+	}
+	//moves all of from to the empty to
+	inline void splice(urdp_wheel_hook* from, urdp_wheel_hook* to)
+	{
+		BOOST_ASSERT(empty_list(to));
+		if (empty_list(from))
+			return;
+		to->next_=from->next_;
+		to->prev_=from->prev_;
+		to->next_->prev_=to;
+		to->prev_->next_=to;
+		init_head(from);
+	}
+}
+
+urdp_wheel_timer::urdp_wheel_timer(io_service& ios)
+	:wheel_(&boost::asio::use_service<urdp_timing_wheel>(ios))
+	,expiry_(0)
+	,level_(LEVEL_DUE)
+{
+}
+
+urdp_wheel_timer::~urdp_wheel_timer()
+{
+	cancel();
+}
+
+void urdp_wheel_timer::async_wait(long msec)
+{
+	if (wheel_)
+		wheel_->__arm(this, urdp_timing_wheel::tick_now()+msec);
+}
+
+void urdp_wheel_timer::cancel()
+{
+	if (!is_idle()&&wheel_)
+		wheel_->__cancel(this);
+}
+
+long urdp_wheel_timer::expires_from_now()const
+{
+	return (long)(expiry_-urdp_timing_wheel::tick_now());
+}
+
+urdp_timing_wheel::urdp_timing_wheel(io_service& ios)
+	:boost::asio::detail::service_base<urdp_timing_wheel>(ios)
+	,cur_(tick_now())
+	,size_(0)
+	,root_size_(0)
+	,timer_(ios)
+	,timer_due_(0)
+	,timer_armed_(false)
+{
+	for (std::size_t i=0;i<ROOT_SIZE;++i)
+		init_head(&root_[i]);
+	for (int level=0;level<LEVELS-1;++level)
+	{
+		for (std::size_t i=0;i<LEVEL_SIZE;++i)
+			init_head(&levels_[level][i]);
+	}
+}
+
+urdp_timing_wheel::~urdp_timing_wheel()
+{
+	BOOST_ASSERT(size_==0);
+}
+
+void urdp_timing_wheel::shutdown_service()
+{
+	//the timers may outlive the wheel(in the handlers the io_service destroys),
+	//they are left idle and detached
+	for (std::size_t i=0;i<ROOT_SIZE;++i)
+		__detach_all(&root_[i]);
+	for (int level=0;level<LEVELS-1;++level)
+	{
+		for (std::size_t i=0;i<LEVEL_SIZE;++i)
+			__detach_all(&levels_[level][i]);
+	}
+	size_=root_size_=0;
+	error_code ec;
+	timer_.cancel(ec);
+}
+
+void urdp_timing_wheel::__detach_all(urdp_wheel_hook* head)
+{
+	while (!empty_list(head))
+	{
+		urdp_wheel_timer* t=static_cast<urdp_wheel_timer*>(head->next_);
+		head->next_=t->next_;
+		t->prev_=t->next_=NULL;
+		t->wheel_=NULL;
+	}
+	init_head(head);
+}
+
+void urdp_timing_wheel::__push_back(urdp_wheel_hook* head, urdp_wheel_hook* h)
+{
+	h->next_=head;
+	h->prev_=head->prev_;
+	head->prev_->next_=h;
+	head->prev_=h;
+}
+
+void urdp_timing_wheel::__unlink(urdp_wheel_hook* h)
+{
+	h->prev_->next_=h->next_;
+	h->next_->prev_=h->prev_;
+	h->prev_=h->next_=NULL;
+}
+
+void urdp_timing_wheel::__arm(urdp_wheel_timer* t, tick_type expiry)
+{
+	__cancel(t);
+	t->expiry_=expiry;
+	__link(t);
+	__schedule_tick(std::max(expiry, cur_));
+}
+
+void urdp_timing_wheel::__cancel(urdp_wheel_timer* t)
+{
+	if (t->is_idle())
+		return;
+	__unlink(t);
+	if (t->level_!=LEVEL_DUE)
+	{
+		BOOST_ASSERT(size_>0);
+		--size_;
+		if (t->level_==0)
+			--root_size_;
+	}
+	t->level_=LEVEL_DUE;
+}
+
+void urdp_timing_wheel::__link(urdp_wheel_timer* t)
+{
+	//a timer that is already due runs in the next msec of the wheel
+	tick_type expiry=std::max(t->expiry_, cur_);
+	tick_type idx=expiry-cur_;
+	++size_;
+	if (idx<ROOT_SIZE)
+	{
+		t->level_=0;
+		++root_size_;
+		__push_back(&root_[expiry&ROOT_MASK], t);
+		return;
+	}
+
+	int level=1;
+	int shift=ROOT_BITS;
+	while (level<LEVELS-1&&idx>=((tick_type)1<<(shift+LEVEL_BITS)))
+	{
+		++level;
+		shift+=LEVEL_BITS;
+	}
+	//beyond the wheel, it is put in the farthest slot and cascaded again
+	if (idx>=((tick_type)1<<(shift+LEVEL_BITS)))
+		expiry=cur_+((tick_type)1<<(shift+LEVEL_BITS))-1;
+	t->level_=level;
+	__push_back(&levels_[level-1][(expiry>>shift)&LEVEL_MASK], t);
+}
+
+void urdp_timing_wheel::__cascade(int level, std::size_t slot)
+{
+	urdp_wheel_hook cascading;
+	init_head(&cascading);
+	splice(&levels_[level-1][slot], &cascading);
+	while (!empty_list(&cascading))
+	{
+		urdp_wheel_timer* t=static_cast<urdp_wheel_timer*>(cascading.next_);
+		__unlink(t);
+		--size_;
+		__link(t);
+	}
+}
+
+void urdp_timing_wheel::__advance(tick_type now)
+{
+	while (cur_<=now)
+	{
+		if (size_==0)
+		{
+			cur_=now+1;
+			break;
+		}
+		//nothing in the root wheel, skip to the next cascade
+		if (root_size_==0&&(cur_&ROOT_MASK)!=0)
+		{
+			cur_=std::min<tick_type>(cur_|ROOT_MASK, now)+1;
+			continue;
+		}
+
+		tick_type tick=cur_;
+		if ((tick&ROOT_MASK)==0)
+		{
+			int shift=ROOT_BITS;
+			for (int level=1;level<LEVELS;++level, shift+=LEVEL_BITS)
+			{
+				std::size_t slot=(std::size_t)((tick>>shift)&LEVEL_MASK);
+				__cascade(level, slot);
+				if (slot!=0)
+					break;
+			}
+		}
+		cur_=tick+1;//timers armed by the handlers go after this msec
+
+		urdp_wheel_hook due;
+		init_head(&due);
+		splice(&root_[tick&ROOT_MASK], &due);
+		for (urdp_wheel_hook* h=due.next_;h!=&due;h=h->next_)
+		{
+			static_cast<urdp_wheel_timer*>(h)->level_=LEVEL_DUE;
+			--size_;
+			--root_size_;
+		}
+		//a handler may cancel(or destroy) the other timers in due
+		while (!empty_list(&due))
+		{
+			urdp_wheel_timer* t=static_cast<urdp_wheel_timer*>(due.next_);
+			__unlink(t);
+			if (t->handler_)
+				t->handler_();
+		}
+	}
+}
+
+void urdp_timing_wheel::__schedule_tick(tick_type due)
+{
+	if (timer_armed_&&timer_due_<=due)
+		return;
+	timer_due_=due;
+	timer_armed_=true;
+	error_code ec;
+	timer_.expires_from_now(milliseconds(std::max<tick_type>(due-tick_now(), 0)), ec);
+	timer_.async_wait(boost::bind(&this_type::__on_tick, this, _1));
+}
+
+void urdp_timing_wheel::__on_tick(const error_code& ec)
+{
+	if (ec)//rearmed for an earlier tick, or shut down
+		return;
+	timer_armed_=false;
+	__advance(tick_now());
+	if (size_==0)
+		return;
+
+	//the first root slot that is not empty, or the next cascade
+	tick_type due=(cur_|ROOT_MASK)+1;
+	if (root_size_)
+	{
+		for (tick_type tick=cur_;tick<due;++tick)
+		{
+			if (!empty_list(&root_[tick&ROOT_MASK]))
+			{
+				due=tick;
+				break;
+			}
+		}
+	}
+	__schedule_tick(due);
+}
+
+NAMESPACE_END(urdp);
+NAMESPACE_END(p2engine);
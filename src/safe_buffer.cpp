@@ -6,7 +6,12 @@ namespace p2engine{
 	//////////////////////////////////////////////////////////////////////////
 	void safe_buffer_base::clear()
 	{
-		if (raw_buffer_)
+		if (raw_buffer_&&e_ptr_)
+		{
+			//the bytes before a slice are not its own
+			pptr(gptr());
+		}
+		else if (raw_buffer_)
 		{
 			gptr(raw_buffer_ptr());
 			pptr(raw_buffer_ptr());
@@ -27,6 +32,7 @@ namespace p2engine{
 			raw_buffer_ = raw_buffer::create(len);
 			gptr(raw_buffer_ptr());
 			pptr(raw_buffer_ptr());
+			e_ptr_=NULL;
 			BOOST_ASSERT(gptr()&&pptr());
 		}
 	}
@@ -0,0 +1,274 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/fssignal.hpp>
+#include <p2engine/rdp.hpp>
+
+using namespace p2engine;
+using urdp::network_conditions;
+using urdp::basic_shared_udp_layer;
+
+//throughput benchmark of urdp and trdp on loopback. In each run a client
+//sends TOTAL_MSGS reliable messages, keeping at most MAX_INFLIGHT bytes that
+//the server has not received, and the run reports goodput, the p50/p99
+//latency of a message(from async_send_reliable to received_signal), the
+//ratio of retransmitted bytes and the process CPU time per MB received.
+//urdp runs on each of the simulated paths of SCENARIOS(in both directions,
+//see basic_shared_udp_layer::simulate_network); trdp runs over the TCP of
+//the kernel, which the simulator can not reach, so it only runs on loopback
+//as the baseline.
+
+std::string domain="/p2p/bench";
+
+enum{
+	BENCH_MSG=1
+};
+
+enum{
+	MSG_SIZE=1024,
+	TOTAL_MSGS=4096,
+	MAX_INFLIGHT=1024*1024,
+	RUN_TIMEOUT=60,//seconds
+	BASE_PORT=8901
+};
+
+struct scenario
+{
+	const char* name;
+	double loss_rate;
+	double reorder_rate;
+	long delay_msec;//one way
+	long jitter_msec;
+	double bandwidth;
+	std::size_t queue_bytes;
+};
+
+const scenario SCENARIOS[]={
+	{"loopback",         0.0,  0.0,  0, 0, 0.0,   0},
+	{"1% loss, 1ms",     0.01, 0.0,  1, 0, 0.0,   0},
+	{"wan 40ms rtt",     0.0,  0.01, 20, 5, 10e6, 512*1024},
+	{"lossy wan",        0.03, 0.02, 20, 5, 5e6,  256*1024}
+};
+const std::size_t SCENARIO_CNT=sizeof(SCENARIOS)/sizeof(SCENARIOS[0]);
+
+inline int64_t now_usec()
+{
+	static boost::posix_time::ptime epoch=
+		boost::posix_time::microsec_clock::universal_time();
+	return (boost::posix_time::microsec_clock::universal_time()-epoch)
+		.total_microseconds();
+}
+
+//-1 if the transport does not tell it
+inline double retransmission_ratio(const urdp_connection& conn)
+{
+	if (conn.sent_bytes()==0)
+		return 0.0;
+	return (double)conn.retransmitted_bytes()/(double)conn.sent_bytes();
+}
+inline double retransmission_ratio(const trdp_connection&)
+{
+	return -1.0;
+}
+
+struct bench_result
+{
+	bench_result():received(0),seconds(0.0),p50_usec(0),p99_usec(0)
+		,rexmit_ratio(0.0),cpu_sec_per_mb(0.0){}
+
+	int received;
+	double seconds;
+	int64_t p50_usec, p99_usec;
+	double rexmit_ratio;
+	double cpu_sec_per_mb;
+};
+
+template<typename Connection, typename Acceptor>
+class bench_run
+	:public fssignal::trackable
+{
+	typedef bench_run<Connection, Acceptor> this_type;
+
+public:
+	bench_run(io_service& ios, int port)
+		:ios_(ios),port_(port),sent_(0),received_(0),t_start_(0),t_end_(0)
+	{
+		latencies_.reserve(TOTAL_MSGS);
+	}
+
+	bench_result run()
+	{
+		acceptor_=Acceptor::create(ios_,false);
+		acceptor_->accepted_signal().bind(&this_type::on_accepted,this,_1,_2);
+		error_code ec;
+		acceptor_->listen(server_endpoint(),domain,ec);
+		if (ec)
+		{
+			std::cout<<"listen error:"<<ec.message()<<std::endl;
+			return bench_result();
+		}
+		acceptor_->keep_async_accepting();
+
+		client_=Connection::create(ios_,false);
+		client_->connected_signal().bind(&this_type::on_connected,this,_1);
+		client_->async_connect(server_endpoint(),domain);
+
+		rough_timer::shared_ptr timeout=rough_timer::create(ios_);
+		timeout->time_signal().bind(&io_service::stop,&ios_);
+		timeout->async_wait(seconds((int)RUN_TIMEOUT));
+
+		std::clock_t cpu=std::clock();
+		ios_.run();
+		cpu=std::clock()-cpu;
+
+		bench_result result;
+		result.received=received_;
+		if (received_>0&&t_end_>t_start_)
+		{
+			double mb=(double)received_*MSG_SIZE/(1024.0*1024.0);
+			result.seconds=(double)(t_end_-t_start_)/1e6;
+			result.cpu_sec_per_mb=(double)cpu/CLOCKS_PER_SEC/mb;
+			std::sort(latencies_.begin(),latencies_.end());
+			result.p50_usec=latencies_[latencies_.size()*50/100];
+			result.p99_usec=latencies_[latencies_.size()*99/100];
+		}
+		result.rexmit_ratio=retransmission_ratio(*client_);
+		client_->close(false);
+		if (server_socket_)
+			server_socket_->close(false);
+		acceptor_->close(ec);
+		return result;
+	}
+
+private:
+	endpoint server_endpoint()const
+	{
+		return endpoint(address(address_v4::loopback()),port_);
+	}
+
+	void on_accepted(boost::shared_ptr<basic_connection> socket,const error_code& ec)
+	{
+		if (ec)
+			return;
+		server_socket_=socket;
+		server_socket_->received_signal(BENCH_MSG).bind(&this_type::on_received,this,_1);
+	}
+
+	void on_connected(const error_code& ec)
+	{
+		if (ec)
+		{
+			std::cout<<"connect error:"<<ec.message()<<std::endl;
+			ios_.stop();
+			return;
+		}
+		t_start_=now_usec();
+		pump();
+	}
+
+	void pump()
+	{
+		while (sent_<TOTAL_MSGS&&(sent_-received_)*MSG_SIZE<MAX_INFLIGHT)
+		{
+			safe_buffer buf(MSG_SIZE);
+			int64_t t=now_usec();
+			memcpy(buffer_cast<char*>(buf),&t,sizeof(t));
+			client_->async_send_reliable(buf,BENCH_MSG);
+			++sent_;
+		}
+	}
+
+	void on_received(safe_buffer buf)
+	{
+		if (buf.size()!=MSG_SIZE)
+			return;
+		int64_t t;
+		memcpy(&t,buffer_cast<const char*>(buf),sizeof(t));
+		int64_t now=now_usec();
+		latencies_.push_back(now-t);
+		if (++received_==TOTAL_MSGS)
+		{
+			t_end_=now;
+			ios_.stop();
+			return;
+		}
+		pump();
+	}
+
+private:
+	io_service& ios_;
+	int port_;
+	boost::shared_ptr<Acceptor> acceptor_;
+	boost::shared_ptr<Connection> client_;
+	boost::shared_ptr<basic_connection> server_socket_;
+	int sent_, received_;
+	int64_t t_start_, t_end_;
+	std::vector<int64_t> latencies_;
+};
+
+void print_result(const char* transport, const char* name, const bench_result& r)
+{
+	double goodput=(r.seconds>0.0?(double)r.received*MSG_SIZE/r.seconds/1e6:0.0);
+	std::cout<<std::left<<std::setw(6)<<transport<<std::setw(16)<<name
+		<<std::right<<std::fixed<<std::setprecision(2)
+		<<" goodput:"<<std::setw(8)<<goodput<<" MB/s"
+		<<"  p50:"<<std::setw(8)<<r.p50_usec/1000.0<<" ms"
+		<<"  p99:"<<std::setw(8)<<r.p99_usec/1000.0<<" ms";
+	if (r.rexmit_ratio>=0.0)
+		std::cout<<"  rexmit:"<<std::setw(6)<<r.rexmit_ratio*100.0<<"%";
+	else
+		std::cout<<"  rexmit:     -";
+	std::cout<<"  cpu:"<<std::setw(6)<<r.cpu_sec_per_mb*1000.0<<" ms/MB"
+		<<"  ("<<r.received<<"/"<<TOTAL_MSGS<<" msgs)"<<std::endl;
+}
+
+int main()
+{
+	bool testOk=true;
+	int port=BASE_PORT;
+
+	for (std::size_t i=0;i<SCENARIO_CNT;++i)
+	{
+		const scenario& s=SCENARIOS[i];
+		network_conditions cond;
+		cond.loss_rate=s.loss_rate;
+		cond.reorder_rate=s.reorder_rate;
+		cond.delay_msec=s.delay_msec;
+		cond.jitter_msec=s.jitter_msec;
+		cond.bandwidth=s.bandwidth;
+		cond.queue_bytes=s.queue_bytes;
+		basic_shared_udp_layer::simulate_network(cond);
+
+		io_service ios;
+		bench_result r;
+		{
+			bench_run<urdp_connection, urdp_acceptor> run(ios,port++);
+			r=run.run();
+		}
+		print_result("urdp",s.name,r);
+		testOk=testOk&&(r.received==TOTAL_MSGS);
+	}
+	basic_shared_udp_layer::simulate_network(network_conditions());
+
+	{
+		io_service ios;
+		bench_result r;
+		{
+			bench_run<trdp_connection, trdp_acceptor> run(ios,port++);
+			r=run.run();
+		}
+		print_result("trdp",SCENARIOS[0].name,r);
+		testOk=testOk&&(r.received==TOTAL_MSGS);
+	}
+
+	std::cout<<(testOk?"rdp benchmark OK":"rdp benchmark FAILED")<<std::endl;
+	return testOk?0:1;
+}
@@ -0,0 +1,275 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/fssignal.hpp>
+#include <p2engine/rdp.hpp>
+#include <p2engine/io_service_pool.hpp>
+
+using namespace p2engine;
+using trdp::basic_shared_tcp_layer;
+
+//connections accepted per second by a trdp_acceptor. CLIENT_THREADS threads
+//keep IN_FLIGHT trdp connects each in flight till TOTAL_CONNS have been
+//made, every connection is closed by the client once connected. The run is
+//done once with the shared tcp layer accepting on the io_service of the
+//acceptor only, and once accepting on a pool of ACCEPT_THREADS io_services
+//(see basic_shared_tcp_layer::accept_on_pool), where the domain handshake
+//of the sockets runs in the threads of the pool.
+
+std::string domain="/p2p/accept_bench";
+
+enum{
+	TOTAL_CONNS=4000,
+	IN_FLIGHT=32,
+	CLIENT_THREADS=4,
+	ACCEPT_THREADS=4,
+	RUN_TIMEOUT=60,//seconds
+	BASE_PORT=8951
+};
+
+inline int64_t now_usec()
+{
+	static boost::posix_time::ptime epoch=
+		boost::posix_time::microsec_clock::universal_time();
+	return (boost::posix_time::microsec_clock::universal_time()-epoch)
+		.total_microseconds();
+}
+
+//the connects left to make, shared by the client threads
+class connect_budget
+{
+public:
+	connect_budget():left_(TOTAL_CONNS),failed_(0){}
+
+	bool take()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (left_==0)
+			return false;
+		--left_;
+		return true;
+	}
+	void fail()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		++failed_;
+	}
+	int failed()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		return failed_;
+	}
+
+private:
+	boost::mutex mutex_;
+	int left_, failed_;
+};
+
+class client_driver
+	:public fssignal::trackable
+{
+	typedef client_driver this_type;
+
+public:
+	client_driver(io_service& ios, const endpoint& edp, connect_budget& budget)
+		:ios_(ios),edp_(edp),budget_(budget)
+	{
+	}
+
+	void start()
+	{
+		for (int i=0;i<IN_FLIGHT;++i)
+			connect_one();
+	}
+
+	void clear()
+	{
+		conns_.clear();
+	}
+
+private:
+	void connect_one()
+	{
+		if (!budget_.take())
+			return;
+		boost::shared_ptr<trdp_connection> conn=trdp_connection::create(ios_,false);
+		conn->connected_signal().bind(&this_type::on_connected,this,conn.get(),_1);
+		conns_[conn.get()]=conn;
+		conn->async_connect(edp_,domain);
+	}
+
+	void on_connected(trdp_connection* conn, const error_code& ec)
+	{
+		if (ec)
+			budget_.fail();
+		std::map<trdp_connection*, boost::shared_ptr<trdp_connection> >::iterator
+			itr=conns_.find(conn);
+		if (itr!=conns_.end())
+		{
+			//released after the signal has returned
+			ios_.post(boost::bind(&this_type::release,itr->second));
+			itr->second->close(false);
+			conns_.erase(itr);
+		}
+		connect_one();
+	}
+
+	static void release(boost::shared_ptr<trdp_connection>)
+	{
+	}
+
+private:
+	io_service& ios_;
+	endpoint edp_;
+	connect_budget& budget_;
+	std::map<trdp_connection*, boost::shared_ptr<trdp_connection> > conns_;
+};
+
+struct accept_result
+{
+	accept_result():accepted(0),failed(0),seconds(0.0){}
+
+	int accepted;
+	int failed;
+	double seconds;
+};
+
+class accept_run
+	:public fssignal::trackable
+{
+	typedef accept_run this_type;
+
+public:
+	accept_run(io_service& ios, int port)
+		:ios_(ios),port_(port),accepted_(0),t_start_(0),t_end_(0)
+	{
+		accepted_socks_.reserve(TOTAL_CONNS);
+	}
+
+	accept_result run()
+	{
+		accept_result result;
+		acceptor_=trdp_acceptor::create(ios_,false);
+		acceptor_->accepted_signal().bind(&this_type::on_accepted,this,_1,_2);
+		error_code ec;
+		endpoint edp(address(address_v4::loopback()),port_);
+		acceptor_->listen(edp,domain,ec);
+		if (ec)
+		{
+			std::cout<<"listen error:"<<ec.message()<<std::endl;
+			return result;
+		}
+		acceptor_->keep_async_accepting();
+
+		rough_timer::shared_ptr timeout=rough_timer::create(ios_);
+		timeout->time_signal().bind(&io_service::stop,&ios_);
+		timeout->async_wait(seconds((int)RUN_TIMEOUT));
+
+		io_service_pool clientPool(CLIENT_THREADS);
+		connect_budget budget;
+		std::vector<boost::shared_ptr<client_driver> > clients;
+		for (std::size_t i=0;i<clientPool.size();++i)
+		{
+			clients.push_back(boost::shared_ptr<client_driver>(
+				new client_driver(clientPool.get_io_service(i),edp,budget)));
+		}
+		clientPool.start();
+		t_start_=now_usec();
+		for (std::size_t i=0;i<clients.size();++i)
+		{
+			clientPool.get_io_service(i).post(
+				boost::bind(&client_driver::start,clients[i].get()));
+		}
+		ios_.run();
+		if (t_end_==0)
+			t_end_=now_usec();
+		clientPool.stop();
+		for (std::size_t i=0;i<clients.size();++i)
+			clients[i]->clear();
+
+		result.accepted=accepted_;
+		result.failed=budget.failed();
+		result.seconds=(double)(t_end_-t_start_)/1e6;
+		acceptor_->close(ec);
+		return result;
+	}
+
+	void release_sockets()
+	{
+		accepted_socks_.clear();
+	}
+
+private:
+	void on_accepted(boost::shared_ptr<basic_connection> sock, const error_code& ec)
+	{
+		if (ec)
+			return;
+		//kept till the end, the clients close them
+		accepted_socks_.push_back(sock);
+		if (++accepted_==TOTAL_CONNS)
+		{
+			t_end_=now_usec();
+			ios_.stop();
+		}
+	}
+
+private:
+	io_service& ios_;
+	int port_;
+	boost::shared_ptr<trdp_acceptor> acceptor_;
+	std::vector<boost::shared_ptr<basic_connection> > accepted_socks_;
+	int accepted_;
+	int64_t t_start_, t_end_;
+};
+
+void print_result(const char* name, const accept_result& r)
+{
+	double rate=(r.seconds>0.0?(double)r.accepted/r.seconds:0.0);
+	std::cout<<std::left<<std::setw(24)<<name<<std::right<<std::fixed
+		<<std::setprecision(0)<<" accepted/s:"<<std::setw(8)<<rate
+		<<"  ("<<r.accepted<<"/"<<TOTAL_CONNS<<" accepted, "
+		<<r.failed<<" connects failed, "<<std::setprecision(2)<<r.seconds<<" s)"
+		<<std::endl;
+}
+
+int main()
+{
+	bool testOk=true;
+
+	{
+		basic_shared_tcp_layer::accept_on_pool(boost::shared_ptr<io_service_pool>());
+		io_service ios;
+		accept_run run(ios,BASE_PORT);
+		accept_result r=run.run();
+		print_result("single io_service",r);
+		testOk=testOk&&(r.accepted==TOTAL_CONNS);
+		run.release_sockets();
+	}
+
+	{
+		boost::shared_ptr<io_service_pool> pool(new io_service_pool(ACCEPT_THREADS));
+		basic_shared_tcp_layer::accept_on_pool(pool);
+		pool->start();
+		io_service ios;
+		accept_run run(ios,BASE_PORT+1);
+		accept_result r=run.run();
+#ifdef TRDP_REUSE_PORT
+		print_result("pool, SO_REUSEPORT",r);
+#else
+		print_result("pool, round robin",r);
+#endif
+		testOk=testOk&&(r.accepted==TOTAL_CONNS);
+		pool->stop();
+		run.release_sockets();
+		basic_shared_tcp_layer::accept_on_pool(boost::shared_ptr<io_service_pool>());
+	}
+
+	std::cout<<(testOk?"trdp accept benchmark OK":"trdp accept benchmark FAILED")<<std::endl;
+	return testOk?0:1;
+}
@@ -0,0 +1,256 @@
+#include <p2engine/push_warning_option.hpp>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/rdp/trdp_send_scheduler.hpp>
+
+using namespace p2engine;
+using namespace p2engine::trdp;
+
+//head-of-line delay of the trdp send queue. A bulk reliable transfer(VOD)
+//is queued at once, then a live stream sends an unreliable chunk every
+//LIVE_INTERVAL msec and the flow pings every PING_INTERVAL msec, while a
+//simulated socket takes LINK_RATE bytes a msec. The delay of a packet is
+//from its push to the time the socket takes it. The scheduler is compared
+//with the FIFO the flow used to have, which only dropped a stale unreliable
+//packet when it got to the head. The live chunks and pings must not wait
+//behind the VOD pieces, and VOD must still get its share of the link.
+//Reliable packets of types without a weight must keep their order; two
+//bulk types given weights must share the link in proportion to them.
+
+enum{
+	LIVE_MSG=1,
+	VOD_MSG=2,
+	FILE_MSG=3,
+	PING_MSG=0xffff
+};
+
+enum{
+	LINK_RATE=1000,//bytes/msec
+	RUN_MSEC=2000,
+	VOD_PIECE=16*1024,
+	VOD_BYTES=4*1024*1024,
+	LIVE_CHUNK=1000,
+	LIVE_INTERVAL=10,
+	PING_INTERVAL=100,
+	UNRELIABLE_TIMEOUT=250,//as trdp_flow
+	MAX_LIVE_DELAY=50,
+	MAX_PING_DELAY=2*VOD_PIECE/LINK_RATE,
+	VOD_WEIGHT=3,
+	FAIR_PACKETS=4000
+};
+
+const int64_t MAX_TIME=(std::numeric_limits<int64_t>::max)();
+
+//the send queue of trdp_flow before the scheduler
+class fifo_queue
+{
+public:
+	void push(const trdp_send_element& elm, bool)
+	{
+		q_.push_back(elm);
+	}
+	std::size_t expire(int64_t now)
+	{
+		std::size_t dropped=0;
+		while (!q_.empty()&&q_.front().outTime<now)
+		{
+			q_.pop_front();
+			++dropped;
+		}
+		return dropped;
+	}
+	bool pop(trdp_send_element& elm)
+	{
+		if (q_.empty())
+			return false;
+		elm=q_.front();
+		q_.pop_front();
+		return true;
+	}
+
+private:
+	std::deque<trdp_send_element> q_;
+};
+
+struct hol_result
+{
+	hol_result():live_sent(0),live_dropped(0),max_ping_delay(0),vod_bytes(0){}
+
+	int live_sent, live_dropped;
+	std::vector<int64_t> live_delays;
+	int64_t max_ping_delay;
+	int64_t vod_bytes;
+};
+
+trdp_send_element make_element(uint16_t msgType, std::size_t len, int64_t now)
+{
+	trdp_send_element elm;
+	elm.buf=safe_buffer(std::max(len, sizeof(now)));
+	memcpy(buffer_cast<char*>(elm.buf), &now, sizeof(now));
+	elm.msgType=msgType;
+	elm.type=(msgType==PING_MSG?'c':'e');
+	elm.alertWritable=(msgType==VOD_MSG);
+	elm.outTime=(msgType==VOD_MSG?MAX_TIME:now+UNRELIABLE_TIMEOUT);
+	return elm;
+}
+
+template<typename Queue>
+hol_result run(Queue& q)
+{
+	hol_result result;
+	for (int i=0;i<VOD_BYTES/VOD_PIECE;++i)
+		q.push(make_element(VOD_MSG, VOD_PIECE, 0), false);
+
+	int64_t linkFree=0;
+	for (int64_t now=0;now<RUN_MSEC;++now)
+	{
+		if (now%LIVE_INTERVAL==0)
+			q.push(make_element(LIVE_MSG, LIVE_CHUNK, now), false);
+		if (now%PING_INTERVAL==0)
+			q.push(make_element(PING_MSG, 8, now), true);
+
+		while (linkFree<=now)
+		{
+			result.live_dropped+=(int)q.expire(now);//only live chunks expire here
+			trdp_send_element elm;
+			if (!q.pop(elm))
+				break;
+			int64_t pushed;
+			memcpy(&pushed, buffer_cast<const char*>(elm.buf), sizeof(pushed));
+			if (elm.msgType==LIVE_MSG)
+			{
+				++result.live_sent;
+				result.live_delays.push_back(now-pushed);
+			}
+			else if (elm.msgType==PING_MSG)
+			{
+				result.max_ping_delay=std::max(result.max_ping_delay, now-pushed);
+			}
+			else
+			{
+				result.vod_bytes+=elm.buf.length();
+			}
+			linkFree=now+std::max<int64_t>(1, (elm.buf.length()+LINK_RATE-1)/LINK_RATE);
+		}
+	}
+	//those still queued at the end are neither sent nor dropped
+	std::sort(result.live_delays.begin(), result.live_delays.end());
+	return result;
+}
+
+//reliable packets of several types and sizes come out in the order they 
+//were pushed, and so do those of a type given a weight after they were
+bool fifo_order()
+{
+	trdp_send_scheduler q;
+	for (int i=0;i<FAIR_PACKETS;++i)
+	{
+		trdp_send_element elm=make_element(
+			(uint16_t)(i%3==0?VOD_MSG:FILE_MSG), 200+(i%7)*1500, 0);
+		elm.outTime=MAX_TIME;//reliable
+		memcpy(buffer_cast<char*>(elm.buf), &i, sizeof(i));
+		q.push(elm, false);
+	}
+	bool ok=!q.weighted(VOD_MSG);
+	int lastVod=-1;
+	trdp_send_element elm;
+	for (int i=0;q.pop(elm);++i)
+	{
+		int n;
+		memcpy(&n, buffer_cast<const char*>(elm.buf), sizeof(n));
+		if (i==FAIR_PACKETS/2)
+			q.weight(VOD_MSG, VOD_WEIGHT);
+		if (i<FAIR_PACKETS/2)
+			ok=ok&&(n==i);
+		else if (elm.msgType==VOD_MSG)
+			ok=ok&&(n>lastVod);
+		if (elm.msgType==VOD_MSG)
+			lastVod=n;
+	}
+	return ok&&q.empty()&&q.weighted(VOD_MSG);
+}
+
+//VOD of VOD_WEIGHT and a file transfer of weight 1, both backlogged with
+//packets of different sizes; returns the bytes of VOD over those of the file
+double fair_share()
+{
+	trdp_send_scheduler q;
+	q.weight(VOD_MSG, VOD_WEIGHT);
+	for (int i=0;i<FAIR_PACKETS;++i)
+	{
+		q.push(make_element(VOD_MSG, 1000+(i%7)*500, 0), false);
+		q.push(make_element(FILE_MSG, 200+(i%5)*3000, 0), false);
+	}
+	int64_t bytes[FILE_MSG+1]={0};
+	trdp_send_element elm;
+	for (int i=0;i<FAIR_PACKETS;++i)
+	{
+		q.pop(elm);
+		bytes[elm.msgType]+=elm.buf.length();
+	}
+	return (double)bytes[VOD_MSG]/(double)bytes[FILE_MSG];
+}
+
+void print_result(const char* name, const hol_result& r)
+{
+	int64_t p50=0, p99=0;
+	if (!r.live_delays.empty())
+	{
+		p50=r.live_delays[r.live_delays.size()*50/100];
+		p99=r.live_delays[r.live_delays.size()*99/100];
+	}
+	std::cout<<std::left<<std::setw(10)<<name<<std::right
+		<<" live sent:"<<std::setw(4)<<r.live_sent
+		<<" dropped:"<<std::setw(4)<<r.live_dropped
+		<<" delay p50:"<<std::setw(4)<<p50<<" ms p99:"<<std::setw(4)<<p99<<" ms"
+		<<"  ping max delay:"<<std::setw(4)<<r.max_ping_delay<<" ms"
+		<<"  vod:"<<std::fixed<<std::setprecision(1)
+		<<(double)r.vod_bytes*100.0/((double)LINK_RATE*RUN_MSEC)<<"% of link"
+		<<std::endl;
+}
+
+int main()
+{
+	fifo_queue fifo;
+	hol_result fifoResult=run(fifo);
+	print_result("fifo", fifoResult);
+
+	trdp_send_scheduler scheduler;
+	hol_result schedResult=run(scheduler);
+	print_result("scheduler", schedResult);
+
+	bool fifoOk=fifo_order();
+	std::cout<<"reliable order across types "<<(fifoOk?"kept":"broken")<<std::endl;
+
+	double share=fair_share();
+	std::cout<<"weight "<<VOD_WEIGHT<<":1 share "<<std::setprecision(2)
+		<<share<<":1"<<std::endl;
+
+	const hol_result& r=schedResult;
+	bool testOk=(fifoOk
+		&&r.live_dropped==0
+		&&r.live_sent>=RUN_MSEC/LIVE_INTERVAL-1
+		&&r.live_delays.back()<=MAX_LIVE_DELAY
+		&&r.max_ping_delay<=MAX_PING_DELAY
+		&&r.vod_bytes*2>=(int64_t)LINK_RATE*RUN_MSEC
+		&&share>VOD_WEIGHT*0.9&&share<VOD_WEIGHT*1.1);
+
+	//what is left is the rest of VOD and the live chunks not yet due, and a
+	//cleared scheduler keeps its weights
+	testOk=testOk&&scheduler.bytes()-scheduler.unreliable_bytes()
+		==(std::size_t)(VOD_BYTES-r.vod_bytes);
+	scheduler.weight(VOD_MSG, VOD_WEIGHT);
+	scheduler.clear();
+	testOk=testOk&&scheduler.empty()&&scheduler.bytes()==0
+		&&scheduler.weight(VOD_MSG)==VOD_WEIGHT&&scheduler.weight(LIVE_MSG)==1;
+
+	std::cout<<(testOk?"trdp send scheduler OK":"trdp send scheduler FAILED")<<std::endl;
+	return testOk?0:1;
+}
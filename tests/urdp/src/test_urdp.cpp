@@ -0,0 +1,209 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/fssignal.hpp>
+#include <p2engine/rdp.hpp>
+#include <p2engine/rdp/basic_shared_udp_layer.hpp>
+
+using namespace p2engine;
+
+//bulk transfer over urdp on loopback. On linux the shared udp layer sends
+//the MSS-sized segments of a burst as UDP GSO super buffers and splits the
+//coalesced datagrams of UDP GRO, the payload must arrive unchanged either way.
+//The flows are paced, so the shared layer wakes up the sender to go on.
+//When the kernel has GSO(GRO) the layers must really have used it: a GSO
+//super buffer sent on loopback to a GRO socket comes in coalesced.
+
+std::string domain="/p2p/bulk";
+
+typedef urdp_connection my_connection;
+typedef urdp_acceptor my_acceptor;
+
+inline endpoint server_endpoint()
+{
+	return endpoint(address(address_v4::loopback()),8889);
+}
+
+enum{
+	BULK_MSG=1
+};
+
+enum{
+	MSG_SIZE=1024,
+	MSG_CNT=4096,
+	MSG_PER_FILL=128
+};
+
+bool test_ok=false;
+
+//the byte at offset i of message n
+inline char payload_byte(int n, std::size_t i)
+{
+	return (char)(n*131+i*7);
+}
+
+class client
+	:public fssignal::trackable
+{
+	typedef client this_type;
+
+public:
+	client(io_service& ios):ios_(ios),sent_(0){}
+	void run()
+	{
+		socket_=my_connection::create(ios_,false);
+		socket_->connected_signal().bind(&this_type::on_connected,this,_1);
+		socket_->writable_signal().bind(&this_type::fill,this);
+		socket_->async_connect(server_endpoint(),domain);
+	}
+
+private:
+	void on_connected(const error_code& ec)
+	{
+		std::cout<<"client connected, error_msg:"<<ec.message()<<std::endl;
+		if (!ec)
+			fill();
+	}
+	void fill()
+	{
+		for (int i=0;i<MSG_PER_FILL&&sent_<MSG_CNT;++i,++sent_)
+		{
+			safe_buffer buf(MSG_SIZE);
+			char* p=buffer_cast<char*>(buf);
+			for (std::size_t j=0;j<MSG_SIZE;++j)
+				p[j]=payload_byte(sent_,j);
+			socket_->async_send_reliable(buf,BULK_MSG);
+		}
+	}
+
+private:
+	io_service& ios_;
+	boost::shared_ptr<basic_connection> socket_;
+	int sent_;
+};
+
+class server
+	:public fssignal::trackable
+{
+	typedef server this_type;
+
+public:
+	server(io_service& ios):ios_(ios),recvd_(0){}
+	void run()
+	{
+		acceptor_=my_acceptor::create(ios_,false);
+		acceptor_->accepted_signal().bind(&this_type::on_accepted,this,_1,_2);
+		error_code ec;
+		acceptor_->listen(server_endpoint(),domain,ec);
+		if (!ec)
+			acceptor_->keep_async_accepting();
+		else
+			std::cout<<"listen error:"<<ec.message()<<std::endl;
+	}
+
+private:
+	void on_accepted(boost::shared_ptr<basic_connection> socket,const error_code& ec)
+	{
+		if (ec)
+			return;
+		socket_=socket;
+		socket_->received_signal(BULK_MSG).bind(&this_type::on_received,this,_1);
+	}
+	void on_received(safe_buffer buf)
+	{
+		const char* p=buffer_cast<const char*>(buf);
+		bool intact=(buf.size()==MSG_SIZE);
+		for (std::size_t i=0;intact&&i<buf.size();++i)
+			intact=(p[i]==payload_byte(recvd_,i));
+		if (!intact)
+		{
+			std::cout<<"message "<<recvd_<<" is corrupted"<<std::endl;
+			ios_.stop();
+			return;
+		}
+		if (++recvd_==MSG_CNT)
+		{
+			test_ok=true;
+			ios_.stop();
+		}
+	}
+
+private:
+	io_service& ios_;
+	boost::shared_ptr<my_acceptor> acceptor_;
+	boost::shared_ptr<basic_connection> socket_;
+	int recvd_;
+};
+
+int main()
+{
+	urdp::basic_shared_udp_layer::use_udp_gso(true);
+	urdp::basic_shared_udp_layer::use_udp_gro(true);
+	urdp::urdp_flow::default_pacing(true);
+
+	io_service ios;
+	server s(ios);
+	client c(ios);
+	s.run();
+	c.run();
+
+	rough_timer::shared_ptr timeout=rough_timer::create(ios);
+	timeout->time_signal().bind(&io_service::stop,&ios);
+	timeout->async_wait(seconds(30));
+	ios.run();
+
+	urdp::basic_shared_udp_layer::send_batch_statistics sendStats
+		=urdp::basic_shared_udp_layer::total_send_batch_stats();
+	urdp::basic_shared_udp_layer::recv_batch_statistics recvStats
+		=urdp::basic_shared_udp_layer::total_recv_batch_stats();
+	std::cout<<"sendmmsg calls:"<<sendStats.syscalls
+		<<", datagrams:"<<sendStats.datagrams
+		<<", GSO super buffers:"<<sendStats.gso_sends
+		<<", GSO segments:"<<sendStats.gso_segments<<std::endl;
+	std::cout<<"recvmmsg calls:"<<recvStats.syscalls
+		<<", datagrams:"<<recvStats.datagrams
+		<<", GRO datagrams:"<<recvStats.gro_datagrams
+		<<", GRO segments:"<<recvStats.gro_segments<<std::endl;
+	//a layer that has the offload and sent(received) the bulk with none of it
+	if (sendStats.gso_layers>0&&sendStats.gso_sends==0)
+	{
+		std::cout<<"GSO is on but no super buffer was sent"<<std::endl;
+		test_ok=false;
+	}
+	else if (sendStats.gso_layers==0)
+	{
+		std::cout<<"GSO not supported, skipped"<<std::endl;
+	}
+	if (recvStats.gro_layers>0&&sendStats.gso_sends>0&&recvStats.gro_datagrams==0)
+	{
+		std::cout<<"GRO is on but no coalesced datagram came in"<<std::endl;
+		test_ok=false;
+	}
+	else if (recvStats.gro_layers==0)
+	{
+		std::cout<<"GRO not supported, skipped"<<std::endl;
+	}
+
+	//the receive buffers of the layers must have been recycled instead of 
+	//being allocated per datagram
+	raw_buffer_pool::statistics bufStats
+		=urdp::basic_shared_udp_layer::total_recv_buffer_stats();
+	std::cout<<"receive buffer allocs:"<<bufStats.allocs
+		<<", reuses:"<<bufStats.reuses
+		<<", recycles:"<<bufStats.recycles<<std::endl;
+	if (bufStats.reuses==0)
+		test_ok=false;
+
+	urdp::basic_shared_udp_layer::pacing_statistics pacingStats
+		=urdp::basic_shared_udp_layer::total_pacing_stats();
+	std::cout<<"pacing wakeups asked:"<<pacingStats.schedules
+		<<", handled:"<<pacingStats.wakeups
+		<<", timer fires:"<<pacingStats.timer_fires
+		<<", max pending:"<<pacingStats.max_pending<<std::endl;
+
+	std::cout<<(test_ok?"bulk transfer OK":"bulk transfer FAILED")<<std::endl;
+	return test_ok?0:1;
+}
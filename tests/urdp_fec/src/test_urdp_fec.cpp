@@ -0,0 +1,141 @@
+#include <p2engine/push_warning_option.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/io.hpp>
+#include <p2engine/safe_buffer.hpp>
+#include <p2engine/rdp/urdp_fec.hpp>
+
+using namespace p2engine;
+using namespace p2engine::urdp;
+
+//the XOR parity of urdp_fec_encoder must give back any one lost packet of a
+//group to urdp_fec_decoder, whatever the lengths of the packets are, and
+//must not make up a packet when two of a group are lost. A data packet that
+//comes after it has been received or recovered is a duplicate.
+
+enum{
+	GROUP_CNT=2000,
+	MAX_PAYLOAD=1400
+};
+
+//[pktID|msgType|payload], as urdp_flow delivers it
+safe_buffer make_body(uint16_t pktID, uint16_t msgType, const safe_buffer& payload)
+{
+	safe_buffer body(4+payload.size());
+	char* p=buffer_cast<char*>(body);
+	write_uint16_hton(pktID, p);
+	write_uint16_hton(msgType, p);
+	memcpy(p, buffer_cast<const char*>(payload), payload.size());
+	return body;
+}
+
+bool same(const safe_buffer& a, const safe_buffer& b)
+{
+	return a.size()==b.size()
+		&&memcmp(buffer_cast<const char*>(a), buffer_cast<const char*>(b), a.size())==0;
+}
+
+int main()
+{
+	urdp_fec_encoder encoder;
+	urdp_fec_decoder decoder;
+	uint16_t pktID=0;
+	int recovered=0, lost=0, wrong=0, dupMissed=0;
+	urdp_fec_decoder::time32_type now=0;
+
+	for (int g=0;g<GROUP_CNT;++g,now+=10)
+	{
+		double lostRate=(g%5)*0.06;
+		int groupSize=urdp_fec_encoder::group_size(lostRate);
+		if (g%7==0)
+			groupSize=1+rand()%groupSize;//flushed before being full
+		encoder.open((uint8_t)urdp_fec_encoder::group_size(lostRate));
+
+		std::vector<safe_buffer> bodies;
+		for (int i=0;i<groupSize;++i,++pktID)
+		{
+			safe_buffer payload(1+rand()%MAX_PAYLOAD);
+			char* p=buffer_cast<char*>(payload);
+			for (std::size_t j=0;j<payload.size();++j)
+				p[j]=(char)rand();
+			encoder.add(pktID, (uint16_t)(g&0xff), payload);
+			bodies.push_back(make_body(pktID, (uint16_t)(g&0xff), payload));
+		}
+		uint16_t group=encoder.group();
+		const std::vector<char>& parity=encoder.parity();
+		safe_buffer parityBuf(parity.size());
+		memcpy(buffer_cast<char*>(parityBuf), &parity[0], parity.size());
+		uint8_t count=encoder.count();
+		encoder.close();
+
+		//lose none, one or two data packets
+		int lostCnt=(g%3==0?0:(g%3==1?1:2));
+		if (lostCnt>groupSize)
+			lostCnt=groupSize;
+		int lost1=rand()%groupSize;
+		int lost2=(lost1+1)%groupSize;
+
+		//the parity goes ahead of some of the data now and then. If none is
+		//lost, the last one is then recovered before it arrives, which is right
+		int parityAt=rand()%(groupSize+1);
+		const safe_buffer* expected=(lostCnt==1?&bodies[lost1]
+			:(lostCnt==0?&bodies[groupSize-1]:NULL));
+		safe_buffer out;
+		bool gotLost=false;
+		bool duplicated;
+		for (int i=0;i<=groupSize;++i)
+		{
+			if (i==parityAt&&decoder.on_parity(group, count, parityBuf, now, out))
+			{
+				if (expected&&same(out, *expected))
+					gotLost=true;
+				else
+					++wrong;
+			}
+			if (i<groupSize
+				&&!((lostCnt>=1&&i==lost1)||(lostCnt>=2&&i==lost2)))
+			{
+				if (decoder.on_data(group, (uint8_t)i, bodies[i], now, out, duplicated))
+				{
+					if (expected&&same(out, *expected))
+						gotLost=true;
+					else
+						++wrong;
+				}
+				//only the last one may have been recovered before it arrives
+				if (duplicated!=(lostCnt==0&&gotLost&&i==groupSize-1))
+					++wrong;
+			}
+		}
+
+		//a late copy of the packets is never delivered again once the group
+		//is recovered
+		if (gotLost)
+		{
+			for (int i=0;i<groupSize;++i)
+			{
+				if (decoder.on_data(group, (uint8_t)i, bodies[i], now, out, duplicated))
+					++wrong;
+				if (!duplicated)
+					++dupMissed;
+			}
+		}
+		if (lostCnt==1)
+		{
+			++lost;
+			if (gotLost)
+				++recovered;
+		}
+	}
+
+	std::cout<<"groups:"<<GROUP_CNT<<", single losses:"<<lost
+		<<", recovered:"<<recovered<<", wrong:"<<wrong
+		<<", duplicates missed:"<<dupMissed<<std::endl;
+	bool testOk=(recovered==lost&&wrong==0&&dupMissed==0);
+	std::cout<<(testOk?"fec OK":"fec FAILED")<<std::endl;
+	return testOk?0:1;
+}
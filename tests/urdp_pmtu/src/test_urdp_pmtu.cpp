@@ -0,0 +1,184 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/fssignal.hpp>
+#include <p2engine/rdp.hpp>
+#include <p2engine/rdp/basic_shared_udp_layer.hpp>
+
+using namespace p2engine;
+
+//path MTU discovery over urdp on loopback. The shared udp layer drops every
+//datagram longer than SIMULATED_PATH_MTU, as a router with a small MTU would
+//do to a DF datagram, so the flows must find an mss that gets through while
+//the messages, several segments each, are being sent.
+
+std::string domain="/p2p/pmtu";
+
+typedef urdp_connection my_connection;
+typedef urdp_acceptor my_acceptor;
+
+inline endpoint server_endpoint()
+{
+	return endpoint(address(address_v4::loopback()),8890);
+}
+
+enum{
+	BULK_MSG=1
+};
+
+enum{
+	SIMULATED_PATH_MTU=1300,
+	MSG_SIZE=4000,
+	MSG_CNT=1024,
+	MSG_PER_FILL=32
+};
+
+class client
+	:public fssignal::trackable
+{
+	typedef client this_type;
+
+public:
+	client(io_service& ios):ios_(ios),sent_(0){}
+	void run()
+	{
+		socket_=my_connection::create(ios_,false);
+		socket_->connected_signal().bind(&this_type::on_connected,this,_1);
+		socket_->writable_signal().bind(&this_type::fill,this);
+		socket_->async_connect(server_endpoint(),domain);
+	}
+	boost::shared_ptr<my_connection> socket()const
+	{
+		return socket_;
+	}
+
+private:
+	void on_connected(const error_code& ec)
+	{
+		std::cout<<"client connected, error_msg:"<<ec.message()<<std::endl;
+		if (!ec)
+			fill();
+	}
+	void fill()
+	{
+		for (int i=0;i<MSG_PER_FILL&&sent_<MSG_CNT;++i,++sent_)
+		{
+			safe_buffer buf(MSG_SIZE);
+			memset(buffer_cast<char*>(buf),(char)sent_,MSG_SIZE);
+			socket_->async_send_reliable(buf,BULK_MSG);
+		}
+	}
+
+private:
+	io_service& ios_;
+	boost::shared_ptr<my_connection> socket_;
+	int sent_;
+};
+
+class server
+	:public fssignal::trackable
+{
+	typedef server this_type;
+
+public:
+	server(io_service& ios):ios_(ios),recvd_(0),corrupted_(false){}
+	void run()
+	{
+		acceptor_=my_acceptor::create(ios_,false);
+		acceptor_->accepted_signal().bind(&this_type::on_accepted,this,_1,_2);
+		error_code ec;
+		acceptor_->listen(server_endpoint(),domain,ec);
+		if (!ec)
+			acceptor_->keep_async_accepting();
+		else
+			std::cout<<"listen error:"<<ec.message()<<std::endl;
+	}
+	bool done()const
+	{
+		return recvd_==MSG_CNT;
+	}
+	bool corrupted()const
+	{
+		return corrupted_;
+	}
+
+private:
+	void on_accepted(boost::shared_ptr<basic_connection> socket,const error_code& ec)
+	{
+		if (ec)
+			return;
+		socket_=socket;
+		socket_->received_signal(BULK_MSG).bind(&this_type::on_received,this,_1);
+	}
+	void on_received(safe_buffer buf)
+	{
+		const char* p=buffer_cast<const char*>(buf);
+		for (std::size_t i=0;i<buf.size();++i)
+		{
+			if (buf.size()!=MSG_SIZE||p[i]!=(char)recvd_)
+			{
+				std::cout<<"message "<<recvd_<<" is corrupted"<<std::endl;
+				corrupted_=true;
+				ios_.stop();
+				return;
+			}
+		}
+		++recvd_;
+	}
+
+private:
+	io_service& ios_;
+	boost::shared_ptr<my_acceptor> acceptor_;
+	boost::shared_ptr<basic_connection> socket_;
+	int recvd_;
+	bool corrupted_;
+};
+
+void check_done(io_service& ios, const server& s, const client& c)
+{
+	boost::shared_ptr<my_connection> sock=c.socket();
+	if (s.done()&&sock&&sock->pmtu_state()==urdp::urdp_flow::PMTU_SEARCH_COMPLETE)
+		ios.stop();
+}
+
+int main()
+{
+	urdp::basic_shared_udp_layer::use_path_mtu_discovery(true);
+	urdp::basic_shared_udp_layer::simulate_path_mtu(SIMULATED_PATH_MTU);
+
+	io_service ios;
+	server s(ios);
+	client c(ios);
+	s.run();
+	c.run();
+
+	rough_timer::shared_ptr poll=rough_timer::create(ios);
+	poll->time_signal().bind(&check_done,boost::ref(ios),boost::cref(s),boost::cref(c));
+	poll->async_keep_waiting(milliseconds(100),milliseconds(100));
+
+	rough_timer::shared_ptr timeout=rough_timer::create(ios);
+	timeout->time_signal().bind(&io_service::stop,&ios);
+	timeout->async_wait(seconds(60));
+	ios.run();
+
+	bool testOk=s.done()&&!s.corrupted();
+	boost::shared_ptr<my_connection> sock=c.socket();
+	uint32_t mss=sock?sock->mss():0;
+	int state=sock?(int)sock->pmtu_state():-1;
+	std::cout<<"received:"<<(s.done()?"all":"not all")
+		<<", mss:"<<mss<<", pmtu state:"<<state<<std::endl;
+
+	//the mss found must get through the simulated path, and must not be the
+	//minimum either, since the path allows more
+	if (state!=urdp::urdp_flow::PMTU_SEARCH_COMPLETE
+		||mss<=MIN_MTU_SIZE||mss>SIMULATED_PATH_MTU)
+	{
+		testOk=false;
+	}
+
+	std::cout<<(testOk?"path MTU discovery OK":"path MTU discovery FAILED")<<std::endl;
+	return testOk?0:1;
+}
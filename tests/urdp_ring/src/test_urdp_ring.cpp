@@ -0,0 +1,182 @@
+#include <p2engine/push_warning_option.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/rdp/urdp_ring.hpp>
+
+using namespace p2engine;
+using namespace p2engine::urdp;
+
+//the rings that urdp_flow queues segments in. urdp_recv_ring must give back
+//the stream unchanged however the segments are reordered, lost(and resent),
+//duplicated or resegmented, and report the holes as SACK blocks;
+//urdp_segment_ring must behave as the std::deque it replaced.
+
+enum{
+	STREAM_LEN=4*1024*1024,
+	MAX_SEG=1400,
+	WINDOW=64*1024
+};
+
+bool test_recv_ring()
+{
+	std::vector<char> stream(STREAM_LEN);
+	for (std::size_t i=0;i<stream.size();++i)
+		stream[i]=(char)rand();
+
+	//start near the wrap of seq
+	const uint32_t isn=0xffffffff-100000;
+	urdp_recv_ring ring;
+	uint32_t rcvNxt=isn, rlen=0;
+	std::size_t sent=0, read=0, held=0;
+	std::vector<char> out(STREAM_LEN);
+	ring.rebase(rcvNxt);
+
+	while (read<STREAM_LEN)
+	{
+		//a segment somewhere in the window, ahead of the in order data
+		std::size_t offset=(std::size_t)(rcvNxt-isn);
+		if (offset<STREAM_LEN)
+		{
+			std::size_t ahead=(rand()%4==0?0:(std::size_t)rand()%WINDOW);
+			std::size_t pos=std::min<std::size_t>(offset+ahead, STREAM_LEN-1);
+			std::size_t len=std::min<std::size_t>(1+rand()%MAX_SEG, STREAM_LEN-pos);
+			uint32_t seq=isn+(uint32_t)pos;
+			if (rlen==0)
+				ring.rebase(rcvNxt);
+			held+=ring.write(seq, &stream[pos], len, rcvNxt);
+			if (seq==rcvNxt)
+			{
+				uint32_t nxt=ring.advance(rcvNxt);
+				rlen+=nxt-rcvNxt;
+				rcvNxt=nxt;
+			}
+			++sent;
+		}
+
+		//the blocks must be in order, apart, and beyond rcv_nxt
+		const urdp_recv_ring::block_list& blocks=ring.blocks();
+		for (std::size_t i=0;i<blocks.size();++i)
+		{
+			if ((int32_t)(blocks[i].first-rcvNxt)<=0
+				||(int32_t)(blocks[i].second-blocks[i].first)<=0
+				||(i>0&&(int32_t)(blocks[i].first-blocks[i-1].second)<=0))
+			{
+				std::cout<<"bad SACK block "<<i<<std::endl;
+				return false;
+			}
+		}
+
+		//the application reads now and then
+		if (rlen&&(rand()%3==0||offset>=STREAM_LEN))
+		{
+			std::size_t len=1+rand()%rlen;
+			ring.read(&out[read], len);
+			read+=len;
+			rlen-=(uint32_t)len;
+		}
+	}
+
+	bool ok=(memcmp(&out[0], &stream[0], STREAM_LEN)==0&&held==STREAM_LEN);
+	std::cout<<"recv ring: segments:"<<sent<<", bytes held:"<<held
+		<<", capacity:"<<ring.capacity()<<std::endl;
+	return ok;
+}
+
+//stale segments(retransmissions from before the wrap of seq) and those
+//too far ahead are not stored, and must not grow the ring
+bool test_recv_ring_bounds()
+{
+	const uint32_t rcvNxt=5;//just wrapped
+	char data[MAX_SEG]={0};
+	urdp_recv_ring ring;
+	ring.rebase(rcvNxt);
+	std::size_t held=ring.write(0xffffff00u, data, MAX_SEG, rcvNxt);
+	held+=ring.write(rcvNxt+urdp_recv_ring::MAX_CAPACITY, data, MAX_SEG, rcvNxt);
+	held+=ring.write(rcvNxt+urdp_recv_ring::MAX_CAPACITY-1, data, 2, rcvNxt);
+	bool ok=(held==0&&ring.capacity()==0&&!ring.has_out_of_order());
+	held=ring.write(rcvNxt+1, data, MAX_SEG, rcvNxt);
+	ok=ok&&held==MAX_SEG&&ring.capacity()<=urdp_recv_ring::MAX_CAPACITY;
+	std::cout<<"recv ring bounds: "<<(ok?"kept":"broken")<<std::endl;
+	return ok;
+}
+
+struct seg
+{
+	uint32_t seq;
+	int v;
+	seg():seq(0),v(0){}
+	seg(uint32_t s, int n):seq(s),v(n){}
+};
+
+bool seq_less(const seg& s, uint32_t seq)
+{
+	return (int32_t)(s.seq-seq)<0;
+}
+
+bool test_segment_ring()
+{
+	urdp_segment_ring<seg> ring;
+	std::deque<seg> dq;
+	uint32_t seq=0xffffff00;
+	for (int i=0;i<200000;++i)
+	{
+		int op=rand()%8;
+		if (op<4||dq.empty())
+		{
+			seg s(seq, i);
+			seq+=1+rand()%MAX_SEG;
+			ring.push_back(s);
+			dq.push_back(s);
+		}
+		else if (op<7)
+		{
+			ring.pop_front();
+			dq.pop_front();
+		}
+		else
+		{
+			//split one, as resegmenting does
+			std::size_t at=rand()%dq.size();
+			uint32_t end=(at+1<dq.size()?dq[at+1].seq:seq);
+			if (end-dq[at].seq>1)
+			{
+				seg s(dq[at].seq+1, -i);
+				ring.insert(ring.begin()+at+1, s);
+				dq.insert(dq.begin()+at+1, s);
+			}
+		}
+
+		if (ring.size()!=dq.size()
+			||(!dq.empty()&&(ring.front().v!=dq.front().v||ring.back().v!=dq.back().v)))
+		{
+			std::cout<<"segment ring differs at "<<i<<std::endl;
+			return false;
+		}
+		if (!dq.empty())
+		{
+			std::size_t at=rand()%dq.size();
+			urdp_segment_ring<seg>::iterator itr=ring.lower_bound(dq[at].seq, &seq_less);
+			if (itr==ring.end()||itr->v!=dq[at].v||(std::size_t)(itr-ring.begin())!=at)
+			{
+				std::cout<<"lower_bound is wrong at "<<i<<std::endl;
+				return false;
+			}
+		}
+	}
+	std::cout<<"segment ring: size:"<<ring.size()<<std::endl;
+	return true;
+}
+
+int main()
+{
+	bool testOk=test_recv_ring();
+	testOk=test_recv_ring_bounds()&&testOk;
+	testOk=test_segment_ring()&&testOk;
+	std::cout<<(testOk?"urdp ring OK":"urdp ring FAILED")<<std::endl;
+	return testOk?0:1;
+}
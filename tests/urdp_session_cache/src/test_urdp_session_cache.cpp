@@ -0,0 +1,98 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/rdp/urdp_session_cache.hpp>
+
+using namespace p2engine;
+using namespace p2engine::urdp;
+
+//the tickets that urdp_flow reconnects fast with. A ticket is found by the
+//endpoint and the domain both, the least recently used one goes when the
+//cache is full, and an expired one is never given back.
+
+enum{
+	MAX_SIZE=64,
+	LIFETIME=200//msec
+};
+
+endpoint make_endpoint(int i)
+{
+	return endpoint(address(address_v4(0x0a000000+i)), (unsigned short)(1000+i));
+}
+
+urdp_session_ticket make_ticket(int i)
+{
+	urdp_session_ticket ticket;
+	ticket.session_id=(uint16_t)i;
+	ticket.mss=1000+i;
+	ticket.srtt=i;
+	return ticket;
+}
+
+bool test_lookup(urdp_session_cache& cache)
+{
+	for (int i=0;i<MAX_SIZE;++i)
+		cache.put(make_endpoint(i), "/a", make_ticket(i));
+	cache.put(make_endpoint(0), "/b", make_ticket(-1));//the oldest of "/a" goes
+
+	urdp_session_ticket ticket;
+	if (cache.size()!=MAX_SIZE||cache.get(make_endpoint(0), "/a", ticket))
+	{
+		std::cout<<"the least recently used one is not dropped"<<std::endl;
+		return false;
+	}
+	if (!cache.get(make_endpoint(0), "/b", ticket)||ticket.session_id!=(uint16_t)-1)
+	{
+		std::cout<<"domain is not a part of the key"<<std::endl;
+		return false;
+	}
+
+	//a lookup makes a ticket the most recently used
+	cache.get(make_endpoint(1), "/a", ticket);
+	cache.put(make_endpoint(1000), "/a", make_ticket(1000));
+	if (!cache.get(make_endpoint(1), "/a", ticket)||ticket.mss!=1001
+		||cache.get(make_endpoint(2), "/a", ticket))
+	{
+		std::cout<<"lookup does not refresh a ticket"<<std::endl;
+		return false;
+	}
+
+	//put replaces
+	cache.put(make_endpoint(1), "/a", make_ticket(7));
+	cache.erase(make_endpoint(3), "/a");
+	if (!cache.get(make_endpoint(1), "/a", ticket)||ticket.mss!=1007
+		||cache.get(make_endpoint(3), "/a", ticket)||cache.size()!=MAX_SIZE-1)
+	{
+		std::cout<<"put or erase is wrong"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool test_expiry(urdp_session_cache& cache)
+{
+	cache.clear();
+	cache.put(make_endpoint(1), "/a", make_ticket(1));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(LIFETIME/2));
+	cache.put(make_endpoint(2), "/a", make_ticket(2));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(LIFETIME/2+50));
+
+	urdp_session_ticket ticket;
+	if (cache.get(make_endpoint(1), "/a", ticket)||!cache.get(make_endpoint(2), "/a", ticket))
+	{
+		std::cout<<"expiry is wrong"<<std::endl;
+		return false;
+	}
+	return cache.size()==1;
+}
+
+int main()
+{
+	urdp_session_cache cache(MAX_SIZE, LIFETIME);
+	bool testOk=test_lookup(cache);
+	testOk=test_expiry(cache)&&testOk;
+	std::cout<<(testOk?"session cache OK":"session cache FAILED")<<std::endl;
+	return testOk?0:1;
+}
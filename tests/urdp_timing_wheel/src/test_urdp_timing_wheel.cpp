@@ -0,0 +1,140 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/bind.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/rdp/urdp_timing_wheel.hpp>
+
+using namespace p2engine;
+using namespace p2engine::urdp;
+
+//the timing wheel that ticks all urdp_flows of an io_service. A timer must
+//not run before its expiry nor long after it, whether it is armed for the
+//root wheel or for an upper level, rearmed or cancelled on the way, or
+//rearmed from a handler; a cancelled timer must never run.
+
+enum{
+	TIMER_CNT=2000,
+	MAX_DELAY=3000,//some go beyond a turn of the root wheel
+	MAX_LATE=100//the tick timer is rough
+};
+
+const tick_type NOT_ARMED=-1;
+
+struct wheel_test
+{
+	wheel_test(io_service& ios)
+		:fired_(0),early_(0),late_(0),stray_(0),max_late_(0)
+	{
+		for (int i=0;i<TIMER_CNT;++i)
+		{
+			timers_.push_back(new urdp_wheel_timer(ios));
+			timers_.back()->set_handler(boost::bind(&wheel_test::on_timer, this, i));
+			expiry_.push_back(NOT_ARMED);
+			rounds_.push_back(3);
+			arm(i);
+		}
+	}
+	~wheel_test()
+	{
+		for (std::size_t i=0;i<timers_.size();++i)
+			delete timers_[i];
+	}
+
+	void arm(int i)
+	{
+		long delay=(rand()%8==0?(long)(rand()%MAX_DELAY):(long)(rand()%200));
+		expiry_[i]=urdp_timing_wheel::tick_now()+delay;
+		timers_[i]->async_wait(delay);
+	}
+
+	//churn: rearm, cancel and arm again, as urdp_flow does
+	void churn()
+	{
+		for (int n=0;n<TIMER_CNT/10;++n)
+		{
+			int i=rand()%TIMER_CNT;
+			if (rand()%4==0)
+			{
+				timers_[i]->cancel();
+				expiry_[i]=NOT_ARMED;
+			}
+			else if (rounds_[i]>0)
+			{
+				arm(i);
+			}
+		}
+	}
+
+	void on_timer(int i)
+	{
+		tick_type now=urdp_timing_wheel::tick_now();
+		if (expiry_[i]==NOT_ARMED)
+		{
+			++stray_;
+			return;
+		}
+		++fired_;
+		if (now<expiry_[i])
+			++early_;
+		else if (now-expiry_[i]>MAX_LATE)
+			++late_;
+		max_late_=std::max<tick_type>(max_late_, now-expiry_[i]);
+		expiry_[i]=NOT_ARMED;
+		if (--rounds_[i]>0)
+		{
+			arm(i);//rearmed from its own handler
+			if (i%3==0)//and one that will not run
+			{
+				int j=(i+1)%TIMER_CNT;
+				timers_[j]->cancel();
+				expiry_[j]=NOT_ARMED;
+			}
+		}
+	}
+
+	std::vector<urdp_wheel_timer*> timers_;
+	std::vector<tick_type> expiry_;
+	std::vector<int> rounds_;
+	int fired_, early_, late_, stray_;
+	tick_type max_late_;
+};
+
+void on_churn(wheel_test* test, boost::asio::deadline_timer* t, int left)
+{
+	if (left==0)
+		return;
+	test->churn();
+	t->expires_from_now(milliseconds(50));
+	t->async_wait(boost::bind(&on_churn, test, t, left-1));
+}
+
+int main()
+{
+	io_service ios;
+	{
+		wheel_test test(ios);
+		boost::asio::deadline_timer churnTimer(ios);
+		on_churn(&test, &churnTimer, 40);
+		//the wheel only keeps the io_service busy while a timer is waiting
+		ios.run();
+
+		int waiting=0;
+		for (int i=0;i<TIMER_CNT;++i)
+		{
+			if (!test.timers_[i]->is_idle())
+				++waiting;
+		}
+		std::cout<<"fired:"<<test.fired_<<", early:"<<test.early_
+			<<", late:"<<test.late_<<"(max "<<test.max_late_<<" msec)"
+			<<", cancelled but fired:"<<test.stray_
+			<<", still waiting:"<<waiting<<std::endl;
+
+		bool testOk=(test.fired_>TIMER_CNT&&test.early_==0&&test.late_==0
+			&&test.stray_==0&&waiting==0);
+		std::cout<<(testOk?"timing wheel OK":"timing wheel FAILED")<<std::endl;
+		return testOk?0:1;
+	}
+}
@@ -0,0 +1,164 @@
+#include <p2engine/push_warning_option.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <ctime>
+#include <iostream>
+#include <p2engine/pop_warning_option.hpp>
+
+#include <p2engine/fssignal.hpp>
+#include <p2engine/rdp.hpp>
+
+using namespace p2engine;
+
+//microbenchmark of unreliable sending over urdp on loopback. One flow sends
+//MSG_PER_SEC small messages a second, half unreliable and half semireliable
+//(which are queued in the flow to be sent again), for RUN_SECONDS. It prints
+//the time spent in async_send_* and the CPU time of the whole process per
+//message, which includes the resends from the timing queue of the flow.
+
+std::string domain="/p2p/unreliable";
+
+typedef urdp_connection my_connection;
+typedef urdp_acceptor my_acceptor;
+
+inline endpoint server_endpoint()
+{
+	return endpoint(address(address_v4::loopback()),8891);
+}
+
+enum{
+	UNRELIABLE_MSG=1,
+	SEMIRELIABLE_MSG=2
+};
+
+enum{
+	MSG_SIZE=200,
+	MSG_PER_SEC=10000,
+	TICK_MSEC=10,
+	MSG_PER_TICK=MSG_PER_SEC*TICK_MSEC/1000,
+	RUN_SECONDS=5
+};
+
+class client
+	:public fssignal::trackable
+{
+	typedef client this_type;
+
+public:
+	client(io_service& ios):ios_(ios),sent_(0){}
+	void run()
+	{
+		socket_=my_connection::create(ios_,false);
+		socket_->connected_signal().bind(&this_type::on_connected,this,_1);
+		socket_->async_connect(server_endpoint(),domain);
+	}
+	int sent()const{return sent_;}
+	boost::posix_time::time_duration send_time()const{return send_time_;}
+
+private:
+	void on_connected(const error_code& ec)
+	{
+		std::cout<<"client connected, error_msg:"<<ec.message()<<std::endl;
+		if (ec)
+			return;
+		timer_=rough_timer::create(ios_);
+		timer_->time_signal().bind(&this_type::on_tick,this);
+		timer_->async_keep_waiting(milliseconds((int)TICK_MSEC),milliseconds((int)TICK_MSEC));
+	}
+	void on_tick()
+	{
+		if (sent_>=MSG_PER_SEC*RUN_SECONDS)
+		{
+			timer_->cancel();
+			return;
+		}
+		boost::posix_time::ptime t=boost::posix_time::microsec_clock::universal_time();
+		for (int i=0;i<MSG_PER_TICK;++i,++sent_)
+		{
+			safe_buffer buf(MSG_SIZE);
+			if (sent_%2)
+				socket_->async_send_semireliable(buf,SEMIRELIABLE_MSG);
+			else
+				socket_->async_send_unreliable(buf,UNRELIABLE_MSG);
+		}
+		send_time_+=boost::posix_time::microsec_clock::universal_time()-t;
+	}
+
+private:
+	io_service& ios_;
+	boost::shared_ptr<my_connection> socket_;
+	rough_timer::shared_ptr timer_;
+	int sent_;
+	boost::posix_time::time_duration send_time_;
+};
+
+class server
+	:public fssignal::trackable
+{
+	typedef server this_type;
+
+public:
+	server(io_service& ios):ios_(ios),recvd_(0){}
+	void run()
+	{
+		acceptor_=my_acceptor::create(ios_,false);
+		acceptor_->accepted_signal().bind(&this_type::on_accepted,this,_1,_2);
+		error_code ec;
+		acceptor_->listen(server_endpoint(),domain,ec);
+		if (!ec)
+			acceptor_->keep_async_accepting();
+		else
+			std::cout<<"listen error:"<<ec.message()<<std::endl;
+	}
+	int recvd()const{return recvd_;}
+
+private:
+	void on_accepted(boost::shared_ptr<basic_connection> socket,const error_code& ec)
+	{
+		if (ec)
+			return;
+		socket_=socket;
+		socket_->received_signal(UNRELIABLE_MSG).bind(&this_type::on_received,this,_1);
+		socket_->received_signal(SEMIRELIABLE_MSG).bind(&this_type::on_received,this,_1);
+	}
+	void on_received(safe_buffer buf)
+	{
+		if (buf.size()==MSG_SIZE)
+			++recvd_;
+	}
+
+private:
+	io_service& ios_;
+	boost::shared_ptr<my_acceptor> acceptor_;
+	boost::shared_ptr<basic_connection> socket_;
+	int recvd_;
+};
+
+int main()
+{
+	io_service ios;
+	server s(ios);
+	client c(ios);
+	s.run();
+	c.run();
+
+	rough_timer::shared_ptr timeout=rough_timer::create(ios);
+	timeout->time_signal().bind(&io_service::stop,&ios);
+	timeout->async_wait(seconds(RUN_SECONDS+2));
+
+	std::clock_t cpu=std::clock();
+	ios.run();
+	cpu=std::clock()-cpu;
+
+	double sent=(c.sent()?(double)c.sent():1.0);
+	std::cout<<"sent:"<<c.sent()<<", received:"<<s.recvd()<<std::endl;
+	std::cout<<"in async_send: "
+		<<c.send_time().total_nanoseconds()/sent<<" ns/msg"<<std::endl;
+	std::cout<<"process cpu: "
+		<<(double)cpu/CLOCKS_PER_SEC*1e9/sent<<" ns/msg"<<std::endl;
+
+	bool testOk=(c.sent()==MSG_PER_SEC*RUN_SECONDS&&s.recvd()>0);
+	std::cout<<(testOk?"unreliable benchmark OK":"unreliable benchmark FAILED")<<std::endl;
+	return testOk?0:1;
+}